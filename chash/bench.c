@@ -0,0 +1,616 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "chash.h"
+#include "hash_table.h"
+
+/* chash-bench: drives the hash_table.h API directly with YCSB-style
+   workloads and prints one CSV row per (workload, thread count).
+
+   A  50% read, 50% update          D  95% read (latest keys), 5% insert
+   B  95% read,  5% update          E  95% short scan (batch search), 5% insert
+   C 100% read                      F  50% read, 50% read-modify-write
+   X  custom mix from -m read:update:insert:delete
+
+   Keys are "user<id>"; the table is preloaded with ids [0, keys).  Reads,
+   updates and deletes pick ids from that range, uniformly or Zipfian;
+   inserts take fresh ids.  YCSB's scans have no equivalent in a hash
+   table, so E looks up 1-100 consecutive ids with ht_search_batch.
+
+   With -W every change of the run (not the preload) goes through a fresh
+   write-ahead log, once per group commit interval given with -F; the
+   commits_per_sync column is the average group size that interval got.
+
+   With -U the workers are instead clients of a running chash -s server,
+   one connection each, sending their operations as command lines in
+   windows of -P requests; the table is whatever the server holds, and
+   the ids are preloaded into it once.  Every operation of a window gets
+   the window's round trip as its latency.  F's read-modify-write adds
+   1 to the salary in one ht_add_salary call (remotely, one add). */
+
+#define BENCH_NAME_MAX 50
+#define SCAN_MAX 100
+
+typedef struct {
+    char name;
+    int read, update, insert, scan, rmw, del;  /* percent */
+    int latest;                                 /* reads favour recent inserts */
+} workload;
+
+static const workload workloads[] = {
+    { 'A', 50, 50, 0, 0, 0, 0, 0 },
+    { 'B', 95, 5, 0, 0, 0, 0, 0 },
+    { 'C', 100, 0, 0, 0, 0, 0, 0 },
+    { 'D', 95, 0, 5, 0, 0, 0, 1 },
+    { 'E', 0, 0, 5, 95, 0, 0, 0 },
+    { 'F', 50, 0, 0, 0, 50, 0, 0 },
+};
+#define NUM_WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+typedef struct {
+    unsigned long keys;
+    unsigned long ops;          /* per thread */
+    int zipf;                   /* 0 uniform, 1 Zipfian */
+    double theta;
+    unsigned long seed;
+    int lockfree;
+    ht_backend backend;
+    const char *wal_path;       /* NULL: no write-ahead log */
+    unsigned flush_us;
+    const char *sock_path;      /* NULL: in-process table */
+    unsigned depth;             /* requests per round trip with sock_path */
+} bench_config;
+
+/* xorshift64* */
+typedef struct {
+    uint64_t s;
+} rng;
+
+static uint64_t rng_next(rng *r) {
+    r->s ^= r->s >> 12;
+    r->s ^= r->s << 25;
+    r->s ^= r->s >> 27;
+    return r->s * 0x2545F4914F6CDD1DULL;
+}
+
+static double rng_unit(rng *r) {
+    return (rng_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Zipfian ranks over [0, n), the generator YCSB uses (Gray et al.,
+   "Quickly generating billion-record synthetic databases"); rank 0 is the
+   most popular.  Set up once per run, then shared read-only. */
+typedef struct {
+    uint64_t n;
+    double theta, alpha, zetan, eta, two_pow;
+} zipf_gen;
+
+static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i) sum += 1.0 / pow((double)i, theta);
+    return sum;
+}
+
+static void zipf_init(zipf_gen *z, uint64_t n, double theta) {
+    double zeta2 = zeta(2, theta);
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = zeta(n, theta);
+    z->eta = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+    z->two_pow = 1.0 + pow(0.5, theta);
+}
+
+static uint64_t zipf_next(const zipf_gen *z, rng *r) {
+    double u = rng_unit(r);
+    double uz = u * z->zetan;
+    if (uz < 1.0) return 0;
+    if (uz < z->two_pow) return 1;
+    uint64_t k = (uint64_t)((double)z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return k < z->n ? k : z->n - 1;
+}
+
+/* Log-linear latency histogram: exact below 16 ns, then 16 sub-buckets per
+   power of two (about 6% resolution). */
+#define HIST_SUB 16
+#define HIST_BUCKETS (61 * HIST_SUB)
+
+typedef struct {
+    uint64_t count[HIST_BUCKETS];
+} histogram;
+
+static int hist_index(uint64_t ns) {
+    if (ns < HIST_SUB) return (int)ns;
+    int msb = 63 - __builtin_clzll(ns);
+    return (msb - 3) * HIST_SUB + (int)((ns >> (msb - 4)) & (HIST_SUB - 1));
+}
+
+/* smallest value that lands in bucket i */
+static uint64_t hist_value(int i) {
+    if (i < HIST_SUB) return (uint64_t)i;
+    int msb = i / HIST_SUB + 3;
+    return (uint64_t)(HIST_SUB + i % HIST_SUB) << (msb - 4);
+}
+
+static uint64_t hist_percentile(const histogram *h, uint64_t total, double pct) {
+    uint64_t want = (uint64_t)ceil(total * pct / 100.0), seen = 0;
+    if (want == 0) want = 1;
+    for (int i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->count[i];
+        if (seen >= want) return hist_value(i);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* shared by the workers of one run */
+static const bench_config *cfg;
+static const workload *wl;
+static zipf_gen zipf;
+static unsigned long next_id;           /* next fresh id for inserts */
+static pthread_barrier_t start_barrier;
+
+typedef struct {
+    pthread_t tid;
+    int id;
+    rng r;
+    uint64_t start_ns, end_ns;
+    uint64_t ops;
+    histogram hist;
+} worker_ctx;
+
+static size_t key_name(char *buf, unsigned long id) {
+    return (size_t)snprintf(buf, BENCH_NAME_MAX, "user%lu", id);
+}
+
+static unsigned long pick_id(worker_ctx *w) {
+    if (wl->latest) {
+        /* D: the most recently inserted ids are the hottest */
+        unsigned long latest = __atomic_load_n(&next_id, __ATOMIC_RELAXED) - 1;
+        uint64_t back = cfg->zipf ? zipf_next(&zipf, &w->r) : rng_next(&w->r) % cfg->keys;
+        return back > latest ? 0 : latest - back;
+    }
+    return cfg->zipf ? zipf_next(&zipf, &w->r) : rng_next(&w->r) % cfg->keys;
+}
+
+static void *bench_worker(void *arg) {
+    worker_ctx *w = arg;
+    char name[BENCH_NAME_MAX];
+    char scan_names[SCAN_MAX][BENCH_NAME_MAX];
+    const char *scan_ptrs[SCAN_MAX];
+    uint64_t scan_keys[SCAN_MAX];
+    hashRecord scan_out[SCAN_MAX];
+    int scan_found[SCAN_MAX];
+    hashRecord rec;
+
+    pthread_barrier_wait(&start_barrier);
+    w->start_ns = now_ns();
+    for (unsigned long i = 0; i < cfg->ops; ++i) {
+        int dice = (int)(rng_next(&w->r) % 100);
+        uint64_t t0, t1;
+        if ((dice -= wl->insert) < 0) {
+            key_name(name, __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED));
+            uint64_t key = key_hash(name);
+            uint32_t h = jenkins_one_at_a_time_hash(name);
+            t0 = now_ns();
+            ht_insert(name, (uint32_t)i, key, h, w->id);
+            t1 = now_ns();
+        } else if ((dice -= wl->scan) < 0) {
+            unsigned long first = pick_id(w);
+            int len = 1 + (int)(rng_next(&w->r) % SCAN_MAX);
+            for (int k = 0; k < len; ++k) {
+                key_name(scan_names[k], (first + (unsigned long)k) % cfg->keys);
+                scan_ptrs[k] = scan_names[k];
+                scan_keys[k] = key_hash(scan_names[k]);
+            }
+            t0 = now_ns();
+            ht_search_batch(scan_ptrs, scan_keys, (size_t)len, w->id, scan_out, scan_found);
+            t1 = now_ns();
+        } else {
+            key_name(name, pick_id(w));
+            uint64_t key = key_hash(name);
+            if ((dice -= wl->update) < 0) {
+                t0 = now_ns();
+                ht_update(name, (uint32_t)i, key, w->id, NULL);
+                t1 = now_ns();
+            } else if ((dice -= wl->rmw) < 0) {
+                t0 = now_ns();
+                ht_add_salary(name, 1, key, w->id, NULL);
+                t1 = now_ns();
+            } else if ((dice -= wl->del) < 0) {
+                t0 = now_ns();
+                ht_delete(name, key, w->id, NULL);
+                t1 = now_ns();
+            } else {
+                t0 = now_ns();
+                ht_search_into(name, key, w->id, &rec);
+                t1 = now_ns();
+            }
+        }
+        w->hist.count[hist_index(t1 - t0)]++;
+    }
+    w->end_ns = now_ns();
+    w->ops = cfg->ops;
+    return NULL;
+}
+
+static void preload(unsigned long keys) {
+    char name[BENCH_NAME_MAX];
+    for (unsigned long id = 0; id < keys; ++id) {
+        key_name(name, id);
+        ht_insert(name, (uint32_t)id, key_hash(name), jenkins_one_at_a_time_hash(name), -1);
+    }
+    next_id = keys;
+}
+
+static int remote_connect(void) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", cfg->sock_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Sends len bytes of requests and reads until nanswers answers, each
+   ending in an empty line, are in.  Sending and reading overlap, since
+   the server stops reading while too many answers wait.  0 or -1. */
+static int remote_round(int fd, const char *req, size_t len, unsigned long nanswers, char *last) {
+    char buf[64 * 1024];
+    size_t sent = 0;
+    while (nanswers > 0) {
+        struct pollfd p = { fd, (short)(POLLIN | (sent < len ? POLLOUT : 0)), 0 };
+        if (poll(&p, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (p.revents & POLLOUT) {
+            ssize_t w = send(fd, req + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (w < 0 && errno != EAGAIN && errno != EINTR) return -1;
+            if (w > 0) sent += (size_t)w;
+        }
+        if (p.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t r = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) return -1;
+            for (ssize_t i = 0; i < r; ++i) {
+                if (buf[i] == '\n' && *last == '\n') nanswers--;
+                *last = buf[i];
+            }
+        }
+    }
+    return 0;
+}
+
+/* Appends the request line of one operation to req */
+static void remote_op(worker_ctx *w, unsigned long i, char *req, size_t *len) {
+    char name[BENCH_NAME_MAX];
+    char *p = req + *len;
+    int dice = (int)(rng_next(&w->r) % 100);
+    if ((dice -= wl->insert) < 0) {
+        key_name(name, __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED));
+        p += sprintf(p, "insert,%s,%lu,0\n", name, i);
+    } else if ((dice -= wl->scan) < 0) {
+        unsigned long first = pick_id(w);
+        int n = 1 + (int)(rng_next(&w->r) % SCAN_MAX);
+        p += sprintf(p, "multisearch,");
+        for (int k = 0; k < n; ++k) {
+            p += key_name(p, (first + (unsigned long)k) % cfg->keys);
+            *p++ = k + 1 < n ? ';' : ',';
+        }
+        p += sprintf(p, "0,0\n");
+    } else {
+        key_name(name, pick_id(w));
+        if ((dice -= wl->update) < 0) {
+            p += sprintf(p, "update,%s,%lu,0\n", name, i);
+        } else if ((dice -= wl->rmw) < 0) {
+            p += sprintf(p, "add,%s,1,0\n", name);
+        } else if ((dice -= wl->del) < 0) {
+            p += sprintf(p, "delete,%s,0,0\n", name);
+        } else {
+            p += sprintf(p, "search,%s,0,0\n", name);
+        }
+    }
+    *len = (size_t)(p - req);
+}
+
+/* the longest request one operation appends */
+#define REMOTE_OP_MAX (SCAN_MAX * BENCH_NAME_MAX + 64)
+
+static void *remote_worker(void *arg) {
+    worker_ctx *w = arg;
+    char *req = malloc(cfg->depth * REMOTE_OP_MAX);
+    int fd = remote_connect();
+    if (!req || fd < 0) {
+        perror(cfg->sock_path);
+        exit(1);
+    }
+    char last = 0;
+
+    pthread_barrier_wait(&start_barrier);
+    w->start_ns = now_ns();
+    for (unsigned long i = 0; i < cfg->ops; ) {
+        unsigned long n = 0;
+        size_t len = 0;
+        for (; n < cfg->depth && i < cfg->ops; ++n, ++i) remote_op(w, i, req, &len);
+        uint64_t t0 = now_ns();
+        if (remote_round(fd, req, len, n, &last) != 0) {
+            perror(cfg->sock_path);
+            exit(1);
+        }
+        w->hist.count[hist_index(now_ns() - t0)] += n;
+    }
+    w->end_ns = now_ns();
+    w->ops = cfg->ops;
+    close(fd);
+    free(req);
+    return NULL;
+}
+
+/* inserts the ids [0, keys) into the server, 1024 to a round trip */
+static void remote_preload(unsigned long keys) {
+    char *req = malloc(1024 * REMOTE_OP_MAX);
+    int fd = remote_connect();
+    if (!req || fd < 0) {
+        perror(cfg->sock_path);
+        exit(1);
+    }
+    char last = 0;
+    for (unsigned long id = 0; id < keys; ) {
+        size_t len = 0;
+        unsigned long n = 0;
+        for (; n < 1024 && id < keys; ++n, ++id) {
+            char *p = req + len;
+            p += sprintf(p, "insert,");
+            p += key_name(p, id);
+            p += sprintf(p, ",%lu,0\n", id);
+            len = (size_t)(p - req);
+        }
+        if (remote_round(fd, req, len, n, &last) != 0) {
+            perror(cfg->sock_path);
+            exit(1);
+        }
+    }
+    close(fd);
+    free(req);
+    next_id = keys;
+}
+
+/* one row: fresh table, preload, run nthreads workers to completion */
+static int run_one(const workload *w, int nthreads) {
+    worker_ctx *ctx = calloc((size_t)nthreads, sizeof(worker_ctx));
+    histogram *total = calloc(1, sizeof(histogram));
+    if (!ctx || !total) {
+        perror("calloc");
+        free(ctx);
+        free(total);
+        return -1;
+    }
+    wl = w;
+    if (cfg->sock_path) {
+        static int preloaded;
+        if (!preloaded) remote_preload(cfg->keys);
+        preloaded = 1;
+    } else {
+        ht_init();
+        preload(cfg->keys);
+    }
+    if (cfg->wal_path) {
+        unlink(cfg->wal_path);
+        if (ht_wal_open(cfg->wal_path, cfg->flush_us) < 0) {
+            perror(cfg->wal_path);
+            exit(1);
+        }
+    }
+    pthread_barrier_init(&start_barrier, NULL, (unsigned)nthreads);
+
+    int started = 0;
+    for (; started < nthreads; ++started) {
+        ctx[started].id = started;
+        ctx[started].r.s = (cfg->seed + 1) * 0x9E3779B97F4A7C15ULL + (uint64_t)started * 0xBF58476D1CE4E5B9ULL;
+        if (ctx[started].r.s == 0) ctx[started].r.s = 1;
+        if (pthread_create(&ctx[started].tid, NULL, cfg->sock_path ? remote_worker : bench_worker,
+                           &ctx[started]) != 0)
+            break;
+    }
+    if (started < nthreads) {
+        /* the barrier counts nthreads; a partial run would never start */
+        perror("pthread_create");
+        exit(1);
+    }
+
+    uint64_t first = UINT64_MAX, last = 0, ops = 0;
+    for (int i = 0; i < nthreads; ++i) {
+        pthread_join(ctx[i].tid, NULL);
+        if (ctx[i].start_ns < first) first = ctx[i].start_ns;
+        if (ctx[i].end_ns > last) last = ctx[i].end_ns;
+        ops += ctx[i].ops;
+        for (int b = 0; b < HIST_BUCKETS; ++b) total->count[b] += ctx[i].hist.count[b];
+    }
+    pthread_barrier_destroy(&start_barrier);
+    wal_stats ws = { 0 };
+    char wal_col[16] = "off", per_sync[16] = "", depth_col[16] = "";
+    const char *read_mode = cfg->lockfree ? "lockfree" : "locked", *backend = ht_backend_name(cfg->backend);
+    if (cfg->sock_path) {
+        snprintf(depth_col, sizeof(depth_col), "%u", cfg->depth);
+        read_mode = "remote";
+        backend = "server";
+    } else {
+        ht_get_wal_stats(&ws);
+        ht_destroy();
+    }
+    if (cfg->wal_path) {
+        snprintf(wal_col, sizeof(wal_col), "%u", cfg->flush_us);
+        snprintf(per_sync, sizeof(per_sync), "%.1f", ws.syncs ? (double)ws.commits / (double)ws.syncs : 0.0);
+    }
+
+    double secs = (double)(last - first) / 1e9;
+    printf("%c,%s,%d,%lu,%llu,%.4f,%.0f,%llu,%llu,%llu,%s,%s,%s,%s,%s\n",
+           w->name, cfg->zipf ? "zipf" : "uniform", nthreads, cfg->keys,
+           (unsigned long long)ops, secs, secs > 0 ? (double)ops / secs : 0.0,
+           (unsigned long long)hist_percentile(total, ops, 50.0),
+           (unsigned long long)hist_percentile(total, ops, 99.0),
+           (unsigned long long)hist_percentile(total, ops, 99.9),
+           read_mode, backend, wal_col, per_sync, depth_col);
+    fflush(stdout);
+    free(ctx);
+    free(total);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-w ABCDEF] [-m read:update:insert:delete] [-k keys] [-n ops]\n"
+                    "          [-t threads,...] [-d uniform|zipf] [-z theta] [-s seed]\n"
+                    "          [-b chain|swiss|compact[,...]] [-l] [-W wal [-F us,...]]\n"
+                    "          [-U socket [-P depth,...]] [-H]\n"
+                    "  -w  YCSB workloads to run (default ABCDEF)\n"
+                    "  -m  also run a custom mix X, in percent\n"
+                    "  -k  records preloaded (default 100000)\n"
+                    "  -n  operations per thread (default 100000)\n"
+                    "  -t  thread counts (default 1,2,4,... up to the online CPUs)\n"
+                    "  -d  key distribution (default zipf)\n"
+                    "  -z  Zipfian skew (default 0.99)\n"
+                    "  -s  random seed (default 1)\n"
+                    "  -b  table backends to run (default chain)\n"
+                    "  -l  lock-free reads (chain backend)\n"
+                    "  -W  log changes to this write-ahead log file (recreated per row)\n"
+                    "  -F  group commit intervals in microseconds for -W (default 0)\n"
+                    "  -U  run as clients of the chash -s server on this socket\n"
+                    "  -P  requests per round trip for -U (default 1)\n"
+                    "  -H  no CSV header\n", prog);
+}
+
+int main(int argc, char **argv) {
+    static bench_config config = { 100000, 100000, 1, 0.99, 1, 0, HT_BACKEND_CHAIN, NULL, 0, NULL, 1 };
+    const char *which = "ABCDEF";
+    const char *threads_arg = NULL;
+    const char *flush_arg = "0";
+    const char *depth_arg = "1";
+    const char *backends_arg = "chain";
+    int header = 1, custom = 0;
+    workload mix = { 'X', 0, 0, 0, 0, 0, 0, 0 };
+    int opt;
+    while ((opt = getopt(argc, argv, "w:m:k:n:t:d:z:s:b:lW:F:U:P:H")) != -1) {
+        switch (opt) {
+        case 'w': which = optarg; break;
+        case 'm':
+            if (sscanf(optarg, "%d:%d:%d:%d", &mix.read, &mix.update, &mix.insert, &mix.del) != 4 ||
+                mix.read < 0 || mix.update < 0 || mix.insert < 0 || mix.del < 0 ||
+                mix.read + mix.update + mix.insert + mix.del != 100) {
+                fprintf(stderr, "-m needs four percentages that add up to 100\n");
+                return 1;
+            }
+            custom = 1;
+            break;
+        case 'k': config.keys = strtoul(optarg, NULL, 10); break;
+        case 'n': config.ops = strtoul(optarg, NULL, 10); break;
+        case 't': threads_arg = optarg; break;
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0) config.zipf = 0;
+            else if (strcmp(optarg, "zipf") == 0) config.zipf = 1;
+            else { usage(argv[0]); return 1; }
+            break;
+        case 'z': config.theta = atof(optarg); break;
+        case 's': config.seed = strtoul(optarg, NULL, 10); break;
+        case 'b': backends_arg = optarg; break;
+        case 'l': config.lockfree = 1; break;
+        case 'W': config.wal_path = optarg; break;
+        case 'F': flush_arg = optarg; break;
+        case 'U': config.sock_path = optarg; break;
+        case 'P': depth_arg = optarg; break;
+        case 'H': header = 0; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    if (config.keys < 2 || config.theta <= 0 || config.theta >= 1 || (config.sock_path && config.wal_path)) {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg = &config;
+    if (config.lockfree) ht_set_read_mode(HT_READ_LOCKFREE);
+    if (config.zipf) zipf_init(&zipf, config.keys, config.theta);
+
+    int counts[64], ncounts = 0;
+    if (threads_arg) {
+        char *copy = strdup(threads_arg), *save = NULL;
+        for (char *tok = strtok_r(copy, ",", &save); tok && ncounts < 64; tok = strtok_r(NULL, ",", &save)) {
+            int t = atoi(tok);
+            if (t < 1) { usage(argv[0]); return 1; }
+            counts[ncounts++] = t;
+        }
+        free(copy);
+    } else {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpu < 1) ncpu = 1;
+        for (long t = 1; t < ncpu && ncounts < 63; t *= 2) counts[ncounts++] = (int)t;
+        counts[ncounts++] = (int)ncpu;
+    }
+
+    ht_backend backends[8];
+    int nbackends = 0;
+    char *copy = strdup(backends_arg), *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok && nbackends < 8; tok = strtok_r(NULL, ",", &save)) {
+        if (ht_parse_backend(tok, &backends[nbackends++]) != 0) { usage(argv[0]); return 1; }
+    }
+    free(copy);
+
+    unsigned flushes[16];
+    int nflushes = 0;
+    copy = strdup(flush_arg);
+    for (char *tok = strtok_r(copy, ",", &save); tok && nflushes < 16; tok = strtok_r(NULL, ",", &save))
+        flushes[nflushes++] = (unsigned)strtoul(tok, NULL, 10);
+    free(copy);
+    if (!config.wal_path) nflushes = 1;
+
+    unsigned depths[16];
+    int ndepths = 0;
+    copy = strdup(depth_arg);
+    for (char *tok = strtok_r(copy, ",", &save); tok && ndepths < 16; tok = strtok_r(NULL, ",", &save)) {
+        depths[ndepths] = (unsigned)strtoul(tok, NULL, 10);
+        if (depths[ndepths++] < 1) { usage(argv[0]); return 1; }
+    }
+    free(copy);
+    /* the server has its own backend */
+    if (config.sock_path) nbackends = 1;
+    else ndepths = 1;
+
+    if (header) printf("workload,distribution,threads,keys,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,read_mode,backend,wal_flush_us,commits_per_sync,pipeline\n");
+    for (int b = 0; b < nbackends; ++b) {
+        config.backend = backends[b];
+        ht_set_backend(backends[b]);
+        for (int f = 0; f < nflushes * ndepths; ++f) {
+            config.flush_us = flushes[f % nflushes];
+            config.depth = depths[f / nflushes];
+            for (const char *c = which; *c; ++c) {
+                const workload *w = NULL;
+                for (int i = 0; i < NUM_WORKLOADS; ++i) if (workloads[i].name == *c) w = &workloads[i];
+                if (!w) {
+                    fprintf(stderr, "unknown workload %c\n", *c);
+                    return 1;
+                }
+                for (int i = 0; i < ncounts; ++i) if (run_one(w, counts[i]) != 0) return 1;
+            }
+            if (custom) {
+                for (int i = 0; i < ncounts; ++i) if (run_one(&mix, counts[i]) != 0) return 1;
+            }
+        }
+    }
+    if (config.wal_path) unlink(config.wal_path);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cache.h"
+
+int cache_capped;
+uint64_t cache_bytes;
+
+static uint64_t limit_records;
+static uint64_t limit_bytes;
+static uint64_t evictions;
+
+void cache_set_limits(uint64_t max_records, uint64_t max_bytes) {
+    limit_records = max_records;
+    limit_bytes = max_bytes;
+    cache_capped = max_records != 0 || max_bytes != 0;
+}
+
+void cache_get_limits(uint64_t *max_records, uint64_t *max_bytes) {
+    *max_records = limit_records;
+    *max_bytes = limit_bytes;
+}
+
+/* Lookup counters, one block per thread as in stats.c: the owner is the
+   only writer and stores with relaxed atomics; blocks of exited threads
+   are folded into `retired` and recycled. */
+typedef struct cache_block {
+    uint64_t hits, misses;
+    struct cache_block *next;
+} __attribute__((aligned(64))) cache_block;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_block *live_blocks;
+static cache_block *spare_blocks;
+static uint64_t retired_hits, retired_misses;
+static pthread_key_t block_key;
+static pthread_once_t block_key_once = PTHREAD_ONCE_INIT;
+
+static __thread cache_block *my_block;
+
+static void block_release(void *arg) {
+    cache_block *b = arg;
+    pthread_mutex_lock(&cache_mutex);
+    retired_hits += b->hits;
+    retired_misses += b->misses;
+    for (cache_block **link = &live_blocks; *link; link = &(*link)->next) {
+        if (*link == b) {
+            *link = b->next;
+            break;
+        }
+    }
+    b->next = spare_blocks;
+    spare_blocks = b;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+static void make_block_key(void) {
+    pthread_key_create(&block_key, block_release);
+}
+
+static cache_block *block_register(void) {
+    pthread_once(&block_key_once, make_block_key);
+    pthread_mutex_lock(&cache_mutex);
+    cache_block *b = spare_blocks;
+    if (b) {
+        spare_blocks = b->next;
+    } else if (posix_memalign((void **)&b, 64, sizeof(*b)) != 0) {
+        pthread_mutex_unlock(&cache_mutex);
+        return NULL;
+    }
+    b->hits = b->misses = 0;
+    b->next = live_blocks;
+    live_blocks = b;
+    pthread_mutex_unlock(&cache_mutex);
+    pthread_setspecific(block_key, b);
+    my_block = b;
+    return b;
+}
+
+void cache_count_lookups(uint64_t hits, uint64_t misses) {
+    cache_block *b = my_block ? my_block : block_register();
+    if (!b) return;
+    __atomic_store_n(&b->hits, b->hits + hits, __ATOMIC_RELAXED);
+    __atomic_store_n(&b->misses, b->misses + misses, __ATOMIC_RELAXED);
+}
+
+void cache_count_eviction(void) {
+    __atomic_fetch_add(&evictions, 1, __ATOMIC_RELAXED);
+}
+
+void cache_get_counters(uint64_t *hits, uint64_t *misses, uint64_t *evicted) {
+    pthread_mutex_lock(&cache_mutex);
+    uint64_t h = retired_hits, m = retired_misses;
+    for (cache_block *b = live_blocks; b; b = b->next) {
+        h += __atomic_load_n(&b->hits, __ATOMIC_RELAXED);
+        m += __atomic_load_n(&b->misses, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    *hits = h;
+    *misses = m;
+    *evicted = __atomic_load_n(&evictions, __ATOMIC_RELAXED);
+}
+
+void cache_reset(void) {
+    pthread_mutex_lock(&cache_mutex);
+    retired_hits = retired_misses = 0;
+    for (cache_block *b = live_blocks; b; b = b->next) {
+        __atomic_store_n(&b->hits, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&b->misses, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    evictions = 0;
+    cache_bytes = 0;
+}
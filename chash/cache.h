@@ -0,0 +1,52 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+/* Bounded cache mode: limits, memory accounting and counters.
+
+   Every structure the table allocates for its records is charged to one
+   byte count as it is allocated and released as it is freed: records
+   (chain nodes at their slab size class, swiss slots, compact slot
+   arrays and name arenas, long names), bucket and slot arrays, the
+   salary index, and the loaded snapshot's records and reference bytes.
+
+   Each record has a reference byte, set by lookups and updates with a
+   plain relaxed store (so a reader never needs more than the read lock
+   it already holds) and cleared by the CLOCK hand of its stripe as it
+   passes.  The store is skipped while no limit is set and when the byte
+   is already set, so a hot record's line is not written on every read.
+
+   Hits and misses are counted per thread without locking, as the
+   statistics are (stats.h), and summed when read. */
+
+/* 0 means no limit; set before ht_init */
+void cache_set_limits(uint64_t max_records, uint64_t max_bytes);
+void cache_get_limits(uint64_t *max_records, uint64_t *max_bytes);
+
+extern int cache_capped;        /* a limit is set */
+extern uint64_t cache_bytes;    /* bytes charged */
+
+static inline void cache_charge(int64_t bytes) {
+    __atomic_fetch_add(&cache_bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+}
+
+static inline void cache_touch(uint8_t *ref) {
+    if (cache_capped && !__atomic_load_n(ref, __ATOMIC_RELAXED)) __atomic_store_n(ref, 1, __ATOMIC_RELAXED);
+}
+
+/* clears *ref; returns whether it was set */
+static inline int cache_clear_ref(uint8_t *ref) {
+    if (!__atomic_load_n(ref, __ATOMIC_RELAXED)) return 0;
+    __atomic_store_n(ref, 0, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/* counts lookups by the calling thread */
+void cache_count_lookups(uint64_t hits, uint64_t misses);
+void cache_count_eviction(void);
+void cache_get_counters(uint64_t *hits, uint64_t *misses, uint64_t *evictions);
+/* zeroes the counters and the byte count; only while nothing runs */
+void cache_reset(void);
+
+#endif /* CACHE_H */
@@ -2,357 +2,875 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
-#include <stdarg.h>
 #include <unistd.h>
-#include <sys/time.h>
 #include "chash.h"
 #include "hash_table.h"
-
-/* logging file and mutex */
-static FILE *log_fp = NULL;
-static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+#include "logger.h"
+#include "workq.h"
+#include "ingest.h"
+#include "stats.h"
+#include "console.h"
+#include "server.h"
 
 /* scheduling state */
-/* active_priority = the priority currently being executed (starts at min found) */
+/* Every command owns one slot of the schedule: ascending priority, FIFO
+   within a priority.  next_slot is the slot allowed to run.  A worker
+   waiting for a later slot parks on its own condition variable and
+   advertises the slot in waiting_slot[], so a finishing command signals
+   exactly its successor instead of broadcasting to every waiter. */
 static pthread_mutex_t sched_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t sched_cv = PTHREAD_COND_INITIALIZER;
-static int active_priority = -1;
+static int next_slot = 0;
+static pthread_cond_t *worker_cv = NULL;
+static int *waiting_slot = NULL;        /* slot each worker waits for, or -1 */
+
+/* sched_mutex with wait/hold statistics; time parked in a condition wait
+   is not counted as held */
+#if HT_STATS
+static __thread uint64_t sched_held;
+#endif
+
+static void sched_lock(void) {
+    STATS_TIME(t0);
+    pthread_mutex_lock(&sched_mutex);
+    STATS_LAP(ST_SCHED_WAIT, t0, sched_held);
+}
 
-/* For FIFO within a priority, maintain next_seq_to_run[priority] and counts */
-static int *next_seq_to_run = NULL;     /* next sequence number to run for priority p */
-static int *count_for_prio = NULL;      /* number of commands with priority p */
-static int max_priority = -1;
+static void sched_unlock(void) {
+    STATS_SINCE(ST_SCHED_HOLD, sched_held);
+    pthread_mutex_unlock(&sched_mutex);
+}
 
-/* parsed commands array (one entry per command) */
+static void sched_wait(pthread_cond_t *cv) {
+    STATS_SINCE(ST_SCHED_HOLD, sched_held);
+    pthread_cond_wait(cv, &sched_mutex);
+    STATS_MARK(sched_held);
+}
+
+/* parsed commands array (one entry per command, file order) */
 static command_t *commands = NULL;
 static int num_commands = 0;
 
-/* Utility: write to hash.log with microsecond timestamp messages already provided by caller */
-void log_message(const char *fmt, ...) {
-    pthread_mutex_lock(&log_mutex);
-    if (!log_fp) {
-        log_fp = fopen("hash.log", "w");
-        if (!log_fp) {
-            perror("log open");
-            pthread_mutex_unlock(&log_mutex);
-            return;
-        }
-    }
-    va_list ap;
-    va_start(ap, fmt);
-    vfprintf(log_fp, fmt, ap);
-    fprintf(log_fp, "\n");
-    fflush(log_fp);
-    va_end(ap);
-    pthread_mutex_unlock(&log_mutex);
+/* Streaming (-S): the parser appends commands to fixed-size chunks and
+   publishes them a batch at a time; workers take them in file order,
+   which is the schedule because the file must be sorted by priority. */
+#define STREAM_CHUNK 4096       /* commands per chunk */
+#define STREAM_BATCH 256        /* commands per publish */
+static command_t **stream_chunks = NULL;
+static int stream_nchunks = 0;
+static int stream_published = 0;        /* protected by sched_mutex */
+static int stream_taken = 0;            /* protected by sched_mutex */
+static int stream_eof = 0;              /* protected by sched_mutex */
+
+/* worker pool: one queue per worker, filled before pool_ready is set */
+static workq *queues = NULL;
+static int num_workers = 0;
+static int pool_ready = 0;
+
+/* next ';'-separated item of a list, trimmed; *p advances past it */
+static size_t next_item(const char **p, const char *end, const char **item) {
+    const char *a = *p, *b = memchr(a, ';', (size_t)(end - a));
+    if (!b) b = end;
+    *p = b < end ? b + 1 : end;
+    while (a < b && (*a == ' ' || *a == '\t')) a++;
+    while (b > a && (b[-1] == ' ' || b[-1] == '\t')) b--;
+    *item = a;
+    return (size_t)(b - a);
 }
 
-long long current_timestamp_us(void) {
-    struct timeval te;
-    gettimeofday(&te, NULL);
-    return (long long)te.tv_sec * 1000000LL + te.tv_usec;
+/* hash.log event of a delete, update or search.  Only inserts need the
+   Jenkins hash for the table, so the others compute it just for the log. */
+static void log_op(log_event_type type, int prio, const char *name, uint32_t salary) {
+    if (log_enabled(type)) log_event(type, prio, jenkins_one_at_a_time_hash(name), name, salary);
 }
 
-/* Jenkins one-at-a-time hash */
-uint32_t jenkins_one_at_a_time_hash(const char *key) {
-    uint32_t hash = 0;
-    while (*key) {
-        hash += (unsigned char)(*key++);
-        hash += (hash << 10);
-        hash ^= (hash >> 6);
-    }
-    hash += (hash << 3);
-    hash ^= (hash >> 11);
-    hash += (hash << 15);
-    return hash;
+/* the arrays of a multisearch/multiinsert, one allocation each so every
+   one is typed (and, for the batch calls' inputs, zeroed) from the start */
+typedef struct {
+    uint64_t *keys;
+    const char **names;
+    uint32_t *hashes;
+    uint32_t *salaries;
+    int *rc;
+    hashRecord *recs;           /* multisearch only */
+    char *text;                 /* the names, each NUL-terminated */
+} multi_arrays;
+
+static void multi_free(multi_arrays *a) {
+    free(a->keys);
+    free(a->names);
+    free(a->hashes);
+    free(a->salaries);
+    free(a->rc);
+    free(a->recs);
+    free(a->text);
 }
 
-/* trim helper */
-static char *trim(char *s) {
-    if (!s) return s;
-    while (*s == ' ' || *s == '\t') s++;
-    char *end = s + strlen(s) - 1;
-    while (end >= s && (*end == '\n' || *end == '\r' || *end == ' ' || *end == '\t')) { *end = '\0'; end--; }
-    return s;
+static int multi_alloc(multi_arrays *a, const command_t *cmd) {
+    size_t n = cmd->nkeys;
+    a->keys = calloc(n, sizeof(*a->keys));
+    a->names = calloc(n, sizeof(*a->names));
+    a->hashes = calloc(n, sizeof(*a->hashes));
+    a->salaries = calloc(n, sizeof(*a->salaries));
+    a->rc = calloc(n, sizeof(*a->rc));
+    a->recs = cmd->type == CMD_MULTISEARCH ? calloc(n, sizeof(*a->recs)) : NULL;
+    a->text = malloc(cmd->names_len + n);
+    if (a->keys && a->names && a->hashes && a->salaries && a->rc && a->text &&
+        (cmd->type != CMD_MULTISEARCH || a->recs))
+        return 0;
+    multi_free(a);
+    return -1;
 }
 
-/* Parse a single CSV line into command_t; returns 0 on success, -1 on failure, 1 if header 'threads' processed */
-static int parse_line_to_command(const char *line, command_t *out) {
-    char *copy = strdup(line);
-    if (!copy) return -1;
-    char *tokens[16];
-    int t = 0;
-    char *p = copy;
-    while (t < 16) {
-        char *tok = strsep(&p, ",");
-        if (!tok) break;
-        tokens[t++] = trim(tok);
+/* multisearch/multiinsert: one batch call for every key of the command,
+   then one console line per key in list order */
+static void exec_multi(const command_t *cmd) {
+    size_t n = cmd->nkeys;
+    multi_arrays a;
+    if (multi_alloc(&a, cmd) != 0) {
+        perror("malloc");
+        return;
     }
-    if (t == 0) { free(copy); return -1; }
 
-    if (strcasecmp(tokens[0], "threads") == 0) {
-        /* header: threads,<N>,... we'll just ignore the explicit N in parsing because we derive counts */
-        free(copy);
-        return 1;
+    char *text = a.text;
+    const char *p = cmd->names, *end = cmd->names + cmd->names_len;
+    const char *sp = cmd->salaries, *send = cmd->salaries + cmd->salaries_len;
+    for (size_t i = 0; i < n; ++i) {
+        const char *item;
+        size_t len = next_item(&p, end, &item);
+        memcpy(text, item, len);
+        text[len] = '\0';
+        a.names[i] = text;
+        text += len + 1;
+        a.keys[i] = key_hash_len(a.names[i], len);
+        a.salaries[i] = 0;
+        a.hashes[i] = 0;
+        if (cmd->type == CMD_MULTIINSERT) {
+            a.hashes[i] = jenkins_one_at_a_time_hash(a.names[i]);
+            len = next_item(&sp, send, &item);
+            a.salaries[i] = (uint32_t)strtol(item, NULL, 10);
+            log_event(EV_INSERT, cmd->priority, a.hashes[i], a.names[i], a.salaries[i]);
+        } else {
+            log_op(EV_SEARCH, cmd->priority, a.names[i], 0);
+        }
     }
 
-    /* last token is priority */
-    int priority = atoi(tokens[t-1]);
-
-    /* initialize */
-    out->priority = priority;
-    out->seq = -1;
-    out->salary = 0;
-    out->original_index = -1;
-    out->type = CMD_INVALID;
-    out->name[0] = '\0';
-
-    if (strcasecmp(tokens[0], "insert") == 0) {
-        if (t < 4) { free(copy); return -1; }
-        strncpy(out->name, tokens[1], sizeof(out->name)-1);
-        out->salary = (uint32_t)atoi(tokens[t-2]); /* second-last is salary */
-        out->type = CMD_INSERT;
-    } else if (strcasecmp(tokens[0], "delete") == 0) {
-        if (t < 3) { free(copy); return -1; }
-        strncpy(out->name, tokens[1], sizeof(out->name)-1);
-        out->type = CMD_DELETE;
-    } else if (strcasecmp(tokens[0], "update") == 0) {
-        /* formats vary; typically: update,Name,newSalary,priority */
-        if (t < 4) { free(copy); return -1; }
-        strncpy(out->name, tokens[1], sizeof(out->name)-1);
-        out->salary = (uint32_t)atoi(tokens[t-2]);
-        out->type = CMD_UPDATE;
-    } else if (strcasecmp(tokens[0], "search") == 0) {
-        if (t < 3) { free(copy); return -1; }
-        strncpy(out->name, tokens[1], sizeof(out->name)-1);
-        out->type = CMD_SEARCH;
-    } else if (strcasecmp(tokens[0], "print") == 0) {
-        out->type = CMD_PRINT;
+    if (cmd->type == CMD_MULTIINSERT) {
+        ht_insert_batch(a.names, a.salaries, a.keys, a.hashes, n, cmd->priority, a.rc);
+        for (size_t i = 0; i < n; ++i) {
+            if (a.rc[i] == 0) console_printf("Inserted %u,%s,%u\n", a.hashes[i], a.names[i], a.salaries[i]);
+            else console_printf("Insert failed. Entry %u is a duplicate.\n", a.hashes[i]);
+        }
     } else {
-        free(copy);
-        return -1;
+        ht_search_batch(a.names, a.keys, n, cmd->priority, a.recs, a.rc);
+        for (size_t i = 0; i < n; ++i) {
+            if (a.rc[i] == 0) console_printf("Found: %u,%s,%u\n", a.recs[i].hash, a.recs[i].name, a.recs[i].salary);
+            else console_printf("%s not found.\n", a.names[i]);
+        }
     }
+    multi_free(&a);
+}
 
-    free(copy);
-    return 0;
+/* stats: one line per histogram, summed over every thread so far, then
+   the cache counters */
+static void print_stats(void) {
+    ht_stats st;
+    ht_cache_stats cs;
+    ht_get_stats(&st);
+    ht_get_cache_stats(&cs);
+    console_printf("Statistics (sampled 1 in %d):\n", HT_STATS_SAMPLE);
+    if (!HT_STATS) console_printf("disabled (built with HT_STATS=0)\n");
+    for (int k = 0; HT_STATS && k < ST_COUNT; ++k) {
+        const stats_hist *h = &st.h[k];
+        console_printf("%s: samples=%llu mean=%llu p50=%llu p99=%llu p999=%llu max=%llu\n",
+                       stats_kind_name((stats_kind)k), (unsigned long long)h->count,
+                       (unsigned long long)(h->count ? h->sum / h->count : 0),
+                       (unsigned long long)stats_percentile(h, 50.0),
+                       (unsigned long long)stats_percentile(h, 99.0),
+                       (unsigned long long)stats_percentile(h, 99.9),
+                       (unsigned long long)h->max);
+    }
+    uint64_t lookups = cs.hits + cs.misses;
+    console_printf("cache: hits=%llu misses=%llu hit%%=%.1f evictions=%llu records=%llu/%llu bytes=%llu/%llu\n",
+                   (unsigned long long)cs.hits, (unsigned long long)cs.misses,
+                   lookups ? 100.0 * (double)cs.hits / (double)lookups : 0.0,
+                   (unsigned long long)cs.evictions,
+                   (unsigned long long)cs.records, (unsigned long long)cs.max_records,
+                   (unsigned long long)cs.bytes, (unsigned long long)cs.max_bytes);
 }
 
-/* Worker thread: one per command */
-static void *worker(void *arg) {
-    command_t cmd = *(command_t*)arg;
-    /* Log WAITING */
-    log_message("%lld: THREAD %d WAITING FOR MY TURN", current_timestamp_us(), cmd.priority);
+static void console_sink(const char *buf, size_t len, void *ctx) {
+    (void)ctx;
+    console_write(buf, len);
+}
 
-    /* Wait until active_priority == cmd.priority and seq matches FIFO token */
-    pthread_mutex_lock(&sched_mutex);
-    while (active_priority != cmd.priority || next_seq_to_run[cmd.priority] != cmd.seq) {
-        pthread_cond_wait(&sched_cv, &sched_mutex);
-    }
-    /* now it's this command's turn */
-    log_message("%lld: THREAD %d AWAKENED FOR WORK", current_timestamp_us(), cmd.priority);
-    pthread_mutex_unlock(&sched_mutex);
+static void print_record(const hashRecord *r, void *ctx) {
+    (void)ctx;
+    console_printf("%u,%s,%u\n", r->hash, r->name, r->salary);
+}
 
-    /* Execute command and write proper logs and console output */
+/* Execute one command: the table operation, its hash.log event and its
+   console text, which is left pending in the worker's console buffer for
+   the caller to commit under the command's slot */
+static void exec_command(const command_t *c) {
+    command_t cmd = *c;
+    char name[HT_NAME_MAX + 1];
+    memcpy(name, cmd.name, cmd.name_len);
+    name[cmd.name_len] = '\0';
     if (cmd.type == CMD_INSERT) {
-        uint32_t h = jenkins_one_at_a_time_hash(cmd.name);
-        log_message("%lld: THREAD %d INSERT,%u,%s,%u", current_timestamp_us(), cmd.priority, h, cmd.name, cmd.salary);
-        int rc = ht_insert(cmd.name, cmd.salary, h, cmd.priority);
+        uint32_t h = jenkins_one_at_a_time_hash(name);
+        log_event(EV_INSERT, cmd.priority, h, name, cmd.salary);
+        int rc = ht_insert(name, cmd.salary, key_hash_len(name, cmd.name_len), h, cmd.priority);
         if (rc == 0) {
-            printf("Inserted %u,%s,%u\n", h, cmd.name, cmd.salary);
+            console_printf("Inserted %u,%s,%u\n", h, name, cmd.salary);
         } else {
-            printf("Insert failed. Entry %u is a duplicate.\n", h);
+            console_printf("Insert failed. Entry %u is a duplicate.\n", h);
         }
     } else if (cmd.type == CMD_DELETE) {
-        uint32_t h = jenkins_one_at_a_time_hash(cmd.name);
-        log_message("%lld: THREAD %d DELETE,%u,%s", current_timestamp_us(), cmd.priority, h, cmd.name);
-        uint32_t deleted_salary = 0;
-        int rc = ht_delete(cmd.name, h, cmd.priority, &deleted_salary);
+        log_op(EV_DELETE, cmd.priority, name, 0);
+        hashRecord old;
+        int rc = ht_delete(name, key_hash_len(name, cmd.name_len), cmd.priority, &old);
         if (rc == 0) {
-            printf("Deleted record for %u,%s,%u\n", h, cmd.name, deleted_salary);
+            console_printf("Deleted record for %u,%s,%u\n", old.hash, name, old.salary);
         } else {
-            printf("%s not found.\n", cmd.name);
+            console_printf("%s not found.\n", name);
         }
     } else if (cmd.type == CMD_UPDATE) {
-        uint32_t h = jenkins_one_at_a_time_hash(cmd.name);
-        log_message("%lld: THREAD %d UPDATE,%u,%s,%u", current_timestamp_us(), cmd.priority, h, cmd.name, cmd.salary);
-        uint32_t old_salary = 0;
-        int rc = ht_update(cmd.name, cmd.salary, h, cmd.priority, &old_salary);
+        log_op(EV_UPDATE, cmd.priority, name, cmd.salary);
+        hashRecord old;
+        int rc = ht_update(name, cmd.salary, key_hash_len(name, cmd.name_len), cmd.priority, &old);
+        if (rc == 0) {
+            uint32_t h = old.hash;
+            console_printf("Updated record %u from %u,%s,%u to %u,%s,%u\n",
+                           h, h, name, old.salary, h, name, cmd.salary);
+        } else {
+            console_printf("Update failed. Entry %u not found.\n",
+                           jenkins_one_at_a_time_hash(name));
+        }
+    } else if (cmd.type == CMD_UPSERT) {
+        uint32_t h = jenkins_one_at_a_time_hash(name);
+        log_event(EV_UPSERT, cmd.priority, h, name, cmd.salary);
+        hashRecord old;
+        int rc = ht_upsert(name, cmd.salary, key_hash_len(name, cmd.name_len), h, cmd.priority, &old);
+        if (rc == 0) {
+            console_printf("Updated record %u from %u,%s,%u to %u,%s,%u\n",
+                           old.hash, old.hash, name, old.salary, old.hash, name, cmd.salary);
+        } else if (rc == 1) {
+            console_printf("Inserted %u,%s,%u\n", h, name, cmd.salary);
+        } else {
+            console_printf("Upsert failed. Entry %u could not be stored.\n", h);
+        }
+    } else if (cmd.type == CMD_ADD || cmd.type == CMD_CAS) {
+        hashRecord old;
+        int rc;
+        if (cmd.type == CMD_ADD) {
+            log_op(EV_ADD, cmd.priority, name, (uint32_t)cmd.delta);
+            rc = ht_add_salary(name, cmd.delta, key_hash_len(name, cmd.name_len), cmd.priority, &old);
+            if (rc == 0) cmd.salary = (uint32_t)((int64_t)old.salary + cmd.delta);
+        } else {
+            log_op(EV_CAS, cmd.priority, name, cmd.salary);
+            rc = ht_cas_salary(name, cmd.expected, cmd.salary, key_hash_len(name, cmd.name_len),
+                               cmd.priority, &old);
+        }
         if (rc == 0) {
-            printf("Updated record %u from %u,%s,%u to %u,%s,%u\n",
-                   h, h, cmd.name, old_salary, h, cmd.name, cmd.salary);
+            uint32_t h = old.hash;
+            console_printf("Updated record %u from %u,%s,%u to %u,%s,%u\n",
+                           h, h, name, old.salary, h, name, cmd.salary);
+        } else if (rc == -1) {
+            console_printf("Update failed. Entry %u not found.\n",
+                           jenkins_one_at_a_time_hash(name));
+        } else if (cmd.type == CMD_ADD) {
+            console_printf("Update failed. Adding %d to %u,%s,%u is out of range.\n",
+                           cmd.delta, old.hash, name, old.salary);
         } else {
-            printf("Update failed. Entry %u not found.\n", h);
+            console_printf("Update failed. %u,%s,%u does not hold %u.\n",
+                           old.hash, name, old.salary, cmd.expected);
         }
     } else if (cmd.type == CMD_SEARCH) {
-        uint32_t h = jenkins_one_at_a_time_hash(cmd.name);
-        log_message("%lld: THREAD %d SEARCH,%u,%s", current_timestamp_us(), cmd.priority, h, cmd.name);
-        hashRecord *rec = ht_search(cmd.name, h, cmd.priority);
-        if (rec) {
-            printf("Found: %u,%s,%u\n", rec->hash, rec->name, rec->salary);
-            free(rec);
+        log_op(EV_SEARCH, cmd.priority, name, 0);
+        hashRecord rec;
+        if (ht_search_into(name, key_hash_len(name, cmd.name_len), cmd.priority, &rec) == 0) {
+            console_printf("Found: %u,%s,%u\n", rec.hash, rec.name, rec.salary);
         } else {
-            printf("%s not found.\n", cmd.name);
+            console_printf("%s not found.\n", name);
         }
     } else if (cmd.type == CMD_PRINT) {
-        log_message("%lld: THREAD %d PRINT", current_timestamp_us(), cmd.priority);
-        ht_print_all(cmd.priority);
+        log_event(EV_PRINT, cmd.priority, 0, NULL, 0);
+        ht_print_all_to(cmd.priority, console_sink, NULL);
+    } else if (cmd.type == CMD_RANGE) {
+        log_event(EV_RANGE, cmd.priority, cmd.expected, NULL, cmd.salary);
+        console_printf("Salaries %u to %u:\n", cmd.expected, cmd.salary);
+        if (ht_salary_range(cmd.expected, cmd.salary, print_record, NULL) < 0)
+            console_printf("Range failed: out of memory\n");
+    } else if (cmd.type == CMD_SUM || cmd.type == CMD_COUNT || cmd.type == CMD_AVG) {
+        uint64_t count, sum;
+        ht_salary_totals(&count, &sum);
+        if (cmd.type == CMD_SUM) console_printf("Salary sum: %llu\n", (unsigned long long)sum);
+        else if (cmd.type == CMD_COUNT) console_printf("Record count: %llu\n", (unsigned long long)count);
+        else if (count == 0) console_printf("Salary average: none\n");
+        else console_printf("Salary average: %.2f\n", (double)sum / (double)count);
+    } else if (cmd.type == CMD_STATS) {
+        print_stats();
+    } else if (cmd.type == CMD_SNAPSHOT) {
+        log_event(EV_SNAPSHOT, cmd.priority, 0, name, 0);
+        ht_resize_stats rs;
+        if (ht_snapshot(name, cmd.priority) == 0) {
+            ht_get_resize_stats(&rs);
+            console_printf("Saved snapshot %s (%zu records)\n", name, rs.records);
+        } else {
+            console_printf("Snapshot to %s failed: %s\n", name, strerror(errno));
+        }
+    } else if (cmd.type == CMD_LOAD) {
+        log_event(EV_LOAD, cmd.priority, 0, name, 0);
+        ht_resize_stats rs;
+        if ((cmd.salary == 0 || ht_snapshot_verify(name) == 0) && ht_load(name) == 0) {
+            ht_get_resize_stats(&rs);
+            console_printf("Loaded snapshot %s (%zu records)\n", name, rs.records);
+        } else {
+            console_printf("Load of %s failed: %s\n", name, strerror(errno));
+        }
+    } else if (cmd.type == CMD_MULTISEARCH || cmd.type == CMD_MULTIINSERT) {
+        exec_multi(&cmd);
     }
+}
 
-    /* Mark completion for this priority seq, possibly advance active_priority */
-    pthread_mutex_lock(&sched_mutex);
-    next_seq_to_run[cmd.priority]++; /* allow next FIFO item at same priority */
-    /* If that exhausted this priority, advance active_priority to next priority that has commands */
-    if (next_seq_to_run[cmd.priority] >= count_for_prio[cmd.priority]) {
-        /* find next priority > current that has count > 0 */
-        int p;
-        for (p = cmd.priority + 1; p <= max_priority; ++p) {
-            if (count_for_prio[p] > 0) break;
-        }
-        if (p <= max_priority) active_priority = p;
-        else active_priority = -1; /* finished */
+/* Run one command once the scheduler reaches its slot */
+static void run_command(const command_t *c, int self) {
+    command_t cmd = *c;
+    /* Log WAITING */
+    log_event(EV_WAITING, cmd.priority, 0, NULL, 0);
+
+    /* Wait until every earlier slot has run */
+    sched_lock();
+    if (next_slot != cmd.slot) {
+        waiting_slot[self] = cmd.slot;
+        while (next_slot != cmd.slot) sched_wait(&worker_cv[self]);
+        waiting_slot[self] = -1;
     }
-    pthread_cond_broadcast(&sched_cv);
-    pthread_mutex_unlock(&sched_mutex);
+    /* now it's this command's turn */
+    log_event(EV_AWAKENED, cmd.priority, 0, NULL, 0);
+    sched_unlock();
 
-    return NULL;
+    /* Execute command and write proper logs and console output */
+    exec_command(&cmd);
+    console_commit(cmd.slot);
+
+    /* Pass the turn on and wake the successor if its worker is parked */
+    sched_lock();
+    next_slot++;
+    for (int w = 0; w < num_workers; ++w) {
+        if (waiting_slot[w] == next_slot) {
+            pthread_cond_signal(&worker_cv[w]);
+            break;
+        }
+    }
+    sched_unlock();
 }
 
-int main(int argc, char **argv) {
-    /* clear log at start */
-    pthread_mutex_lock(&log_mutex);
-    if (log_fp) fclose(log_fp);
-    log_fp = fopen("hash.log", "w");
-    if (!log_fp) {
-        perror("Unable to open hash.log");
-        pthread_mutex_unlock(&log_mutex);
-        return 1;
+/* Pool worker: drain the own queue in schedule order, then steal from the
+   others.  Queues are only filled before the workers start and a worker
+   only steals once its own queue is empty, so the earliest pending command
+   always sits at the head of a queue whose owner is free to take it. */
+static void *pool_worker(void *arg) {
+    int self = (int)(intptr_t)arg;
+    sched_lock();
+    while (!pool_ready) sched_wait(&sched_cv);
+    sched_unlock();
+    for (;;) {
+        command_t *cmd = workq_pop(&queues[self]);
+        for (int i = 1; !cmd && i < num_workers; ++i) {
+            cmd = workq_steal(&queues[(self + i) % num_workers]);
+        }
+        if (!cmd) break;
+        run_command(cmd, self);
     }
-    fclose(log_fp);
-    log_fp = NULL;
-    pthread_mutex_unlock(&log_mutex);
+    console_thread_exit();
+    return NULL;
+}
 
-    ht_init();
+/* Streaming worker: take the next published command in file order */
+static void *stream_worker(void *arg) {
+    int self = (int)(intptr_t)arg;
+    for (;;) {
+        sched_lock();
+        while (stream_taken == stream_published && !stream_eof) {
+            sched_wait(&sched_cv);
+        }
+        if (stream_taken == stream_published) {
+            sched_unlock();
+            break;
+        }
+        int i = stream_taken++;
+        command_t *cmd = &stream_chunks[i / STREAM_CHUNK][i % STREAM_CHUNK];
+        sched_unlock();
+        run_command(cmd, self);
+    }
+    console_thread_exit();
+    return NULL;
+}
 
-    /* Read commands.txt */
-    FILE *f = fopen("commands.txt", "r");
-    if (!f) {
-        perror("Unable to open commands.txt in working directory");
-        ht_destroy();
-        return 1;
+/* Parse the mapping batch by batch and publish each batch to the stream
+   workers as soon as it is parsed.  *count receives the number of commands
+   published.  Returns -1 if the file is not sorted by priority (commands
+   before the offending one still run) or memory runs out. */
+static int stream_commands(cmd_file *cf, int *count) {
+    int n = 0, last_priority = 0, seq = 0, rc = 0;
+    for (;;) {
+        int off = n % STREAM_CHUNK;
+        if (off == 0) {
+            /* workers index the chunk table under sched_mutex */
+            command_t *chunk = malloc(sizeof(command_t) * STREAM_CHUNK);
+            sched_lock();
+            command_t **table = chunk ? realloc(stream_chunks, sizeof(command_t *) * (stream_nchunks + 1)) : NULL;
+            if (table) {
+                stream_chunks = table;
+                stream_chunks[stream_nchunks++] = chunk;
+            }
+            sched_unlock();
+            if (!table) {
+                perror("malloc");
+                free(chunk);
+                rc = -1;
+                break;
+            }
+        }
+        int room = STREAM_CHUNK - off < STREAM_BATCH ? STREAM_CHUNK - off : STREAM_BATCH;
+        command_t *batch = &stream_chunks[stream_nchunks - 1][off];
+        int got = cmdfile_next(cf, batch, room);
+        if (got == 0) break;
+        for (int k = 0; k < got; ++k) {
+            if (batch[k].priority < last_priority) {
+                fprintf(stderr, "commands.txt: command %d has priority %d after %d; "
+                                "-S needs the file sorted by priority\n",
+                        n + k + 1, batch[k].priority, last_priority);
+                got = k;
+                rc = -1;
+                break;
+            }
+            if (batch[k].priority != last_priority) seq = 0;
+            last_priority = batch[k].priority;
+            batch[k].seq = seq++;
+            batch[k].slot = n + k;
+        }
+        sched_lock();
+        stream_published += got;
+        pthread_cond_broadcast(&sched_cv);
+        sched_unlock();
+        n += got;
+        if (rc != 0) break;
     }
+    sched_lock();
+    stream_eof = 1;
+    pthread_cond_broadcast(&sched_cv);
+    sched_unlock();
+    *count = n;
+    return rc;
+}
 
-    /* Read lines into temporary array */
-    char *line = NULL;
-    size_t len = 0;
-    ssize_t r;
-    command_t *tmp_commands = NULL;
-    int tmp_cap = 0;
-    int tmp_n = 0;
-
-    while ((r = getline(&line, &len, f)) != -1) {
-        char *t = trim(line);
-        if (t[0] == '\0') continue;
-        command_t cmd;
-        int parse_ret = parse_line_to_command(t, &cmd);
-        if (parse_ret == 1) {
-            /* header 'threads' - ignore as we derive priorities from commands themselves */
+/* Dependency mode (-d).
+   Commands are numbered by schedule position.  Each waits only for the
+   previous command on the same name and for the last barrier (print or a
+   multi-key command) before it; a barrier waits for everything scheduled
+   before it.  Ready commands go to
+   the completing worker's queue, and each command's console text is
+   committed under its schedule position, so the output matches the
+   serial run. */
+typedef struct {
+    command_t *cmd;
+    int pending;            /* unfinished predecessors */
+    int next_same_key;      /* next command on this name before the next barrier, or -1 */
+    int next_barrier;       /* next barrier after this command, or -1 */
+    int first_on_key;       /* no earlier command on this name since the last barrier */
+} dep_node;
+
+static dep_node *dep_nodes = NULL;
+static int dep_ready = 0;               /* queued nodes, protected by sched_mutex */
+static int dep_remaining = 0;           /* unfinished nodes, protected by sched_mutex */
+static __thread int my_worker;
+
+/* print, snapshot and the salary queries read every key, load replaces
+   them all and the multi-key commands touch many, so they order against
+   everything around them; stats reports on everything scheduled before
+   it */
+static int is_barrier_cmd(const command_t *c) {
+    return c->type == CMD_PRINT || c->type == CMD_STATS ||
+           c->type == CMD_SNAPSHOT || c->type == CMD_LOAD ||
+           c->type == CMD_MULTISEARCH || c->type == CMD_MULTIINSERT ||
+           c->type == CMD_RANGE || c->type == CMD_SUM || c->type == CMD_COUNT || c->type == CMD_AVG;
+}
+
+static int is_barrier(int i) {
+    return is_barrier_cmd(dep_nodes[i].cmd);
+}
+
+/* Build the graph over order[0..n); returns 0 or -1 on allocation failure */
+static int dep_build(command_t **order, int n) {
+    /* open-addressed map key -> last position, valid only for entries
+       stamped with the current segment (the commands since the last barrier).
+       Two names only share a slot if their 64-bit keys collide, which at
+       worst orders two independent commands. */
+    typedef struct { uint64_t key; int pos; int seg; } key_slot;
+    int cap = 16;
+    while (cap < 2 * n) cap <<= 1;
+    key_slot *map = malloc(sizeof(key_slot) * cap);
+    dep_nodes = calloc(n, sizeof(dep_node));
+    if (!map || !dep_nodes) { free(map); return -1; }
+    for (int i = 0; i < cap; ++i) map[i].seg = -1;
+
+    int seg = 0, seg_count = 0, prev_barrier = -1;
+    for (int i = 0; i < n; ++i) {
+        dep_node *d = &dep_nodes[i];
+        d->cmd = order[i];
+        d->next_same_key = -1;
+        d->next_barrier = -1;
+        if (is_barrier_cmd(d->cmd)) {
+            d->pending = seg_count + (seg_count == 0 && prev_barrier >= 0);
+            prev_barrier = i;
+            seg++;
+            seg_count = 0;
             continue;
-        } else if (parse_ret == 0) {
-            /* push */
-            if (tmp_n + 1 > tmp_cap) {
-                tmp_cap = tmp_cap ? tmp_cap * 2 : 64;
-                tmp_commands = realloc(tmp_commands, sizeof(command_t) * tmp_cap);
-                if (!tmp_commands) { perror("realloc"); free(line); fclose(f); ht_destroy(); return 1; }
-            }
-            cmd.original_index = tmp_n;
-            tmp_commands[tmp_n++] = cmd;
+        }
+        uint64_t key = key_hash_len(d->cmd->name, d->cmd->name_len);
+        uint32_t slot = (uint32_t)key & (cap - 1);
+        while (map[slot].seg >= 0 && map[slot].key != key) slot = (slot + 1) & (cap - 1);
+        if (map[slot].seg == seg) {
+            dep_nodes[map[slot].pos].next_same_key = i;
+            d->pending = 1;
         } else {
-            fprintf(stderr, "Warning: skipping unparsable line: %s\n", t);
+            d->first_on_key = 1;
+            d->pending = prev_barrier >= 0;
         }
+        map[slot].key = key;
+        map[slot].pos = i;
+        map[slot].seg = seg;
+        seg_count++;
     }
-    free(line);
-    fclose(f);
+    free(map);
 
-    if (tmp_n == 0) {
-        fprintf(stderr, "No commands found in commands.txt\n");
-        free(tmp_commands);
-        ht_destroy();
-        return 0;
+    int next = -1;
+    for (int i = n - 1; i >= 0; --i) {
+        dep_nodes[i].next_barrier = next;
+        if (is_barrier(i)) next = i;
     }
+    dep_remaining = n;
+    return 0;
+}
+
+static void dep_push(int i) {
+    workq_push(&queues[my_worker], &dep_nodes[i]);
+    sched_lock();
+    dep_ready++;
+    pthread_cond_signal(&sched_cv);
+    sched_unlock();
+}
+
+static void dep_release(int i) {
+    if (__atomic_sub_fetch(&dep_nodes[i].pending, 1, __ATOMIC_ACQ_REL) == 0) dep_push(i);
+}
+
+static void dep_complete(int i) {
+    int n = num_commands;
+    /* nodes are numbered by schedule position, which is the slot */
+    console_commit(i);
 
-    /* Determine max priority and count per priority, and assign seq numbers (FIFO order) */
-    max_priority = -1;
-    for (int i = 0; i < tmp_n; ++i) if (tmp_commands[i].priority > max_priority) max_priority = tmp_commands[i].priority;
-    if (max_priority < 0) max_priority = 0;
+    if (is_barrier(i)) {
+        int j;
+        for (j = i + 1; j < n && !is_barrier(j); ++j) {
+            if (dep_nodes[j].first_on_key) dep_release(j);
+        }
+        if (j < n && j == i + 1) dep_release(j);
+    } else {
+        if (dep_nodes[i].next_same_key >= 0) dep_release(dep_nodes[i].next_same_key);
+        if (dep_nodes[i].next_barrier >= 0) dep_release(dep_nodes[i].next_barrier);
+    }
 
-    /* allocate counters sized max_priority+1 */
-    next_seq_to_run = calloc(max_priority + 1, sizeof(int));
-    count_for_prio = calloc(max_priority + 1, sizeof(int));
-    if (!next_seq_to_run || !count_for_prio) { perror("calloc"); free(tmp_commands); ht_destroy(); return 1; }
+    sched_lock();
+    if (--dep_remaining == 0) pthread_cond_broadcast(&sched_cv);
+    sched_unlock();
+}
 
-    /* First pass to count */
-    for (int i = 0; i < tmp_n; ++i) {
-        int p = tmp_commands[i].priority;
-        count_for_prio[p]++;
+static void *dep_worker(void *arg) {
+    my_worker = (int)(intptr_t)arg;
+    sched_lock();
+    while (!pool_ready) sched_wait(&sched_cv);
+    sched_unlock();
+    for (;;) {
+        dep_node *d = workq_pop(&queues[my_worker]);
+        for (int i = 1; !d && i < num_workers; ++i) {
+            d = workq_steal(&queues[(my_worker + i) % num_workers]);
+        }
+        if (!d) {
+            sched_lock();
+            while (dep_ready == 0 && dep_remaining > 0) {
+                sched_wait(&sched_cv);
+            }
+            int finished = dep_remaining == 0;
+            sched_unlock();
+            if (finished) break;
+            continue;
+        }
+        /* counted out under the lock the wait checks it under, so an idle
+           worker does not see this node as queued and spin instead of
+           sleeping */
+        sched_lock();
+        dep_ready--;
+        sched_unlock();
+
+        log_event(EV_AWAKENED, d->cmd->priority, 0, NULL, 0);
+        exec_command(d->cmd);
+        dep_complete((int)(d - dep_nodes));
     }
+    console_thread_exit();
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-b chain|swiss|compact] [-l] [-L off|ops|trace] [-j workers]\n"
+                    "          [-d | -S | -s socket] [-W wal [-F us]]\n"
+                    "          [-C records] [-M bytes]\n"
+                    "  -b  table backend: chained buckets (default), open addressing with\n"
+                    "      64-byte slots, or open addressing with split slot arrays\n"
+                    "  -l  lock-free reads (search/print never take the table lock;\n"
+                    "      chain backend only)\n"
+                    "  -L  hash.log detail: off, ops (no lock events) or trace (default)\n"
+                    "  -j  worker threads (default: number of online CPUs)\n"
+                    "  -d  run commands on different keys in parallel, keeping per-key\n"
+                    "      order and treating print and multi-key commands as barriers\n"
+                    "  -S  stream: start running while commands.txt is still being parsed\n"
+                    "      (the file must be sorted by priority)\n"
+                    "  -s  serve: keep the table and take commands from clients of this\n"
+                    "      Unix socket until SIGINT or SIGTERM, instead of commands.txt\n"
+                    "      (-j sets the server threads)\n"
+                    "  -W  write-ahead log: recover the table from it, then log every change\n"
+                    "      and finish a change only once its record is on disk\n"
+                    "  -F  microseconds a change waits for others to share its disk write\n"
+                    "      (default 0)\n"
+                    "  -C  cache mode: keep at most this many records, evicting the least\n"
+                    "      recently used (approximately) to make room\n"
+                    "  -M  cache mode: keep the table's memory under this many bytes\n", prog);
+}
 
-    /* assign seq numbers per priority by iterating file order */
-    int *seq_alloc = calloc(max_priority + 1, sizeof(int));
-    if (!seq_alloc) { perror("calloc2"); free(tmp_commands); ht_destroy(); return 1; }
-    for (int i = 0; i < tmp_n; ++i) {
-        int p = tmp_commands[i].priority;
-        tmp_commands[i].seq = seq_alloc[p]++;
+/* Start the workers; returns how many came up, or 0 if none did */
+static int start_workers(pthread_t *tids, int n, void *(*fn)(void *)) {
+    int started = 0;
+    while (started < n && pthread_create(&tids[started], NULL, fn, (void *)(intptr_t)started) == 0) {
+        started++;
     }
-    free(seq_alloc);
-
-    /* Build commands array (copy) */
-    commands = malloc(sizeof(command_t) * tmp_n);
-    if (!commands) { perror("malloc"); free(tmp_commands); ht_destroy(); return 1; }
-    num_commands = tmp_n;
-    for (int i = 0; i < num_commands; ++i) commands[i] = tmp_commands[i];
-    free(tmp_commands);
-
-    /* Set initial active_priority to the smallest priority that has commands (FIFO across priorities ascending) */
-    int start_p = -1;
-    for (int p = 0; p <= max_priority; ++p) if (count_for_prio[p] > 0) { start_p = p; break; }
-    if (start_p == -1) start_p = 0;
-    active_priority = start_p;
-
-    /* spawn one thread per command */
-    pthread_t *tids = malloc(sizeof(pthread_t) * num_commands);
-    if (!tids) { perror("malloc"); ht_destroy(); return 1; }
-
-    for (int i = 0; i < num_commands; ++i) {
-        /* create thread; pass pointer to commands[i] */
-        command_t *arg = &commands[i];
-        if (pthread_create(&tids[i], NULL, worker, arg) != 0) {
-            perror("pthread_create");
-            tids[i] = 0;
+    if (started < n) perror("pthread_create");
+    return started;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    log_level level = LOG_TRACE;
+    int jobs = 0;
+    int dep_mode = 0;
+    int stream_mode = 0;
+    int status = 0;
+    int lockfree = 0;
+    const char *wal_path = NULL;
+    const char *sock_path = NULL;
+    unsigned flush_us = 0;
+    uint64_t max_records = 0, max_bytes = 0;
+    ht_backend backend = HT_BACKEND_CHAIN;
+    while ((opt = getopt(argc, argv, "b:lL:j:dSs:W:F:C:M:")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (ht_parse_backend(optarg, &backend) != 0) { usage(argv[0]); return 1; }
+            break;
+        case 'l': lockfree = 1; break;
+        case 'L':
+            if (log_parse_level(optarg, &level) != 0) { usage(argv[0]); return 1; }
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            if (jobs < 1) { usage(argv[0]); return 1; }
+            break;
+        case 'd': dep_mode = 1; break;
+        case 'S': stream_mode = 1; break;
+        case 's': sock_path = optarg; break;
+        case 'W': wal_path = optarg; break;
+        case 'F': flush_us = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'C': max_records = strtoull(optarg, NULL, 10); break;
+        case 'M': max_bytes = strtoull(optarg, NULL, 10); break;
+        default: usage(argv[0]); return 1;
         }
     }
+    if (dep_mode + stream_mode + (sock_path != NULL) > 1) { usage(argv[0]); return 1; }
+    if (lockfree && backend != HT_BACKEND_CHAIN)
+        fprintf(stderr, "Warning: -l has no effect with -b %s\n", ht_backend_name(backend));
+    ht_set_backend(backend);
+    if (lockfree) ht_set_read_mode(HT_READ_LOCKFREE);
+    ht_set_capacity(max_records, max_bytes);
+    log_set_level(level);
+
+    /* size the pool: one worker per CPU unless -j says otherwise */
+    if (jobs == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = ncpu > 0 ? (int)ncpu : 1;
+    }
 
-    /* Broadcast to wake waiting threads so they check active_priority */
-    pthread_mutex_lock(&sched_mutex);
-    pthread_cond_broadcast(&sched_cv);
-    pthread_mutex_unlock(&sched_mutex);
+    /* truncate hash.log and start the background log writer */
+    if (log_open("hash.log") != 0) {
+        perror("Unable to open hash.log");
+        return 1;
+    }
+
+    ht_init();
+    if (wal_path) {
+        long replayed = ht_wal_open(wal_path, flush_us);
+        if (replayed < 0) {
+            fprintf(stderr, "Recovery from %s failed: %s\n", wal_path, strerror(errno));
+            ht_destroy();
+            return 1;
+        }
+        if (replayed > 0) fprintf(stderr, "Recovered %s: %ld changes replayed\n", wal_path, replayed);
+    }
+
+    /* Serve clients instead of running commands.txt; the answers go to
+       the clients, so there is no console writer and no final print */
+    if (sock_path) {
+        if (server_run(sock_path, jobs, exec_command) != 0) {
+            fprintf(stderr, "Unable to serve on %s: %s\n", sock_path, strerror(errno));
+            status = 1;
+        }
+        ht_destroy();
+        log_close();
+        return status;
+    }
+
+    /* Map commands.txt; it is parsed in place */
+    cmd_file cf;
+    if (cmdfile_open(&cf, "commands.txt") != 0) {
+        perror("Unable to open commands.txt in working directory");
+        ht_destroy();
+        return 1;
+    }
 
-    /* join threads */
-    for (int i = 0; i < num_commands; ++i) {
-        if (tids[i]) pthread_join(tids[i], NULL);
+    pthread_t *tids = malloc(sizeof(pthread_t) * jobs);
+    worker_cv = malloc(sizeof(pthread_cond_t) * jobs);
+    waiting_slot = malloc(sizeof(int) * jobs);
+    if (!tids || !worker_cv || !waiting_slot) { perror("malloc"); ht_destroy(); return 1; }
+    for (int w = 0; w < jobs; ++w) {
+        pthread_cond_init(&worker_cv[w], NULL);
+        waiting_slot[w] = -1;
+    }
+
+    /* from here until the workers are joined, stdout belongs to the
+       console writer */
+    fflush(stdout);
+    if (console_open(STDOUT_FILENO) != 0) { perror("console"); ht_destroy(); return 1; }
+
+    if (stream_mode) {
+        /* workers run commands while the rest of the file is parsed */
+        num_workers = start_workers(tids, jobs, stream_worker);
+        if (num_workers == 0) { ht_destroy(); return 1; }
+        if (stream_commands(&cf, &num_commands) != 0) status = 1;
+        for (int w = 0; w < num_workers; ++w) pthread_join(tids[w], NULL);
+        console_close();
+        if (num_commands == 0 && status == 0) {
+            fprintf(stderr, "No commands found in commands.txt\n");
+            ht_destroy();
+            return 0;
+        }
+    } else {
+        num_commands = cmdfile_parse_all(&cf, jobs, &commands);
+        if (num_commands < 0) { perror("malloc"); ht_destroy(); return 1; }
+        if (num_commands == 0) {
+            fprintf(stderr, "No commands found in commands.txt\n");
+            free(commands);
+            ht_destroy();
+            return 0;
+        }
+
+        /* Assign slots: priorities ascending, FIFO (file order) within one */
+        int max_priority = 0;
+        for (int i = 0; i < num_commands; ++i) if (commands[i].priority > max_priority) max_priority = commands[i].priority;
+        int *first_slot = calloc(max_priority + 1, sizeof(int));
+        int *seq_alloc = calloc(max_priority + 1, sizeof(int));
+        command_t **order = malloc(sizeof(command_t *) * num_commands);
+        if (!first_slot || !seq_alloc || !order) { perror("calloc"); ht_destroy(); return 1; }
+        for (int i = 0; i < num_commands; ++i) first_slot[commands[i].priority]++;
+        for (int p = 0, base = 0; p <= max_priority; ++p) {
+            int count = first_slot[p];
+            first_slot[p] = base;
+            base += count;
+        }
+        for (int i = 0; i < num_commands; ++i) {
+            command_t *c = &commands[i];
+            c->seq = seq_alloc[c->priority]++;
+            c->slot = first_slot[c->priority] + c->seq;
+            order[c->slot] = c;
+        }
+        free(first_slot);
+        free(seq_alloc);
+
+        int want = jobs < num_commands ? jobs : num_commands;
+        queues = calloc(want, sizeof(workq));
+        if (!queues) { perror("calloc"); ht_destroy(); return 1; }
+
+        /* start the workers first so the queues can be dealt to as many as
+           actually came up; they wait for pool_ready */
+        int started = start_workers(tids, want, dep_mode ? dep_worker : pool_worker);
+        if (started == 0) { ht_destroy(); return 1; }
+
+        /* in dependency mode any worker may queue every released command */
+        int qcap = dep_mode ? num_commands : (num_commands + started - 1) / started;
+        for (int w = 0; w < started; ++w) {
+            if (workq_init(&queues[w], qcap) != 0) {
+                perror("workq_init");
+                ht_destroy();
+                return 1;
+            }
+        }
+        if (dep_mode) {
+            if (dep_build(order, num_commands) != 0) { perror("malloc"); ht_destroy(); return 1; }
+            /* deal the commands with no predecessor round-robin */
+            int k = 0;
+            for (int i = 0; i < num_commands; ++i) {
+                log_event(EV_WAITING, order[i]->priority, 0, NULL, 0);
+                if (dep_nodes[i].pending == 0) {
+                    workq_push(&queues[k++ % started], &dep_nodes[i]);
+                    dep_ready++;
+                }
+            }
+        } else {
+            /* deal the commands round-robin in schedule order, so every queue
+               is sorted and neighbouring slots land on different workers */
+            for (int i = 0; i < num_commands; ++i) workq_push(&queues[i % started], order[i]);
+        }
+        free(order);
+
+        sched_lock();
+        num_workers = started;
+        pool_ready = 1;
+        pthread_cond_broadcast(&sched_cv);
+        sched_unlock();
+
+        /* join workers */
+        for (int w = 0; w < num_workers; ++w) pthread_join(tids[w], NULL);
+        console_close();
     }
 
     /* final print as required */
-    /* If active_priority != -1 it means some priorities remain but all threads have completed; ht_print_all will still print final state */
     ht_print_all(-1);
 
     /* cleanup */
     ht_destroy();
     free(tids);
+    for (int w = 0; queues && w < num_workers; ++w) workq_destroy(&queues[w]);
+    free(queues);
+    free(dep_nodes);
+    for (int w = 0; w < jobs; ++w) pthread_cond_destroy(&worker_cv[w]);
+    free(worker_cv);
+    free(waiting_slot);
     free(commands);
-    free(next_seq_to_run);
-    free(count_for_prio);
-    if (log_fp) { fclose(log_fp); log_fp = NULL; }
+    for (int i = 0; i < stream_nchunks; ++i) free(stream_chunks[i]);
+    free(stream_chunks);
+    cmdfile_close(&cf);
+    log_close();
 
-    return 0;
+    return status;
 }
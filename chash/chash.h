@@ -1,13 +1,21 @@
 #ifndef CHASH_H
 #define CHASH_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* longest name a record or command may have, in bytes */
+#define HT_NAME_MAX 1024
+
+/* A record is identified by its full name.  hash is the Jenkins value
+   shown in the output; key is key_hash(name), which places the record in
+   the table and is compared before the name.  This is the form records
+   are handed out in; each backend stores them in its own layout. */
 typedef struct hash_struct {
     uint32_t hash;
-    char name[50];
     uint32_t salary;
-    struct hash_struct *next;
+    uint64_t key;
+    const char *name;           /* NUL-terminated; owner as documented per call */
 } hashRecord;
 
 typedef enum {
@@ -16,21 +24,51 @@ typedef enum {
     CMD_UPDATE,
     CMD_SEARCH,
     CMD_PRINT,
+    CMD_MULTISEARCH,
+    CMD_MULTIINSERT,
+    CMD_STATS,
+    CMD_SNAPSHOT,
+    CMD_LOAD,
+    CMD_UPSERT,
+    CMD_ADD,
+    CMD_CAS,
+    CMD_RANGE,
+    CMD_SUM,
+    CMD_COUNT,
+    CMD_AVG,
     CMD_INVALID
 } command_type;
 
 typedef struct {
     command_type type;
-    char name[50];
-    uint32_t salary;   /* for insert/update */
+    /* name or path, pointing into the mapped command file (not
+       NUL-terminated); at most HT_NAME_MAX bytes */
+    const char *name;
+    uint32_t name_len;
+    uint32_t salary;   /* for insert/update/upsert, cas: the new salary,
+                          range: the highest salary */
+    uint32_t expected; /* cas: the salary to replace, range: the lowest */
+    int32_t delta;     /* add: the change to the salary */
     int priority;      /* priority number */
     int seq;           /* FIFO sequence among same-priority commands */
+    int slot;          /* position in the execution schedule */
     int original_index;/* order in file (optional) */
+    /* multisearch/multiinsert: ';'-separated names and salaries, pointing
+       into the mapped command file (not NUL-terminated) */
+    const char *names;
+    const char *salaries;
+    uint32_t names_len;
+    uint32_t salaries_len;
+    uint32_t nkeys;
 } command_t;
 
 /* utilities */
 uint32_t jenkins_one_at_a_time_hash(const char *key);
+uint64_t key_hash(const char *key);
+/* key_hash of the len bytes at key, which need no NUL */
+uint64_t key_hash_len(const char *key, size_t len);
+/* CRC-32C of buf, continuing from crc (start with 0) */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
 long long current_timestamp_us(void);
-void log_message(const char *fmt, ...);
 
 #endif /* CHASH_H */
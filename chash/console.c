@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "console.h"
+
+#define CONSOLE_BLOCK (64 * 1024)
+#define CONSOLE_IOV (IOV_MAX < 1024 ? IOV_MAX : 1024)   /* slots per writev */
+#define CONSOLE_BATCH 64        /* ready slots that wake the writer early */
+#define CONSOLE_INTERVAL_MS 10
+
+/* refs: one per committed, unwritten text in it, plus one while it is
+   its worker's current block */
+typedef struct {
+    int refs;
+    size_t cap;
+    size_t used;
+    char data[];
+} con_block;
+
+typedef struct {
+    const char *text;
+    size_t len;
+    con_block *block;           /* NULL if len is 0 */
+    int ready;
+} con_slot;
+
+/* Committed slots not yet written, in a ring indexed by slot number that
+   grows when a commit runs further ahead of the writer than it holds */
+static struct {
+    pthread_mutex_t mu;
+    pthread_cond_t cv;          /* the writer waits here for ready slots */
+    pthread_cond_t room;        /* committers wait here for the writer to pass */
+    con_slot *ring;
+    int cap;                    /* power of two */
+    int next;                   /* next slot to write */
+    int waiting;                /* the writer is parked */
+    int stop;
+} con = { .mu = PTHREAD_MUTEX_INITIALIZER, .cv = PTHREAD_COND_INITIALIZER, .room = PTHREAD_COND_INITIALIZER };
+
+static int con_fd = -1;
+static pthread_t writer_tid;
+
+static __thread con_block *my_block;
+static __thread size_t my_start;        /* start of the pending text */
+
+static void block_release(con_block *b) {
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0) free(b);
+}
+
+static void write_iov(struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(con_fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("console");
+            return;
+        }
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= (ssize_t)iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= (size_t)w;
+        }
+    }
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    struct iovec iov[CONSOLE_IOV];
+    con_block *written[CONSOLE_IOV];
+    pthread_mutex_lock(&con.mu);
+    for (;;) {
+        if (!con.ring[con.next & (con.cap - 1)].ready) {
+            if (con.stop) break;
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += CONSOLE_INTERVAL_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            con.waiting = 1;
+            pthread_cond_timedwait(&con.cv, &con.mu, &ts);
+            con.waiting = 0;
+            continue;
+        }
+
+        /* the run of ready slots, merging texts that sit back to back */
+        int niov = 0, nblocks = 0;
+        con_slot *s;
+        while (nblocks < CONSOLE_IOV && (s = &con.ring[con.next & (con.cap - 1)])->ready) {
+            if (s->len) {
+                if (niov && (const char *)iov[niov - 1].iov_base + iov[niov - 1].iov_len == s->text) {
+                    iov[niov - 1].iov_len += s->len;
+                } else {
+                    iov[niov].iov_base = (void *)s->text;
+                    iov[niov].iov_len = s->len;
+                    niov++;
+                }
+                written[nblocks++] = s->block;
+            }
+            s->ready = 0;
+            con.next++;
+        }
+        /* a committer that could not grow the ring waits for these slots */
+        pthread_cond_broadcast(&con.room);
+        pthread_mutex_unlock(&con.mu);
+        write_iov(iov, niov);
+        for (int i = 0; i < nblocks; ++i) block_release(written[i]);
+        pthread_mutex_lock(&con.mu);
+    }
+    pthread_mutex_unlock(&con.mu);
+    return NULL;
+}
+
+int console_open(int fd) {
+    con.cap = CONSOLE_IOV;
+    con.ring = calloc((size_t)con.cap, sizeof(con_slot));
+    if (!con.ring) return -1;
+    con.next = 0;
+    con.stop = 0;
+    con_fd = fd;
+    if (pthread_create(&writer_tid, NULL, writer_main, NULL) != 0) {
+        free(con.ring);
+        con.ring = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void console_close(void) {
+    if (!con.ring) return;
+    pthread_mutex_lock(&con.mu);
+    con.stop = 1;
+    pthread_cond_signal(&con.cv);
+    pthread_mutex_unlock(&con.mu);
+    pthread_join(writer_tid, NULL);
+    /* slots past a gap were never written; drop their texts */
+    for (int i = 0; i < con.cap; ++i)
+        if (con.ring[i].ready && con.ring[i].len) block_release(con.ring[i].block);
+    free(con.ring);
+    con.ring = NULL;
+    con_fd = -1;
+}
+
+/* Room for len more bytes after the pending text, moving the pending
+   text to a new block if the current one is full; NULL if out of memory. */
+static char *reserve(size_t len) {
+    con_block *b = my_block;
+    if (b && b->used + len <= b->cap) return b->data + b->used;
+    size_t pending = b ? b->used - my_start : 0;
+    size_t cap = CONSOLE_BLOCK;
+    while (cap < pending + len) cap *= 2;
+    con_block *nb = malloc(sizeof(con_block) + cap);
+    if (!nb) return NULL;
+    nb->refs = 1;
+    nb->cap = cap;
+    nb->used = pending;
+    if (pending) memcpy(nb->data, b->data + my_start, pending);
+    if (b) block_release(b);
+    my_block = nb;
+    my_start = 0;
+    return nb->data + nb->used;
+}
+
+void console_write(const char *buf, size_t len) {
+    char *p = reserve(len);
+    if (!p) {
+        perror("console");
+        return;
+    }
+    memcpy(p, buf, len);
+    my_block->used += len;
+}
+
+void console_printf(const char *fmt, ...) {
+    va_list ap;
+    char *p = reserve(256);
+    if (!p) {
+        perror("console");
+        return;
+    }
+    size_t room = my_block->cap - my_block->used;
+    va_start(ap, fmt);
+    int n = vsnprintf(p, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n >= room) {
+        if (!(p = reserve((size_t)n + 1))) {
+            perror("console");
+            return;
+        }
+        va_start(ap, fmt);
+        vsnprintf(p, (size_t)n + 1, fmt, ap);
+        va_end(ap);
+    }
+    my_block->used += (size_t)n;
+}
+
+/* doubles the ring until slot fits ahead of the writer */
+static int grow_ring(int slot) {
+    int cap = con.cap;
+    while (slot - con.next >= cap) cap *= 2;
+    con_slot *ring = calloc((size_t)cap, sizeof(con_slot));
+    if (!ring) return -1;
+    for (int s = con.next; s < con.next + con.cap; ++s) ring[s & (cap - 1)] = con.ring[s & (con.cap - 1)];
+    free(con.ring);
+    con.ring = ring;
+    con.cap = cap;
+    return 0;
+}
+
+void console_commit(int slot) {
+    con_slot s = { NULL, 0, NULL, 1 };
+    con_block *b = my_block;
+    if (b && b->used > my_start) {
+        s.text = b->data + my_start;
+        s.len = b->used - my_start;
+        s.block = b;
+        __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+        my_start = b->used;
+    }
+    pthread_mutex_lock(&con.mu);
+    if (slot - con.next >= con.cap && grow_ring(slot) != 0) {
+        /* keep the order: the slot goes out without its text */
+        perror("console");
+        if (s.block) block_release(s.block);
+        s.text = NULL;
+        s.len = 0;
+        s.block = NULL;
+        while (slot - con.next >= con.cap) pthread_cond_wait(&con.room, &con.mu);
+    }
+    con.ring[slot & (con.cap - 1)] = s;
+    if (con.waiting && (slot == con.next || slot - con.next >= CONSOLE_BATCH))
+        pthread_cond_signal(&con.cv);
+    pthread_mutex_unlock(&con.mu);
+}
+
+size_t console_take(const char **text) {
+    con_block *b = my_block;
+    *text = NULL;
+    if (!b || b->used == my_start) return 0;
+    /* the block is the caller's until the next call, which writes over it */
+    *text = b->data + my_start;
+    size_t len = b->used - my_start;
+    b->used = my_start;
+    return len;
+}
+
+size_t console_pending(void) {
+    return my_block ? my_block->used - my_start : 0;
+}
+
+void console_thread_exit(void) {
+    if (my_block) block_release(my_block);
+    my_block = NULL;
+    my_start = 0;
+}
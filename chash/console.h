@@ -0,0 +1,42 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stddef.h>
+
+/* Ordered console output.
+   A command formats its console text into its worker's own buffer, then
+   commits it under the command's schedule slot.  A writer thread sends
+   the committed text to the output in slot order, gathering every run
+   of consecutive slots that are ready into one writev, so workers never
+   touch stdout and the output is the same however the commands were
+   spread over the workers or whatever order they finished in.
+
+   Buffers are 64 KB blocks (larger for a bigger single command, such as a
+   print); a block is freed once the writer has sent all of its text and
+   its worker has moved on to another block. */
+
+/* Starts the writer on fd; until then nothing may be committed.  Anything
+   already buffered in stdout should be flushed first.  0 or -1. */
+int console_open(int fd);
+/* Waits until every slot committed so far has been written, up to the
+   first slot that never was, then stops the writer. */
+void console_close(void);
+
+/* Append to the calling thread's pending text.  Out of memory drops the
+   text with a message on stderr. */
+void console_write(const char *buf, size_t len);
+void console_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+/* Publishes the pending text (possibly none) as the output of slot; every
+   slot from 0 up must be committed exactly once. */
+void console_commit(int slot);
+/* Hands the pending text (possibly none) to the caller instead of a slot:
+   returns its length and points *text at it, valid until the calling
+   thread's next console call.  For threads that send their own output,
+   which need no writer. */
+size_t console_take(const char **text);
+/* length of the calling thread's pending text */
+size_t console_pending(void);
+/* Drops the calling thread's buffer; call before a worker exits. */
+void console_thread_exit(void);
+
+#endif /* CONSOLE_H */
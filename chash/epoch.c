@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include "epoch.h"
+
+/* how many retires a thread queues between attempts to advance the epoch */
+#define EPOCH_SCAN_EVERY 32
+
+typedef struct retired {
+    struct retired *next;
+    void *p;
+    void (*free_fn)(void *);
+} retired_t;
+
+/* Per-thread state.  Records are only ever pushed onto the registry; when a
+   thread exits its record is released for reuse by the next new thread,
+   which also inherits whatever it still has in limbo. */
+typedef struct epoch_thread {
+    unsigned long epoch;        /* global epoch seen on entry */
+    int active;                 /* inside a critical section */
+    int in_use;                 /* owned by a live thread */
+    int nesting;
+    unsigned retire_count;
+    retired_t *limbo[3];        /* retired nodes, bucketed by epoch % 3 */
+    unsigned long limbo_epoch[3];
+    struct epoch_thread *next;
+} __attribute__((aligned(64))) epoch_thread;
+
+static unsigned long global_epoch;
+static epoch_thread *threads;
+static pthread_mutex_t reg_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_key;
+/* bumped by epoch_init so stale thread-local pointers are re-registered */
+static unsigned long registry_gen;
+
+static __thread epoch_thread *self;
+static __thread unsigned long self_gen;
+
+static void release_thread(void *arg) {
+    epoch_thread *t = arg;
+    __atomic_store_n(&t->active, 0, __ATOMIC_RELEASE);
+    t->nesting = 0;
+    __atomic_store_n(&t->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static epoch_thread *register_thread(void) {
+    pthread_mutex_lock(&reg_mutex);
+    epoch_thread *t;
+    for (t = threads; t; t = t->next)
+        if (!__atomic_load_n(&t->in_use, __ATOMIC_ACQUIRE)) break;
+    if (!t) {
+        if (posix_memalign((void **)&t, 64, sizeof(*t)) != 0) abort();
+        *t = (epoch_thread){0};
+        t->next = threads;
+        __atomic_store_n(&threads, t, __ATOMIC_RELEASE);
+    }
+    t->in_use = 1;
+    pthread_mutex_unlock(&reg_mutex);
+    pthread_setspecific(thread_key, t);
+    self = t;
+    self_gen = registry_gen;
+    return t;
+}
+
+static inline epoch_thread *get_self(void) {
+    if (self && self_gen == registry_gen) return self;
+    return register_thread();
+}
+
+static void free_list(retired_t *r) {
+    while (r) {
+        retired_t *next = r->next;
+        r->free_fn(r->p);
+        free(r);
+        r = next;
+    }
+}
+
+/* advance the global epoch if every active thread has caught up with it */
+static void try_advance(void) {
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (epoch_thread *t = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+        if (__atomic_load_n(&t->active, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&t->epoch, __ATOMIC_ACQUIRE) != e)
+            return;
+    }
+    __atomic_compare_exchange_n(&global_epoch, &e, e + 1, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/* free this thread's limbo lists that are two or more epochs old */
+static void reclaim(epoch_thread *t) {
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < 3; ++i) {
+        if (t->limbo[i] && t->limbo_epoch[i] + 2 <= e) {
+            retired_t *r = t->limbo[i];
+            t->limbo[i] = NULL;
+            free_list(r);
+        }
+    }
+}
+
+void epoch_init(void) {
+    pthread_key_create(&thread_key, release_thread);
+    global_epoch = 0;
+    threads = NULL;
+    registry_gen++;
+}
+
+void epoch_destroy(void) {
+    epoch_thread *t = threads;
+    while (t) {
+        epoch_thread *next = t->next;
+        for (int i = 0; i < 3; ++i) free_list(t->limbo[i]);
+        free(t);
+        t = next;
+    }
+    threads = NULL;
+    self = NULL;
+    pthread_key_delete(thread_key);
+}
+
+void epoch_enter(void) {
+    epoch_thread *t = get_self();
+    if (t->nesting++) return;
+    __atomic_store_n(&t->active, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&t->epoch, __atomic_load_n(&global_epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    /* publish before any shared pointer is read */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void) {
+    epoch_thread *t = get_self();
+    if (--t->nesting) return;
+    __atomic_store_n(&t->active, 0, __ATOMIC_RELEASE);
+}
+
+void epoch_retire(void *p, void (*free_fn)(void *)) {
+    epoch_thread *t = get_self();
+    /* the caller's unlink must be visible before we sample the epoch */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+
+    retired_t *r = malloc(sizeof(*r));
+    if (!r) {
+        /* no memory to defer with: wait out two epochs and free inline */
+        while (__atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) < e + 2) {
+            try_advance();
+            sched_yield();
+        }
+        free_fn(p);
+        return;
+    }
+    int slot = e % 3;
+    if (t->limbo[slot] && t->limbo_epoch[slot] != e) {
+        /* slot still holds epoch e-3: long since safe */
+        free_list(t->limbo[slot]);
+        t->limbo[slot] = NULL;
+    }
+    r->p = p;
+    r->free_fn = free_fn;
+    r->next = t->limbo[slot];
+    t->limbo[slot] = r;
+    t->limbo_epoch[slot] = e;
+
+    if (++t->retire_count % EPOCH_SCAN_EVERY == 0) {
+        try_advance();
+        reclaim(t);
+    }
+}
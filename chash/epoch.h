@@ -0,0 +1,17 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/* Epoch-based reclamation.
+   Readers bracket lock-free traversals with epoch_enter()/epoch_exit().
+   Writers unlink a node and hand it to epoch_retire(); it is freed only once
+   every thread that could still see it has left its critical section. */
+
+void epoch_init(void);
+/* frees everything still retired; no thread may be inside a critical section */
+void epoch_destroy(void);
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *p, void (*free_fn)(void *));
+
+#endif /* EPOCH_H */
@@ -1,164 +1,598 @@
-#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <pthread.h>
+#include <errno.h>
 #include "hash_table.h"
-#include "chash.h"
+#include "ht_backend.h"
+#include "snapshot.h"
+#include "salary_index.h"
+#include "cache.h"
+#include "logger.h"
+#include "stats.h"
+#include "wal.h"
 
-/* singly-linked list head (sorted by hash) */
-static hashRecord *head = NULL;
-/* rwlock protecting the list */
-static pthread_rwlock_t list_rwlock;
+/* Front end of the table: forwards each ht_* call to the backend chosen
+   at ht_init and times it for the per-operation statistics.  Changes
+   wait here for their write-ahead log records to reach the disk, after
+   the backend has released the stripe, and inserts make room here when
+   the table is over its cache limits. */
+
+static ht_read_mode read_mode = HT_READ_LOCKED;
+static ht_backend backend = HT_BACKEND_CHAIN;
+static const ht_ops *ops = &ht_chain_ops;
+
+#if HT_STATS
+__thread uint64_t ht_stripe_held;
+#endif
+
+/* size of print's output blocks */
+#define HT_PRINT_BLOCK (64 * 1024)
+/* size of a record buffer's name blocks (larger for a longer name) */
+#define HT_NAME_BLOCK (64 * 1024)
+
+static const char *const backend_names[] = {
+    [HT_BACKEND_CHAIN] = "chain",
+    [HT_BACKEND_SWISS] = "swiss",
+    [HT_BACKEND_COMPACT] = "compact",
+};
+
+struct ht_name_block {
+    ht_name_block *next;
+    size_t used, cap;
+    char data[];
+};
+
+hashRecord *recbuf_push(ht_recbuf *b, const char *name, size_t len) {
+    if (b->n == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 64;
+        hashRecord *grown = realloc(b->recs, sizeof(*grown) * cap);
+        if (!grown) return NULL;
+        b->recs = grown;
+        b->cap = cap;
+    }
+    ht_name_block *blk = b->names;
+    if (!blk || blk->cap - blk->used < len + 1) {
+        size_t cap = len + 1 > HT_NAME_BLOCK ? len + 1 : HT_NAME_BLOCK;
+        ht_name_block *fresh = malloc(sizeof(*fresh) + cap);
+        if (!fresh) return NULL;
+        fresh->next = blk;
+        fresh->used = 0;
+        fresh->cap = cap;
+        b->names = blk = fresh;
+    }
+    char *copy = blk->data + blk->used;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    blk->used += len + 1;
+    hashRecord *r = &b->recs[b->n++];
+    r->name = copy;
+    return r;
+}
+
+void recbuf_clear(ht_recbuf *b) {
+    b->n = 0;
+    if (!b->names) return;
+    ht_name_block *rest = b->names->next;
+    while (rest) {
+        ht_name_block *next = rest->next;
+        free(rest);
+        rest = next;
+    }
+    b->names->next = NULL;
+    b->names->used = 0;
+}
+
+void recbuf_free(ht_recbuf *b) {
+    recbuf_clear(b);
+    free(b->names);
+    free(b->recs);
+    memset(b, 0, sizeof(*b));
+}
+
+static int cmp_batch_key(const void *a, const void *b) {
+    const batch_key *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return (x->idx > y->idx) - (x->idx < y->idx);
+}
+
+batch_key *ht_batch_sort(const uint64_t *keys, size_t n) {
+    batch_key *sorted = malloc(sizeof(batch_key) * (n ? n : 1));
+    if (!sorted) return NULL;
+    for (size_t i = 0; i < n; ++i) {
+        sorted[i].key = keys[i];
+        sorted[i].idx = (uint32_t)i;
+    }
+    qsort(sorted, n, sizeof(batch_key), cmp_batch_key);
+    return sorted;
+}
+
+void ht_set_read_mode(ht_read_mode mode) {
+    read_mode = mode;
+}
+
+void ht_set_backend(ht_backend b) {
+    backend = b;
+}
+
+int ht_parse_backend(const char *s, ht_backend *out) {
+    for (size_t i = 0; i < sizeof(backend_names) / sizeof(backend_names[0]); ++i) {
+        if (strcmp(s, backend_names[i]) == 0) {
+            *out = (ht_backend)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *ht_backend_name(ht_backend b) {
+    return backend_names[b];
+}
 
-/* initialize/destroy */
 void ht_init(void) {
-    head = NULL;
-    pthread_rwlock_init(&list_rwlock, NULL);
+    ops = backend == HT_BACKEND_SWISS ? &ht_swiss_ops :
+          backend == HT_BACKEND_COMPACT ? &ht_compact_ops : &ht_chain_ops;
+    stats_reset();
+    cache_reset();
+    sidx_init();
+    ops->init(read_mode);
 }
+
 void ht_destroy(void) {
-    pthread_rwlock_wrlock(&list_rwlock);
-    hashRecord *cur = head;
-    while (cur) {
-        hashRecord *tmp = cur;
-        cur = cur->next;
-        free(tmp);
-    }
-    head = NULL;
-    pthread_rwlock_unlock(&list_rwlock);
-    pthread_rwlock_destroy(&list_rwlock);
-}
-
-/* helper: find prev by hash */
-static hashRecord *find_prev_by_hash(uint32_t hash, hashRecord **prev_out) {
-    hashRecord *prev = NULL;
-    hashRecord *cur = head;
-    while (cur && cur->hash < hash) {
-        prev = cur;
-        cur = cur->next;
-    }
-    if (prev_out) *prev_out = prev;
-    return cur;
-}
-
-/* Insert */
-int ht_insert(const char *name, uint32_t salary, uint32_t hash_out, int thread_prio) {
-    log_message("%lld: THREAD %d WRITE LOCK ACQUIRE ATTEMPT", current_timestamp_us(), thread_prio);
-    pthread_rwlock_wrlock(&list_rwlock);
-    log_message("%lld: THREAD %d WRITE LOCK ACQUIRED", current_timestamp_us(), thread_prio);
-
-    hashRecord *prev = NULL;
-    hashRecord *cur = find_prev_by_hash(hash_out, &prev);
-    if (cur && cur->hash == hash_out) {
-        log_message("%lld: THREAD %d WRITE LOCK RELEASED", current_timestamp_us(), thread_prio);
-        pthread_rwlock_unlock(&list_rwlock);
-        return -1;
+    wal_close();
+    ops->destroy();
+    snap_unload();
+    sidx_destroy();
+}
+
+void ht_set_capacity(uint64_t max_records, uint64_t max_bytes) {
+    cache_set_limits(max_records, max_bytes);
+}
+
+static int over_capacity(void) {
+    uint64_t max_records, max_bytes, count, sum;
+    cache_get_limits(&max_records, &max_bytes);
+    sidx_totals(&count, &sum);
+    return (max_records != 0 && count > max_records) ||
+           (max_bytes != 0 && __atomic_load_n(&cache_bytes, __ATOMIC_RELAXED) > max_bytes);
+}
+
+/* whose turns of the CLOCK hands are next: the stripes' in order, and
+   now and then the base's */
+static uint64_t clock_turn;
+
+/* Evicts one record: 0, or -1 if a hand of every stripe found none.
+   The base takes its share of the records' turns, spread out by a Weyl
+   sequence, so a loaded snapshot ages as fast as the rest. */
+static int evict_one(int thread_prio) {
+    char name[HT_NAME_MAX + 1];
+    for (int tries = 0; tries <= HT_NUM_STRIPES; ++tries) {
+        uint64_t turn = __atomic_fetch_add(&clock_turn, 1, __ATOMIC_RELAXED);
+        uint64_t count, sum, in_base = base_count();
+        sidx_totals(&count, &sum);
+        int from_base = in_base > 0 && ((turn * 0x9E3779B97F4A7C15ULL) >> 32) % (count ? count : 1) < in_base;
+        int rc = from_base ? base_clock_next(name)
+                           : ops->clock_next((size_t)(turn % HT_NUM_STRIPES), thread_prio, name);
+        /* the record may have gone since the hand passed it */
+        if (rc != 0 || ops->delete_key(name, key_hash(name), thread_prio, NULL) != 0) continue;
+        cache_count_eviction();
+        if (log_enabled(EV_EVICT)) log_event(EV_EVICT, thread_prio, jenkins_one_at_a_time_hash(name), name, 0);
+        return 0;
     }
-    hashRecord *node = malloc(sizeof(hashRecord));
-    if (!node) {
-        log_message("%lld: THREAD %d WRITE LOCK RELEASED", current_timestamp_us(), thread_prio);
-        pthread_rwlock_unlock(&list_rwlock);
-        return -1;
+    return -1;
+}
+
+/* Evicts until the table is back within its limits.  Writers call it
+   after their insert, under their log change hold, so the evictions are
+   logged as deletes; inserts running at once may each be one record
+   over for a moment. */
+static void make_room(int thread_prio) {
+    if (!cache_capped) return;
+    while (over_capacity() && evict_one(thread_prio) == 0) {
     }
-    node->hash = hash_out;
-    strncpy(node->name, name, sizeof(node->name)-1);
-    node->name[sizeof(node->name)-1] = '\0';
-    node->salary = salary;
+}
 
-    if (!prev) {
-        node->next = head;
-        head = node;
-    } else {
-        node->next = prev->next;
-        prev->next = node;
+int ht_insert(const char *name, uint32_t salary, uint64_t key, uint32_t hash_out, int thread_prio) {
+    STATS_TIME(t0);
+    wal_change_begin();
+    int rc = ops->insert(name, salary, key, hash_out, thread_prio);
+    if (rc == 0) make_room(thread_prio);
+    wal_change_end();
+    wal_sync();
+    STATS_SINCE(ST_OP_INSERT, t0);
+    return rc;
+}
+
+int ht_delete(const char *name, uint64_t key, int thread_prio, hashRecord *out_deleted) {
+    STATS_TIME(t0);
+    wal_change_begin();
+    int rc = ops->delete_key(name, key, thread_prio, out_deleted);
+    wal_change_end();
+    wal_sync();
+    STATS_SINCE(ST_OP_DELETE, t0);
+    return rc;
+}
+
+/* ht_update, ht_add_salary and ht_cas_salary: one backend call each */
+static int change_salary(const char *name, uint64_t key, const salary_op *op, int thread_prio,
+                         hashRecord *out_old) {
+    STATS_TIME(t0);
+    wal_change_begin();
+    int rc = ops->update(name, key, op, thread_prio, out_old);
+    wal_change_end();
+    wal_sync();
+    STATS_SINCE(ST_OP_UPDATE, t0);
+    return rc;
+}
+
+int ht_update(const char *name, uint32_t new_salary, uint64_t key, int thread_prio, hashRecord *out_old) {
+    salary_op op = { SAL_SET, new_salary, 0, 0 };
+    return change_salary(name, key, &op, thread_prio, out_old);
+}
+
+int ht_add_salary(const char *name, int32_t delta, uint64_t key, int thread_prio, hashRecord *out_old) {
+    salary_op op = { SAL_ADD, 0, 0, delta };
+    return change_salary(name, key, &op, thread_prio, out_old);
+}
+
+int ht_cas_salary(const char *name, uint32_t expected, uint32_t new_salary, uint64_t key, int thread_prio,
+                  hashRecord *out_old) {
+    salary_op op = { SAL_CAS, new_salary, expected, 0 };
+    return change_salary(name, key, &op, thread_prio, out_old);
+}
+
+int ht_upsert(const char *name, uint32_t salary, uint64_t key, uint32_t hash_out, int thread_prio,
+              hashRecord *out_old) {
+    STATS_TIME(t0);
+    wal_change_begin();
+    int rc = ops->upsert(name, salary, key, hash_out, thread_prio, out_old);
+    if (rc == 1) make_room(thread_prio);
+    wal_change_end();
+    wal_sync();
+    STATS_SINCE(rc == 1 ? ST_OP_INSERT : ST_OP_UPDATE, t0);
+    return rc;
+}
+
+int ht_search_into(const char *name, uint64_t key, int thread_prio, hashRecord *out) {
+    STATS_TIME(t0);
+    int rc = ops->search_into(name, key, thread_prio, out);
+    cache_count_lookups(rc == 0, rc != 0);
+    STATS_SINCE(ST_OP_SEARCH, t0);
+    return rc;
+}
+
+/* Search: returns malloc'd copy of record, with its name in the same
+   block, or NULL */
+hashRecord *ht_search(const char *name, uint64_t key, int thread_prio) {
+    hashRecord tmp;
+    if (ht_search_into(name, key, thread_prio, &tmp) != 0) return NULL;
+    size_t len = strlen(name);
+    hashRecord *res = malloc(sizeof(hashRecord) + len + 1);
+    if (res) {
+        *res = tmp;
+        res->name = memcpy(res + 1, name, len + 1);
     }
+    return res;
+}
 
-    log_message("%lld: THREAD %d WRITE LOCK RELEASED", current_timestamp_us(), thread_prio);
-    pthread_rwlock_unlock(&list_rwlock);
-    return 0;
+struct ht_cursor {
+    uint64_t from;              /* first key not returned yet */
+    int done;
+    int thread_prio;
+    int logged;                 /* the walk's lock events have started */
+    size_t chunk;
+    ht_recbuf buf;              /* the current chunk */
+};
+
+static int cmp_key_name(const void *a, const void *b) {
+    const hashRecord *x = a, *y = b;
+    if (x->key != y->key) return x->key < y->key ? -1 : 1;
+    return strcmp(x->name, y->name);
 }
 
-/* Delete: on success, out_deleted_salary filled if non-NULL */
-int ht_delete(const char *name, uint32_t hash_out, int thread_prio, uint32_t *out_deleted_salary) {
-    log_message("%lld: THREAD %d WRITE LOCK ACQUIRE ATTEMPT", current_timestamp_us(), thread_prio);
-    pthread_rwlock_wrlock(&list_rwlock);
-    log_message("%lld: THREAD %d WRITE LOCK ACQUIRED", current_timestamp_us(), thread_prio);
+ht_cursor *ht_cursor_open(size_t chunk, int thread_prio) {
+    ht_cursor *c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    c->chunk = chunk ? chunk : HT_CURSOR_CHUNK;
+    c->thread_prio = thread_prio;
+    return c;
+}
 
-    hashRecord *prev = NULL;
-    hashRecord *cur = head;
-    while (cur && cur->hash < hash_out) {
-        prev = cur;
-        cur = cur->next;
+/* A chunk gathers stretches of the key space, each copied under its own
+   lock hold, until it is full; a stretch is sorted by key only across
+   buckets, so the chunk is sorted here, outside every lock. */
+long ht_cursor_next(ht_cursor *c, const hashRecord **out) {
+    recbuf_clear(&c->buf);
+    if (!c->logged && !(read_mode == HT_READ_LOCKFREE && backend == HT_BACKEND_CHAIN)) {
+        log_event(EV_READ_LOCK_ATTEMPT, c->thread_prio, 0, NULL, 0);
+        log_event(EV_READ_LOCK_ACQUIRED, c->thread_prio, 0, NULL, 0);
+        c->logged = 1;
     }
-    if (!cur || cur->hash != hash_out) {
-        log_message("%lld: THREAD %d WRITE LOCK RELEASED", current_timestamp_us(), thread_prio);
-        pthread_rwlock_unlock(&list_rwlock);
-        return -1;
+    while (!c->done && c->buf.n < c->chunk) {
+        if (ops->scan(&c->from, &c->done, c->chunk, &c->buf) != 0) return -1;
     }
-    /* found */
-    if (out_deleted_salary) *out_deleted_salary = cur->salary;
-    if (!prev) head = cur->next;
-    else prev->next = cur->next;
-    free(cur);
+    if (c->buf.n) qsort(c->buf.recs, c->buf.n, sizeof(hashRecord), cmp_key_name);
+    *out = c->buf.recs;
+    return (long)c->buf.n;
+}
 
-    log_message("%lld: THREAD %d WRITE LOCK RELEASED", current_timestamp_us(), thread_prio);
-    pthread_rwlock_unlock(&list_rwlock);
-    return 0;
+void ht_cursor_close(ht_cursor *c) {
+    if (!c) return;
+    if (c->logged) log_event(EV_READ_LOCK_RELEASED, c->thread_prio, 0, NULL, 0);
+    recbuf_free(&c->buf);
+    free(c);
 }
 
-/* Update: return old salary via out_old_salary if non-NULL */
-int ht_update(const char *name, uint32_t new_salary, uint32_t hash_out, int thread_prio, uint32_t *out_old_salary) {
-    log_message("%lld: THREAD %d WRITE LOCK ACQUIRE ATTEMPT", current_timestamp_us(), thread_prio);
-    pthread_rwlock_wrlock(&list_rwlock);
-    log_message("%lld: THREAD %d WRITE LOCK ACQUIRED", current_timestamp_us(), thread_prio);
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
 
-    hashRecord *cur = head;
-    while (cur && cur->hash < hash_out) cur = cur->next;
-    if (!cur || cur->hash != hash_out) {
-        log_message("%lld: THREAD %d WRITE LOCK RELEASED", current_timestamp_us(), thread_prio);
-        pthread_rwlock_unlock(&list_rwlock);
-        return -1;
+/* Print order is by displayed hash, then name (distinct names may share
+   a Jenkins hash).  Sorting (hash << 32 | index) words moves 8 bytes per
+   step instead of a whole record; then each run of equal hashes, almost
+   always a single record, is put in name order.  Prints may run at once
+   (server mode), so the comparator's records are per thread. */
+static __thread const hashRecord *print_recs;
+
+static int cmp_print_name(const void *a, const void *b) {
+    return strcmp(print_recs[*(const uint64_t *)a & 0xFFFFFFFF].name,
+                  print_recs[*(const uint64_t *)b & 0xFFFFFFFF].name);
+}
+
+static void sort_for_print(const hashRecord *recs, uint64_t *order, size_t n) {
+    for (size_t i = 0; i < n; ++i) order[i] = (uint64_t)recs[i].hash << 32 | i;
+    qsort(order, n, sizeof(*order), cmp_u64);
+    print_recs = recs;
+    for (size_t i = 0, j; i < n; i = j) {
+        for (j = i + 1; j < n && order[j] >> 32 == order[i] >> 32; ++j) {}
+        if (j - i > 1) qsort(order + i, j - i, sizeof(*order), cmp_print_name);
     }
-    if (out_old_salary) *out_old_salary = cur->salary;
-    cur->salary = new_salary;
+}
 
-    log_message("%lld: THREAD %d WRITE LOCK RELEASED", current_timestamp_us(), thread_prio);
-    pthread_rwlock_unlock(&list_rwlock);
-    return 0;
+static char *put_u32(char *p, uint32_t v) {
+    char digits[10];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n) *p++ = digits[--n];
+    return p;
 }
 
-/* Search: returns malloc'd copy of record or NULL */
-hashRecord *ht_search(const char *name, uint32_t hash_out, int thread_prio) {
-    log_message("%lld: THREAD %d READ LOCK ACQUIRE ATTEMPT", current_timestamp_us(), thread_prio);
-    pthread_rwlock_rdlock(&list_rwlock);
-    log_message("%lld: THREAD %d READ LOCK ACQUIRED", current_timestamp_us(), thread_prio);
+/* Print all records sorted by hash.  The records are copied a chunk at a
+   time through a cursor, so a writer waits at most for one chunk's copy;
+   sorting and formatting happen after every lock is released, and the
+   lines go to the sink in large blocks. */
+void ht_print_all_to(int thread_prio, void (*sink)(const char *buf, size_t len, void *ctx), void *ctx) {
+    STATS_TIME(t0);
+    ht_recbuf all = { NULL, 0, 0, NULL };
+    ht_cursor *c = ht_cursor_open(0, thread_prio);
+    const hashRecord *chunk;
+    long n = c ? 0 : -1;
+    while (c && (n = ht_cursor_next(c, &chunk)) > 0) {
+        /* the chunk's names go with the next chunk, so they are copied */
+        for (long i = 0; i < n; ++i) {
+            hashRecord *r = recbuf_push(&all, chunk[i].name, strlen(chunk[i].name));
+            if (!r) {
+                n = -1;
+                break;
+            }
+            r->hash = chunk[i].hash;
+            r->salary = chunk[i].salary;
+            r->key = chunk[i].key;
+        }
+        if (n < 0) break;
+    }
+    ht_cursor_close(c);
 
-    hashRecord *cur = head;
-    while (cur && cur->hash < hash_out) cur = cur->next;
-    hashRecord *res = NULL;
-    if (cur && cur->hash == hash_out) {
-        res = malloc(sizeof(hashRecord));
-        if (res) memcpy(res, cur, sizeof(hashRecord));
+    static const char header[] = "Current Database:\n";
+    sink(header, sizeof(header) - 1, ctx);
+    char *text = n == 0 ? malloc(HT_PRINT_BLOCK) : NULL;
+    uint64_t *order = text ? malloc(sizeof(*order) * (all.n ? all.n : 1)) : NULL;
+    if (order) {
+        sort_for_print(all.recs, order, all.n);
+        char *p = text;
+        for (size_t i = 0; i < all.n; ++i) {
+            /* a line is at most 10 + 1 + HT_NAME_MAX + 1 + 10 + 1 bytes */
+            if (p - text > HT_PRINT_BLOCK - (HT_NAME_MAX + 32)) {
+                sink(text, (size_t)(p - text), ctx);
+                p = text;
+            }
+            const hashRecord *r = &all.recs[order[i] & 0xFFFFFFFF];
+            p = put_u32(p, r->hash);
+            *p++ = ',';
+            size_t len = strlen(r->name);
+            memcpy(p, r->name, len);
+            p += len;
+            *p++ = ',';
+            p = put_u32(p, r->salary);
+            *p++ = '\n';
+        }
+        sink(text, (size_t)(p - text), ctx);
+    } else {
+        perror("print");
     }
+    free(order);
+    free(text);
+    recbuf_free(&all);
+    STATS_SINCE(ST_OP_PRINT, t0);
+}
 
-    log_message("%lld: THREAD %d READ LOCK RELEASED", current_timestamp_us(), thread_prio);
-    pthread_rwlock_unlock(&list_rwlock);
-    return res;
+static void print_stdout(const char *buf, size_t len, void *ctx) {
+    (void)ctx;
+    fwrite(buf, 1, len, stdout);
 }
 
-/* Print all records (sorted by hash) to stdout */
 void ht_print_all(int thread_prio) {
-    log_message("%lld: THREAD %d READ LOCK ACQUIRE ATTEMPT", current_timestamp_us(), thread_prio);
-    pthread_rwlock_rdlock(&list_rwlock);
-    log_message("%lld: THREAD %d READ LOCK ACQUIRED", current_timestamp_us(), thread_prio);
+    ht_print_all_to(thread_prio, print_stdout, NULL);
+}
+
+int ht_search_batch(const char *const *names, const uint64_t *keys, size_t n,
+                    int thread_prio, hashRecord *out, int *found) {
+    int hits = ops->search_batch(names, keys, n, thread_prio, out, found);
+    cache_count_lookups((uint64_t)hits, n - (uint64_t)hits);
+    return hits;
+}
+
+int ht_insert_batch(const char *const *names, const uint32_t *salaries, const uint64_t *keys,
+                    const uint32_t *hashes, size_t n, int thread_prio, int *results) {
+    wal_change_begin();
+    int rc = ops->insert_batch(names, salaries, keys, hashes, n, thread_prio, results);
+    if (rc > 0) make_room(thread_prio);
+    wal_change_end();
+    wal_sync();
+    return rc;
+}
+
+long ht_salary_range(uint32_t lo, uint32_t hi, void (*fn)(const hashRecord *r, void *ctx), void *ctx) {
+    return sidx_range(lo, hi, fn, ctx);
+}
+
+void ht_salary_totals(uint64_t *count, uint64_t *sum) {
+    sidx_totals(count, sum);
+}
+
+/* With a write-ahead log, no change is applied while the records are
+   copied, so the snapshot holds exactly the changes up to the last record
+   logged by then; recovery replays only the ones after it. */
+int ht_snapshot(const char *path, int thread_prio) {
+    ht_recbuf all = { NULL, 0, 0, NULL };
+    wal_checkpoint_begin();
+    int rc = ops->collect(thread_prio, &all);
+    uint64_t lsn = wal_last_lsn();
+    wal_checkpoint_end();
+    if (rc != 0) {
+        recbuf_free(&all);
+        errno = ENOMEM;
+        return -1;
+    }
+    rc = snap_write(path, all.recs, all.n, lsn);
+    recbuf_free(&all);
+    if (rc == 0) {
+        wal_append(WAL_SNAPSHOT, path, 0);
+        wal_sync();
+    }
+    return rc;
+}
 
-    printf("Current Database:\n");
-    hashRecord *cur = head;
-    while (cur) {
-        printf("%u,%s,%u\n", cur->hash, cur->name, cur->salary);
-        cur = cur->next;
+/* The file is checked before anything changes, so a bad snapshot leaves
+   the table as it was.  The backend restarts empty with the snapshot as
+   its base; the records themselves are not touched until used. */
+int ht_load(const char *path) {
+    if (snap_load(path) != 0) return -1;
+    ops->destroy();
+    ops->init(read_mode);
+    sidx_clear();
+    if (base_index() != 0) {
+        perror("ht_load");
+        exit(1);
     }
+    wal_append(WAL_LOAD, path, 0);
+    make_room(-1);
+    wal_sync();
+    return 0;
+}
+
+int ht_snapshot_verify(const char *path) {
+    return snap_verify(path);
+}
+
+/* the last snapshot written or loaded according to the log */
+typedef struct {
+    char *path;
+    wal_op type;
+    uint64_t lsn;
+} wal_marker;
+
+static int find_marker(const wal_entry *e, void *ctx) {
+    wal_marker *m = ctx;
+    if (e->type != WAL_SNAPSHOT && e->type != WAL_LOAD) return 0;
+    char *path = strdup(e->name);
+    if (!path) return -1;
+    free(m->path);
+    m->path = path;
+    m->type = e->type;
+    m->lsn = e->lsn;
+    return 0;
+}
+
+typedef struct {
+    uint64_t from;              /* records up to here are in the snapshot */
+    long applied;
+} replay_ctx;
+
+static int replay(const wal_entry *e, void *ctx) {
+    replay_ctx *r = ctx;
+    if (e->lsn <= r->from) return 0;
+    uint64_t key = key_hash(e->name);
+    switch (e->type) {
+    case WAL_INSERT:
+        ops->insert(e->name, e->salary, key, jenkins_one_at_a_time_hash(e->name), -1);
+        break;
+    case WAL_DELETE:
+        ops->delete_key(e->name, key, -1, NULL);
+        break;
+    case WAL_UPDATE: {
+        salary_op op = { SAL_SET, e->salary, 0, 0 };
+        ops->update(e->name, key, &op, -1, NULL);
+        break;
+    }
+    case WAL_LOAD:
+        if (ht_load(e->name) != 0) return -1;
+        break;
+    case WAL_SNAPSHOT:
+        return 0;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+    r->applied++;
+    return 0;
+}
+
+/* Replays with the log still closed, so nothing is logged twice.  A
+   snapshot records the last change it holds; a load marker is itself the
+   point the loaded file stands for. */
+long ht_wal_open(const char *path, unsigned flush_us) {
+    wal_marker m = { NULL, 0, 0 };
+    uint64_t valid_len, last_lsn;
+    long n = wal_scan(path, find_marker, &m, &valid_len, &last_lsn);
+    if (n < 0 && errno != ENOENT) {
+        free(m.path);
+        return -1;
+    }
+    replay_ctx r = { 0, 0 };
+    if (m.path) {
+        int rc = ht_load(m.path);
+        r.from = m.type == WAL_SNAPSHOT ? snap_wal_lsn() : m.lsn;
+        free(m.path);
+        if (rc != 0) return -1;
+    }
+    if (n > 0 && wal_scan(path, replay, &r, &valid_len, &last_lsn) < 0) return -1;
+    if (wal_open(path, valid_len, last_lsn, flush_us) != 0) return -1;
+    /* the limits may be lower than when the log was written */
+    make_room(-1);
+    wal_sync();
+    return r.applied;
+}
+
+void ht_get_wal_stats(wal_stats *out) {
+    wal_get_stats(out);
+}
+
+void ht_get_resize_stats(ht_resize_stats *out) {
+    ops->resize_stats(out);
+}
+
+void ht_get_stats(ht_stats *out) {
+    stats_collect(out);
+}
 
-    log_message("%lld: THREAD %d READ LOCK RELEASED", current_timestamp_us(), thread_prio);
-    pthread_rwlock_unlock(&list_rwlock);
+void ht_get_cache_stats(ht_cache_stats *out) {
+    uint64_t sum;
+    cache_get_counters(&out->hits, &out->misses, &out->evictions);
+    sidx_totals(&out->records, &sum);
+    out->bytes = __atomic_load_n(&cache_bytes, __ATOMIC_RELAXED);
+    cache_get_limits(&out->max_records, &out->max_bytes);
 }
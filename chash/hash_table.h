@@ -1,23 +1,218 @@
 #ifndef HASH_TABLE_H
 #define HASH_TABLE_H
 
+#include <stddef.h>
 #include "chash.h"
+#include "stats.h"
+#include "wal.h"
+
+/* Build-time tuning (override with -D or `make STRIPES=... BUCKETS=...`).
+   Both must be powers of two, with BUCKETS >= STRIPES. */
+#ifndef HT_NUM_STRIPES
+#define HT_NUM_STRIPES 64      /* number of bucket lock stripes */
+#endif
+#ifndef HT_NUM_BUCKETS
+#define HT_NUM_BUCKETS 1024    /* initial and minimum number of hash buckets */
+#endif
+
+/* Online resizing: the table doubles when records exceed GROW_LOAD_PCT% of
+   the bucket count and halves when they drop under SHRINK_LOAD_PCT%.  The
+   records move incrementally, HT_MIGRATE_STEP buckets per write. */
+#ifndef HT_GROW_LOAD_PCT
+#define HT_GROW_LOAD_PCT 200
+#endif
+#ifndef HT_SHRINK_LOAD_PCT
+#define HT_SHRINK_LOAD_PCT 25
+#endif
+#ifndef HT_MIGRATE_STEP
+#define HT_MIGRATE_STEP 4
+#endif
+
+/* records per cursor chunk unless ht_cursor_open says otherwise */
+#ifndef HT_CURSOR_CHUNK
+#define HT_CURSOR_CHUNK 1024
+#endif
+
+/* Read path: HT_READ_LOCKED takes the stripe rwlock for searches and prints;
+   HT_READ_LOCKFREE walks the chains without locks and defers frees through
+   epoch-based reclamation (see epoch.h).  Select before ht_init(). */
+typedef enum {
+    HT_READ_LOCKED,
+    HT_READ_LOCKFREE
+} ht_read_mode;
+void ht_set_read_mode(ht_read_mode mode);
+
+/* Storage backend, selected before ht_init():
+   HT_BACKEND_CHAIN  sorted chains of heap nodes, resized incrementally
+   HT_BACKEND_SWISS  open addressing: 1-byte hash tags probed 16 at a time,
+                     records stored inline in the slot array
+   HT_BACKEND_COMPACT open addressing in separate arrays: tags, then 32-bit
+                     fingerprints sixteen to a cache line, then payloads,
+                     with the names length-prefixed in an arena
+   Only the chained backend has a lock-free read path; the others always
+   take the stripe lock, and HT_READ_LOCKFREE does not apply to them. */
+typedef enum {
+    HT_BACKEND_CHAIN,
+    HT_BACKEND_SWISS,
+    HT_BACKEND_COMPACT
+} ht_backend;
+void ht_set_backend(ht_backend backend);
+/* parses "chain", "swiss" or "compact"; returns -1 if unknown */
+int ht_parse_backend(const char *s, ht_backend *out);
+const char *ht_backend_name(ht_backend backend);
+
+/* Bounded cache mode, set before ht_init(): at most max_records records
+   and max_bytes bytes of table memory (records, their index and the
+   loaded snapshot; 0: no limit).  Inserts past a limit evict records
+   their stripe's CLOCK hand finds unused since it last passed, logged as
+   deletes.  The limits are soft: inserts running at once can each be
+   one record over until they return. */
+void ht_set_capacity(uint64_t max_records, uint64_t max_bytes);
 
 /* Initialize and destroy table */
 void ht_init(void);
 void ht_destroy(void);
 
-/* Thread-id aware operations (thread_prio used in logs) */
+/* Thread-id aware operations (thread_prio used in logs).  Records are
+   identified by name, of up to HT_NAME_MAX bytes; key must be
+   key_hash(name).  hash_out is the Jenkins hash stored with a new record
+   for display (see chash.h).  The records copied out by delete, the
+   updates, search_into and search_batch point their name at the
+   caller's name. */
 /* return values:
-   insert: 0 success, -1 duplicate
-   delete: 0 success, -1 not found (if success, out_deleted_salary is filled if non-NULL)
-   update: 0 success, -1 not found (old salary returned via out_old_salary if non-NULL)
-   search: returns malloc'd copy of record or NULL
+   insert: 0 success, -1 duplicate name
+   delete: 0 success, -1 not found (if success, the record is copied to *out_deleted if non-NULL)
+   update: 0 success, -1 not found (the record before the update is copied to *out_old if non-NULL)
+   upsert: 0 updated as by update, 1 inserted as by insert, -1 out of memory
+   add_salary: as update, with the salary raised by delta; -2 if the
+               result would fall outside 0..UINT32_MAX (nothing changed,
+               *out_old still filled)
+   cas_salary: as update, if the salary is expected; -2 if not (nothing
+               changed, the current record in *out_old)
+   search: returns malloc'd copy of record (name included) or NULL
+   search_into: 0 found (record copied into *out), -1 not found;
+                allocates nothing
 */
-int ht_insert(const char *name, uint32_t salary, uint32_t hash_out, int thread_prio);
-int ht_delete(const char *name, uint32_t hash_out, int thread_prio, uint32_t *out_deleted_salary);
-int ht_update(const char *name, uint32_t new_salary, uint32_t hash_out, int thread_prio, uint32_t *out_old_salary);
-hashRecord *ht_search(const char *name, uint32_t hash_out, int thread_prio);
+int ht_insert(const char *name, uint32_t salary, uint64_t key, uint32_t hash_out, int thread_prio);
+int ht_delete(const char *name, uint64_t key, int thread_prio, hashRecord *out_deleted);
+int ht_update(const char *name, uint32_t new_salary, uint64_t key, int thread_prio, hashRecord *out_old);
+hashRecord *ht_search(const char *name, uint64_t key, int thread_prio);
+/* Read-modify-write in one call: each finds the record once and changes
+   it under a single hold of its stripe, so nothing runs between the read
+   and the write, and logs the result as one insert or update. */
+int ht_upsert(const char *name, uint32_t salary, uint64_t key, uint32_t hash_out, int thread_prio,
+              hashRecord *out_old);
+int ht_add_salary(const char *name, int32_t delta, uint64_t key, int thread_prio, hashRecord *out_old);
+int ht_cas_salary(const char *name, uint32_t expected, uint32_t new_salary, uint64_t key, int thread_prio,
+                  hashRecord *out_old);
+int ht_search_into(const char *name, uint64_t key, int thread_prio, hashRecord *out);
 void ht_print_all(int thread_prio);
+/* ht_print_all handing the text to sink instead of stdout */
+void ht_print_all_to(int thread_prio, void (*sink)(const char *buf, size_t len, void *ctx), void *ctx);
+
+/* Cursors return every record in key order (key_hash, then name), a
+   chunk of about chunk records (0: HT_CURSOR_CHUNK) at a time.  Each chunk
+   is copied under short holds of single stripes (lock-free reads: inside
+   an epoch, holding nothing), so a writer waits at most for one stretch
+   of buckets to be copied and never for what the caller does with the
+   records.  Each record comes back once, as it was when its stretch was
+   copied; the whole is not one moment's snapshot, so a change to a key
+   ahead of the cursor shows up and one behind it doesn't.  ht_print_all
+   reads the table this way.  hash.log gets one read lock attempt,
+   acquire and release (key 0) for the whole walk, as for a print that
+   locks every stripe, rather than one per hold (none with lock-free
+   reads).
+   ht_cursor_next points *out at the next chunk, names included, valid
+   until the next call, and returns its length: 0 at the end, -1 if out of
+   memory. */
+typedef struct ht_cursor ht_cursor;
+ht_cursor *ht_cursor_open(size_t chunk, int thread_prio);
+long ht_cursor_next(ht_cursor *c, const hashRecord **out);
+void ht_cursor_close(ht_cursor *c);
+
+/* Batches of n keys.  Each stripe is locked once for all of its keys and
+   each key's first probe (chain head or control group) is prefetched
+   ahead of use; per-key results land at the
+   key's index, and repeated names behave as if applied in index order.
+   search_batch: found[i] is 0 (out[i] filled) or -1; returns keys found.
+   insert_batch: results[i] as for ht_insert; returns records inserted. */
+int ht_search_batch(const char *const *names, const uint64_t *keys, size_t n,
+                    int thread_prio, hashRecord *out, int *found);
+int ht_insert_batch(const char *const *names, const uint32_t *salaries, const uint64_t *keys,
+                    const uint32_t *hashes, size_t n, int thread_prio, int *results);
+
+/* Salary index (salary_index.h), kept in step with every change.
+   ht_salary_range calls fn for each record with lo <= salary <= hi, in
+   salary order (ties in print order), with no lock held; each stripe's matches
+   are copied under that stripe's index lock alone, so a range costs a
+   descent per stripe plus the records it returns, and writers elsewhere
+   carry on.  Names are valid for the call only.  Returns the number of
+   records, or -1 if out of memory.
+   ht_salary_totals reads the running record count and salary sum
+   without looking at any record; the two are read one after the other,
+   so while writers run they need not match the same moment. */
+long ht_salary_range(uint32_t lo, uint32_t hi, void (*fn)(const hashRecord *r, void *ctx), void *ctx);
+void ht_salary_totals(uint64_t *count, uint64_t *sum);
+
+/* Snapshots (format in snapshot.h).
+   ht_snapshot writes every record, as of one moment, to path (replaced
+   atomically via a synced temporary file).  ht_load replaces the table's
+   contents with the snapshot at path by mapping the file: records are
+   read from the mapping where they are stored, changes to them stay
+   private to this process, and the salary index serves them from the
+   file's salary order, so no step goes over every record (unless the
+   file was written by a build with a different HT_NUM_STRIPES, which
+   adds them to the index one by one).
+   Like ht_init, ht_load must not run concurrently with other calls.
+   ht_load checks the file's header and index; ht_snapshot_verify also
+   checks the records' CRC, which reads the whole file.
+   All return 0 or -1 with errno set (EINVAL: not a usable snapshot, for
+   example one written by a build with a different key hash). */
+int ht_snapshot(const char *path, int thread_prio);
+int ht_load(const char *path);
+int ht_snapshot_verify(const char *path);
+
+/* Write-ahead log (format and group commit in wal.h).
+   ht_wal_open first recovers the table from the log at path, if there
+   is one: it loads the snapshot that the log last wrote or loaded, if
+   any, and replays the changes logged after it.  From then on every
+   insert, delete, update, batch insert, snapshot and load is logged, and
+   the call returns only once its record is on disk.  Changes running at
+   the same time share one write and fdatasync; flush_us is how long the
+   first of them waits for others to join before writing (0: don't wait).
+   Call right after ht_init; ht_destroy closes the log.  Returns the
+   changes replayed, or -1 with errno set. */
+long ht_wal_open(const char *path, unsigned flush_us);
+/* records, commits and group writes since ht_wal_open */
+void ht_get_wal_stats(wal_stats *out);
+
+/* resize counters */
+typedef struct {
+    unsigned long grows;            /* resizes started that doubled the table */
+    unsigned long shrinks;          /* resizes started that halved it */
+    unsigned long buckets_migrated; /* old buckets moved, over all resizes (swiss: slots) */
+    int resizing;                   /* 1 while a migration is in progress */
+    size_t buckets;                 /* bucket count of the current array (swiss: slots) */
+    size_t records;
+} ht_resize_stats;
+void ht_get_resize_stats(ht_resize_stats *out);
+
+/* Lock wait/hold, chain-walk and per-operation latency histograms summed
+   over all threads since ht_init (see stats.h); all zero when built with
+   HT_STATS=0. */
+void ht_get_stats(ht_stats *out);
+
+/* cache counters since ht_init: lookups by ht_search, ht_search_into and
+   ht_search_batch, and records evicted to stay within the limits */
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t records;
+    uint64_t bytes;                 /* table memory charged now */
+    uint64_t max_records;           /* limits, 0 if none */
+    uint64_t max_bytes;
+} ht_cache_stats;
+void ht_get_cache_stats(ht_cache_stats *out);
 
 #endif /* HASH_TABLE_H */
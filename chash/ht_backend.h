@@ -0,0 +1,172 @@
+#ifndef HT_BACKEND_H
+#define HT_BACKEND_H
+
+#include <pthread.h>
+#include <string.h>
+#include "hash_table.h"
+#include "cache.h"
+#include "stats.h"
+
+/* Growable array of record copies.  The copies' names live in an arena
+   of blocks owned by the buffer, which never move, so a copy's name stays
+   put while more are added. */
+typedef struct ht_name_block ht_name_block;
+typedef struct {
+    hashRecord *recs;
+    size_t n, cap;
+    ht_name_block *names;       /* current block first */
+} ht_recbuf;
+
+/* Appends a copy of name (len bytes) to b's arena and a record naming it
+   to b, with the other fields for the caller to fill; NULL if out of
+   memory (hash_table.c) */
+hashRecord *recbuf_push(ht_recbuf *b, const char *name, size_t len);
+/* empties b, keeping one arena block and the array for reuse */
+void recbuf_clear(ht_recbuf *b);
+void recbuf_free(ht_recbuf *b);
+
+/* How an update changes a found record's salary: ht_update sets it,
+   ht_add_salary adds to it and ht_cas_salary sets it only if it holds
+   the expected value. */
+typedef enum {
+    SAL_SET,
+    SAL_ADD,
+    SAL_CAS
+} salary_op_kind;
+
+typedef struct {
+    salary_op_kind kind;
+    uint32_t salary;            /* SET, CAS: the new salary */
+    uint32_t expected;          /* CAS */
+    int32_t delta;              /* ADD */
+} salary_op;
+
+/* 0 with the salary op makes of old in *out, or -2 if op refuses old (CAS:
+   it is not the expected one; ADD: the sum would fall outside 0..UINT32_MAX) */
+static inline int salary_apply(const salary_op *op, uint32_t old, uint32_t *out) {
+    int64_t sum;
+    switch (op->kind) {
+    case SAL_ADD:
+        sum = (int64_t)old + op->delta;
+        if (sum < 0 || sum > UINT32_MAX) return -2;
+        *out = (uint32_t)sum;
+        return 0;
+    case SAL_CAS:
+        if (old != op->expected) return -2;
+        *out = op->salary;
+        return 0;
+    default:
+        *out = op->salary;
+        return 0;
+    }
+}
+
+/* Storage engine behind the ht_* functions.  hash_table.c picks one at
+   ht_init and forwards every call to it; the per-operation latency
+   statistics are taken there, so backends only record lock and probe
+   statistics.  Entries follow the ht_* contracts in hash_table.h.  Keys
+   missing from a backend's own storage are looked up in the snapshot
+   base (snapshot.h) under the same stripe, and every change is appended
+   to the write-ahead log (wal.h) before the stripe is released.  What
+   they allocate for records is charged to the cache's byte count, and
+   lookups and updates set the record's reference byte (cache.h). */
+typedef struct {
+    void (*init)(ht_read_mode mode);
+    void (*destroy)(void);
+    int (*insert)(const char *name, uint32_t salary, uint64_t key, uint32_t hash, int thread_prio);
+    int (*delete_key)(const char *name, uint64_t key, int thread_prio, hashRecord *out_deleted);
+    /* finds the record once and applies op to it under one stripe hold:
+       0, -1 not found or -2 refused by salary_apply; the record as it
+       was goes to out_old if non-NULL whenever it is found */
+    int (*update)(const char *name, uint64_t key, const salary_op *op, int thread_prio,
+                  hashRecord *out_old);
+    /* one stripe hold: updates the record as update with SAL_SET (0) or,
+       if there is none, inserts it (1); -1 if out of memory */
+    int (*upsert)(const char *name, uint32_t salary, uint64_t key, uint32_t hash, int thread_prio,
+                  hashRecord *out_old);
+    int (*search_into)(const char *name, uint64_t key, int thread_prio, hashRecord *out);
+    /* appends every record (including the snapshot base, see snapshot.h)
+       to b, as of one moment; 0, or -1 if out of memory */
+    int (*collect)(int thread_prio, ht_recbuf *b);
+    /* Appends to b the records (snapshot base included) of the next
+       stretch of the key space from *from, copied under one hold of the
+       stripe holding *from (lock-free reads: inside an epoch): whole
+       buckets until b->n reaches want or the stripe ends (swiss: the whole
+       stripe).  Moves *from to the first key not copied, or sets *done
+       after the last stripe.  0, or -1 if out of memory.  The cursor logs
+       the lock events, once per walk. */
+    int (*scan)(uint64_t *from, int *done, size_t want, ht_recbuf *b);
+    int (*search_batch)(const char *const *names, const uint64_t *keys, size_t n,
+                        int thread_prio, hashRecord *out, int *found);
+    int (*insert_batch)(const char *const *names, const uint32_t *salaries, const uint64_t *keys,
+                        const uint32_t *hashes, size_t n, int thread_prio, int *results);
+    void (*resize_stats)(ht_resize_stats *out);
+    /* CLOCK hand of one stripe, moved under a read hold (lock-free reads:
+       inside an epoch): from where it last stopped, it clears the
+       reference byte of each record it passes that has one set, and stops
+       past the first that has none.  That record's name goes to name
+       (HT_NAME_MAX + 1 bytes) and 0 is returned; -1 if two turns of the
+       stripe found none.  The caller evicts the record with delete_key,
+       so a record read in between is evicted all the same. */
+    int (*clock_next)(size_t stripe, int thread_prio, char *name);
+} ht_ops;
+
+extern const ht_ops ht_chain_ops;       /* ht_chain.c */
+extern const ht_ops ht_swiss_ops;       /* ht_swiss.c */
+extern const ht_ops ht_compact_ops;     /* ht_compact.c */
+
+/* Batches are sorted by (key, caller index): that groups the keys by
+   stripe, so each stripe is locked once, and keeps repeated keys in caller
+   order.  While key k is worked on, keys HT_PREFETCH_AHEAD and half as far
+   ahead are prefetched in two stages, so their cache misses overlap with
+   the current key's work instead of following it. */
+#define HT_PREFETCH_AHEAD 8
+
+typedef struct {
+    uint64_t key;
+    uint32_t idx;
+} batch_key;
+
+/* sorted keys of a batch, NULL if out of memory (hash_table.c) */
+batch_key *ht_batch_sort(const uint64_t *keys, size_t n);
+
+/* Stored names carry their length; a lookup takes the length of the
+   name it looks for once, and compares bytes only when the lengths match. */
+static inline int name_eq(const char *stored, size_t stored_len, const char *name, size_t len) {
+    return stored_len == len && memcmp(stored, name, len) == 0;
+}
+
+/* lock events carry the high word of the key, which picks the stripe */
+static inline uint32_t log_key(uint64_t key) {
+    return (uint32_t)(key >> 32);
+}
+
+/* one rwlock per stripe, padded so neighbouring stripes don't share a line */
+typedef struct {
+    pthread_rwlock_t lock;
+} __attribute__((aligned(64))) ht_stripe;
+
+/* Stripe locking with wait/hold statistics.  Outside the backends'
+   lock-everything paths a thread holds at most one stripe, and those
+   paths count the whole set as one acquisition, so one start time per
+   thread is enough. */
+#if HT_STATS
+extern __thread uint64_t ht_stripe_held;
+#endif
+
+static inline void stripe_rdlock(pthread_rwlock_t *lock) {
+    STATS_TIME(t0);
+    pthread_rwlock_rdlock(lock);
+    STATS_LAP(ST_STRIPE_WAIT, t0, ht_stripe_held);
+}
+static inline void stripe_wrlock(pthread_rwlock_t *lock) {
+    STATS_TIME(t0);
+    pthread_rwlock_wrlock(lock);
+    STATS_LAP(ST_STRIPE_WAIT, t0, ht_stripe_held);
+}
+static inline void stripe_unlock(pthread_rwlock_t *lock) {
+    STATS_SINCE(ST_STRIPE_HOLD, ht_stripe_held);
+    pthread_rwlock_unlock(lock);
+}
+
+#endif /* HT_BACKEND_H */
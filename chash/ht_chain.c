@@ -0,0 +1,941 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include "hash_table.h"
+#include "ht_backend.h"
+#include "chash.h"
+#include "epoch.h"
+#include "slab.h"
+#include "snapshot.h"
+#include "salary_index.h"
+#include "logger.h"
+#include "stats.h"
+#include "wal.h"
+
+/* Bucket and stripe counts must be powers of two and there must be at least
+   as many buckets as stripes.  Both index by the top bits of the key hash,
+   so a bucket always lives inside exactly one stripe (whatever the table
+   size) and walking the buckets in index order visits the records in key
+   order. */
+#if (HT_NUM_STRIPES & (HT_NUM_STRIPES - 1)) != 0 || HT_NUM_STRIPES < 1
+#error "HT_NUM_STRIPES must be a power of two"
+#endif
+#if (HT_NUM_BUCKETS & (HT_NUM_BUCKETS - 1)) != 0 || HT_NUM_BUCKETS < HT_NUM_STRIPES
+#error "HT_NUM_BUCKETS must be a power of two >= HT_NUM_STRIPES"
+#endif
+
+/* A record in a chain: the link and the key, which a walk reads, come
+   first, and the name is stored at its own length after the payload.
+   Nodes come from slab pools of a few sizes; a node too big for the
+   largest is malloc'd. */
+typedef struct ch_node {
+    struct ch_node *next;
+    uint64_t key;
+    uint32_t hash;              /* Jenkins, for display */
+    uint32_t salary;
+    uint16_t len;
+    uint8_t ref;                /* CLOCK reference byte (cache.h) */
+    char name[];                /* len bytes and a NUL */
+} ch_node;
+
+#define CH_NODE_CLASSES 6
+static const size_t node_class_size[CH_NODE_CLASSES] = { 32, 48, 64, 80, 96, 128 };
+
+/* A bucket array.  While a resize is in progress there are two of them:
+   cur_array receives all writes and old_array is frozen.  Before a writer
+   touches a key it moves that key's old bucket across, so an old bucket
+   that is not yet marked moved still holds every record in its key range
+   and the new array holds none of them. */
+typedef struct {
+    unsigned bits;              /* log2(nbuckets) */
+    size_t nbuckets;
+    ch_node **buckets;          /* each chain is sorted by key */
+    unsigned char *moved;       /* per bucket, set once migrated (old array only) */
+    size_t migrate_next;        /* next bucket to try, taken with fetch_add */
+    size_t moved_count;
+} ht_array;
+
+static ht_stripe stripes[HT_NUM_STRIPES];
+static unsigned stripe_bits;    /* log2(HT_NUM_STRIPES) */
+
+/* one pool per node size class */
+static slab_pool *node_pools[CH_NODE_CLASSES];
+
+static ht_array *cur_array;
+static ht_array *old_array;
+/* per stripe, the key its CLOCK hand stands at */
+static uint64_t clock_hand[HT_NUM_STRIPES];
+/* odd while cur_array/old_array are being swapped; lets lock-free readers
+   notice that a resize started or finished under them */
+static unsigned long resize_seq;
+/* set while a writer allocates the array for the next resize */
+static int resize_claimed;
+static size_t record_count;
+
+/* resize counters */
+static unsigned long n_grows;
+static unsigned long n_shrinks;
+static unsigned long n_migrated;
+
+/* The chained backend: sorted chains under striped rwlocks, resized
+   incrementally.
+
+   In lock-free read mode, searches and prints take no lock at all: they
+   walk the chains with acquire loads inside an epoch, and writers (still
+   serialized per stripe) publish links with release stores and retire
+   unlinked nodes through epoch-based reclamation instead of freeing them.
+   Writers use the atomic stores in both modes so the chains look the same. */
+static ht_read_mode read_mode = HT_READ_LOCKED;
+
+static unsigned log2_u32(uint32_t v) {
+    unsigned r = 0;
+    while (v >>= 1) r++;
+    return r;
+}
+
+/* top `bits` bits of the key; shifting a uint64_t by 64 is undefined */
+static inline size_t top_bits(uint64_t key, unsigned bits) {
+    return bits == 0 ? 0 : (size_t)(key >> (64 - bits));
+}
+static inline pthread_rwlock_t *stripe_of(uint64_t key) {
+    return &stripes[top_bits(key, stripe_bits)].lock;
+}
+/* stripe guarding bucket i of array a */
+static inline pthread_rwlock_t *stripe_of_bucket(const ht_array *a, size_t i) {
+    return &stripes[i >> (a->bits - stripe_bits)].lock;
+}
+
+static inline ch_node *load_link(ch_node **link) {
+    return __atomic_load_n(link, __ATOMIC_ACQUIRE);
+}
+static inline void store_link(ch_node **link, ch_node *node) {
+    __atomic_store_n(link, node, __ATOMIC_RELEASE);
+}
+static inline int bucket_moved(const ht_array *a, size_t i) {
+    return __atomic_load_n(&a->moved[i], __ATOMIC_ACQUIRE);
+}
+
+static size_t array_bytes(const ht_array *a) {
+    return sizeof(*a) + a->nbuckets * (sizeof(ch_node *) + 1);
+}
+
+static ht_array *array_new(unsigned bits) {
+    ht_array *a = calloc(1, sizeof(*a));
+    if (!a) return NULL;
+    a->bits = bits;
+    a->nbuckets = (size_t)1 << bits;
+    a->buckets = calloc(a->nbuckets, sizeof(ch_node *));
+    a->moved = calloc(a->nbuckets, 1);
+    if (!a->buckets || !a->moved) {
+        free(a->buckets);
+        free(a->moved);
+        free(a);
+        return NULL;
+    }
+    cache_charge((int64_t)array_bytes(a));
+    return a;
+}
+
+/* size class of a node holding a len-byte name, or -1 for malloc */
+static int node_class(size_t len) {
+    size_t size = offsetof(ch_node, name) + len + 1;
+    for (int c = 0; c < CH_NODE_CLASSES; ++c)
+        if (size <= node_class_size[c]) return c;
+    return -1;
+}
+
+/* bytes a node holding a len-byte name takes: its class's size, or
+   exactly what it needs if malloc'd */
+static size_t node_bytes(size_t len) {
+    int c = node_class(len);
+    return c >= 0 ? node_class_size[c] : offsetof(ch_node, name) + len + 1;
+}
+
+static ch_node *node_alloc(size_t len) {
+    int c = node_class(len);
+    ch_node *node = c >= 0 ? slab_alloc(node_pools[c]) : malloc(offsetof(ch_node, name) + len + 1);
+    if (node) {
+        node->len = (uint16_t)len;
+        cache_charge((int64_t)node_bytes(len));
+    }
+    return node;
+}
+static void node_free(void *p) {
+    ch_node *node = p;
+    int c = node_class(node->len);
+    cache_charge(-(int64_t)node_bytes(node->len));
+    if (c >= 0) slab_free(node_pools[c], node);
+    else free(node);
+}
+
+static void chain_free(ch_node *cur) {
+    while (cur) {
+        ch_node *tmp = cur;
+        cur = cur->next;
+        node_free(tmp);
+    }
+}
+
+/* frees the array and every node still chained from it */
+static void array_free(void *p) {
+    ht_array *a = p;
+    for (size_t b = 0; b < a->nbuckets; ++b) chain_free(a->buckets[b]);
+    cache_charge(-(int64_t)array_bytes(a));
+    free(a->buckets);
+    free(a->moved);
+    free(a);
+}
+
+static void lock_all(void) {
+    STATS_TIME(t0);
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) pthread_rwlock_wrlock(&stripes[i].lock);
+    STATS_LAP(ST_STRIPE_WAIT, t0, ht_stripe_held);
+}
+static void unlock_all(void) {
+    STATS_SINCE(ST_STRIPE_HOLD, ht_stripe_held);
+    for (int i = HT_NUM_STRIPES - 1; i >= 0; --i) pthread_rwlock_unlock(&stripes[i].lock);
+}
+
+/* initialize/destroy */
+static void chained_init(ht_read_mode mode) {
+    read_mode = mode;
+    epoch_init();
+    int pools_ok = 1;
+    for (int c = 0; c < CH_NODE_CLASSES; ++c)
+        pools_ok = (node_pools[c] = slab_create(node_class_size[c])) != NULL && pools_ok;
+    stripe_bits = log2_u32(HT_NUM_STRIPES);
+    for (int i = 0; i < HT_NUM_STRIPES; ++i)
+        pthread_rwlock_init(&stripes[i].lock, NULL);
+    cur_array = array_new(log2_u32(HT_NUM_BUCKETS));
+    if (!pools_ok || !cur_array) {
+        perror("ht_init");
+        exit(1);
+    }
+    old_array = NULL;
+    memset(clock_hand, 0, sizeof(clock_hand));
+    resize_seq = 0;
+    resize_claimed = 0;
+    record_count = 0;
+    n_grows = n_shrinks = n_migrated = 0;
+}
+static void chained_destroy(void) {
+    lock_all();
+    /* moved old buckets are either empty or (lock-free mode) hold the
+       originals of nodes that were copied across, so each array owns
+       everything still chained from it */
+    if (old_array) array_free(old_array);
+    array_free(cur_array);
+    old_array = cur_array = NULL;
+    for (int i = HT_NUM_STRIPES - 1; i >= 0; --i) {
+        pthread_rwlock_unlock(&stripes[i].lock);
+        pthread_rwlock_destroy(&stripes[i].lock);
+    }
+    epoch_destroy();    /* frees retired nodes back into the pools */
+    for (int c = 0; c < CH_NODE_CLASSES; ++c) {
+        slab_destroy(node_pools[c]);
+        node_pools[c] = NULL;
+    }
+}
+
+/* copy a live record out, naming it name; salary is the only field that
+   changes in place */
+static void copy_record(hashRecord *dst, const ch_node *src, const char *name) {
+    dst->hash = src->hash;
+    dst->salary = __atomic_load_n(&src->salary, __ATOMIC_RELAXED);
+    dst->key = src->key;
+    dst->name = name;
+}
+
+/* helper: first node whose key is >= key, and its prev, within one chain */
+static ch_node *find_prev_by_key(ch_node **head, uint64_t key, ch_node **prev_out) {
+    ch_node *prev = NULL;
+    ch_node *cur = load_link(head);
+    uint64_t visited = 0;
+    while (cur && cur->key < key) {
+        prev = cur;
+        cur = load_link(&cur->next);
+        visited++;
+    }
+    STATS_VALUE(ST_CHAIN_WALK, visited + (cur != NULL));
+    if (prev_out) *prev_out = prev;
+    return cur;
+}
+
+/* helper: the node named name (len bytes), and its prev, or NULL.  Names
+   are only compared within the run of nodes whose key matches. */
+static ch_node *find_by_name(ch_node **head, uint64_t key, const char *name, size_t len,
+                             ch_node **prev_out) {
+    ch_node *prev = NULL;
+    ch_node *cur = find_prev_by_key(head, key, &prev);
+    while (cur && cur->key == key && !name_eq(cur->name, cur->len, name, len)) {
+        prev = cur;
+        cur = load_link(&cur->next);
+    }
+    if (prev_out) *prev_out = prev;
+    return cur && cur->key == key ? cur : NULL;
+}
+
+/* link node into its sorted position in a chain */
+static void chain_insert(ch_node **head, ch_node *node) {
+    ch_node *prev = NULL;
+    find_prev_by_key(head, node->key, &prev);
+    ch_node **link = prev ? &prev->next : head;
+    node->next = *link;
+    store_link(link, node);
+}
+
+/* Move old bucket i into cur_array; caller holds its stripe for writing.
+   Locked readers can't be inside the chain, so nodes are simply relinked.
+   Lock-free readers may be walking it, so the old chain is left intact and
+   copies are published instead; the originals go with the old array. */
+static int migrate_bucket(ht_array *old, size_t i) {
+    ht_array *cur = cur_array;
+    ch_node *n = old->buckets[i];
+    if (read_mode == HT_READ_LOCKFREE) {
+        /* copy everything before linking anything, so running out of
+           memory leaves the bucket untouched */
+        ch_node *copies = NULL, **tail = &copies;
+        for (ch_node *m = n; m; m = m->next) {
+            ch_node *copy = node_alloc(m->len);
+            if (!copy) {
+                chain_free(copies);
+                return -1;
+            }
+            copy->key = m->key;
+            copy->hash = m->hash;
+            copy->salary = __atomic_load_n(&m->salary, __ATOMIC_RELAXED);
+            copy->ref = __atomic_load_n(&m->ref, __ATOMIC_RELAXED);
+            memcpy(copy->name, m->name, (size_t)m->len + 1);
+            copy->next = NULL;
+            *tail = copy;
+            tail = &copy->next;
+        }
+        n = copies;
+    } else {
+        old->buckets[i] = NULL;
+    }
+    while (n) {
+        ch_node *next = n->next;
+        chain_insert(&cur->buckets[top_bits(n->key, cur->bits)], n);
+        n = next;
+    }
+    __atomic_store_n(&old->moved[i], 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&old->moved_count, 1, __ATOMIC_ACQ_REL);
+    __atomic_fetch_add(&n_migrated, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Writer entry: returns the chain in cur_array that holds key, first
+   migrating its old bucket if a resize is in progress.  Caller holds the
+   key's stripe for writing, which keeps cur_array/old_array stable. */
+static ch_node **bucket_for_write(uint64_t key) {
+    ht_array *old = old_array;
+    if (old) {
+        size_t i = top_bits(key, old->bits);
+        if (!old->moved[i] && migrate_bucket(old, i) != 0) return NULL;
+    }
+    return &cur_array->buckets[top_bits(key, cur_array->bits)];
+}
+
+/* chain a reader walks for key: the old bucket until it has moved */
+static ch_node **read_head(ht_array *old, ht_array *cur, uint64_t key) {
+    if (old) {
+        size_t i = top_bits(key, old->bits);
+        if (!bucket_moved(old, i)) return &old->buckets[i];
+    }
+    return &cur->buckets[top_bits(key, cur->bits)];
+}
+
+/* Reader entry: caller holds the stripe (any mode) or an epoch. */
+static ch_node *lookup(ht_array *old, ht_array *cur, uint64_t key, const char *name, size_t len) {
+    return find_by_name(read_head(old, cur, key), key, name, len, NULL);
+}
+
+static void swap_begin(void) { __atomic_fetch_add(&resize_seq, 1, __ATOMIC_SEQ_CST); }
+static void swap_end(void) { __atomic_fetch_add(&resize_seq, 1, __ATOMIC_SEQ_CST); }
+
+static void finish_resize(ht_array *old) {
+    lock_all();
+    if (old_array == old && old->moved_count == old->nbuckets) {
+        swap_begin();
+        __atomic_store_n(&old_array, NULL, __ATOMIC_RELEASE);
+        swap_end();
+        log_event(EV_RESIZE_DONE, -1, 0, NULL, (uint32_t)cur_array->nbuckets);
+        epoch_retire(old, array_free);
+    }
+    unlock_all();
+}
+
+/* Start a grow/shrink if the load factor crossed a threshold and no resize
+   is running.  Only pointers are swapped under the stripe locks; the
+   records move later, a few buckets at a time. */
+static void maybe_start_resize(void) {
+    size_t n = __atomic_load_n(&record_count, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&old_array, __ATOMIC_ACQUIRE)) return;
+    epoch_enter();
+    ht_array *cur = __atomic_load_n(&cur_array, __ATOMIC_ACQUIRE);
+    int grow = n * 100 > cur->nbuckets * HT_GROW_LOAD_PCT && cur->bits < 32;
+    int shrink = n * 100 < cur->nbuckets * HT_SHRINK_LOAD_PCT && cur->nbuckets > HT_NUM_BUCKETS;
+    unsigned bits = grow ? cur->bits + 1 : cur->bits - 1;
+    epoch_exit();
+    if (!grow && !shrink) return;
+
+    /* allocated before the locks, so the table does not wait for it, and
+       by one writer at a time, so the others do not allocate in vain */
+    if (__atomic_exchange_n(&resize_claimed, 1, __ATOMIC_ACQUIRE)) return;
+    ht_array *next = array_new(bits);
+    if (!next) {
+        __atomic_store_n(&resize_claimed, 0, __ATOMIC_RELEASE);
+        return;
+    }
+    lock_all();
+    /* cur is only dereferenced again if it is still the live array */
+    if (!old_array && cur == cur_array) {
+        swap_begin();
+        __atomic_store_n(&old_array, cur, __ATOMIC_RELEASE);
+        __atomic_store_n(&cur_array, next, __ATOMIC_RELEASE);
+        swap_end();
+        if (grow) n_grows++;
+        else n_shrinks++;
+        log_event(EV_RESIZE_START, -1, (uint32_t)cur->nbuckets, NULL, (uint32_t)next->nbuckets);
+        next = NULL;
+    }
+    unlock_all();
+    __atomic_store_n(&resize_claimed, 0, __ATOMIC_RELEASE);
+    /* a resize started and finished while it was allocated */
+    if (next) array_free(next);
+}
+
+/* Move up to HT_MIGRATE_STEP buckets of the running resize, finish it if
+   nothing is left, and start the next one if the load factor calls for it.
+   Called by writers after they drop their own stripe. */
+static void migrate_step(void) {
+    epoch_enter();   /* keeps old alive even if someone else finishes it */
+    ht_array *old = __atomic_load_n(&old_array, __ATOMIC_ACQUIRE);
+    int done = 0;
+    if (old) {
+        for (int k = 0; k < HT_MIGRATE_STEP; ++k) {
+            if (__atomic_load_n(&old->moved_count, __ATOMIC_ACQUIRE) == old->nbuckets) break;
+            size_t i = __atomic_fetch_add(&old->migrate_next, 1, __ATOMIC_RELAXED) % old->nbuckets;
+            pthread_rwlock_t *lock = stripe_of_bucket(old, i);
+            stripe_wrlock(lock);
+            if (old_array == old && !old->moved[i]) migrate_bucket(old, i);
+            stripe_unlock(lock);
+        }
+        done = __atomic_load_n(&old->moved_count, __ATOMIC_ACQUIRE) == old->nbuckets;
+    }
+    epoch_exit();
+    /* outside the epoch: finish_resize only dereferences old after
+       checking under the locks that it is still the live old array */
+    if (done) finish_resize(old);
+    maybe_start_resize();
+}
+
+static void chained_resize_stats(ht_resize_stats *out) {
+    epoch_enter();
+    ht_array *old = __atomic_load_n(&old_array, __ATOMIC_ACQUIRE);
+    ht_array *cur = __atomic_load_n(&cur_array, __ATOMIC_ACQUIRE);
+    out->grows = __atomic_load_n(&n_grows, __ATOMIC_RELAXED);
+    out->shrinks = __atomic_load_n(&n_shrinks, __ATOMIC_RELAXED);
+    out->buckets_migrated = __atomic_load_n(&n_migrated, __ATOMIC_RELAXED);
+    out->resizing = old != NULL;
+    out->buckets = cur->nbuckets;
+    out->records = __atomic_load_n(&record_count, __ATOMIC_RELAXED) + base_count();
+    epoch_exit();
+}
+
+/* Link a new record for a name known to be absent into head; caller
+   holds the stripe for writing.  0, or -1 if out of memory. */
+static int link_new(ch_node **head, const char *name, size_t len, uint32_t salary, uint64_t key,
+                    uint32_t hash) {
+    ch_node *prev = NULL;
+    ch_node *node = node_alloc(len);
+    if (!node) return -1;
+    if (sidx_add(key, name, len, hash, salary) != 0) {
+        node_free(node);
+        return -1;
+    }
+    node->hash = hash;
+    memcpy(node->name, name, len + 1);
+    node->salary = salary;
+    node->key = key;
+    node->ref = 1;
+
+    find_prev_by_key(head, key, &prev);
+    ch_node **link = prev ? &prev->next : head;
+    node->next = *link;
+    store_link(link, node);
+    __atomic_fetch_add(&record_count, 1, __ATOMIC_RELAXED);
+    wal_append(WAL_INSERT, name, salary);
+    return 0;
+}
+
+/* Link a new record unless the name is taken; caller holds the stripe
+   for writing.  0 inserted, -1 duplicate or out of memory. */
+static int insert_locked(const char *name, uint32_t salary, uint64_t key, uint32_t hash) {
+    ch_node **head = bucket_for_write(key);
+    size_t len = strlen(name);
+    if (!head || find_by_name(head, key, name, len, NULL) || base_contains(key, name)) return -1;
+    return link_new(head, name, len, salary, key, hash);
+}
+
+/* Insert */
+static int chained_insert(const char *name, uint32_t salary, uint64_t key, uint32_t hash, int thread_prio) {
+    pthread_rwlock_t *lock = stripe_of(key);
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    int rc = insert_locked(name, salary, key, hash);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(lock);
+    migrate_step();
+    return rc;
+}
+
+/* Delete: on success, out_deleted filled if non-NULL */
+static int chained_delete(const char *name, uint64_t key, int thread_prio, hashRecord *out_deleted) {
+    pthread_rwlock_t *lock = stripe_of(key);
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    int rc = -1;
+    ch_node **head = bucket_for_write(key);
+    ch_node *prev = NULL;
+    size_t len = strlen(name);
+    ch_node *cur = head ? find_by_name(head, key, name, len, &prev) : NULL;
+    if (cur) {
+        if (out_deleted) copy_record(out_deleted, cur, name);
+        sidx_remove(key, name, len, cur->hash, cur->salary);
+        store_link(prev ? &prev->next : head, cur->next);
+        if (read_mode == HT_READ_LOCKFREE) epoch_retire(cur, node_free);
+        else node_free(cur);
+        __atomic_fetch_sub(&record_count, 1, __ATOMIC_RELAXED);
+        rc = 0;
+    } else if (head) {
+        rc = base_delete(key, name, out_deleted);
+    }
+    if (rc == 0) wal_append(WAL_DELETE, name, 0);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(lock);
+    migrate_step();
+    return rc;
+}
+
+/* Update: the record as it was before the update goes to out_old if non-NULL */
+static int chained_update(const char *name, uint64_t key, const salary_op *op, int thread_prio,
+                          hashRecord *out_old) {
+    pthread_rwlock_t *lock = stripe_of(key);
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    int rc = -1;
+    uint32_t salary = 0;
+    ch_node **head = bucket_for_write(key);
+    size_t len = strlen(name);
+    ch_node *cur = head ? find_by_name(head, key, name, len, NULL) : NULL;
+    if (cur) {
+        if (out_old) copy_record(out_old, cur, name);
+        cache_touch(&cur->ref);
+        rc = salary_apply(op, cur->salary, &salary);
+        if (rc == 0) {
+            sidx_change(key, name, len, cur->hash, cur->salary, salary);
+            __atomic_store_n(&cur->salary, salary, __ATOMIC_RELAXED);
+        }
+    } else if (head) {
+        rc = base_update(key, name, op, out_old, &salary);
+    }
+    if (rc == 0) wal_append(WAL_UPDATE, name, salary);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(lock);
+    migrate_step();
+    return rc;
+}
+
+/* Upsert: set the salary of the record found, else link a new one
+   without looking the name up again */
+static int chained_upsert(const char *name, uint32_t salary, uint64_t key, uint32_t hash, int thread_prio,
+                          hashRecord *out_old) {
+    pthread_rwlock_t *lock = stripe_of(key);
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    int rc = -1;
+    size_t len = strlen(name);
+    salary_op op = { SAL_SET, salary, 0, 0 };
+    ch_node **head = bucket_for_write(key);
+    ch_node *cur = head ? find_by_name(head, key, name, len, NULL) : NULL;
+    if (cur) {
+        if (out_old) copy_record(out_old, cur, name);
+        cache_touch(&cur->ref);
+        sidx_change(key, name, len, cur->hash, cur->salary, salary);
+        __atomic_store_n(&cur->salary, salary, __ATOMIC_RELAXED);
+        rc = 0;
+    } else if (head) {
+        rc = base_update(key, name, &op, out_old, &salary);
+        if (rc != 0) rc = link_new(head, name, len, salary, key, hash) == 0 ? 1 : -1;
+    }
+    if (rc == 0) wal_append(WAL_UPDATE, name, salary);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(lock);
+    migrate_step();
+    return rc;
+}
+
+/* Search into a caller-provided record: 0 found, -1 not found.  No heap
+   allocation on either path.  The lock-free path retries if a resize
+   started or finished while it was looking, since the arrays it loaded may
+   no longer be the ones that hold the key. */
+static int chained_search_into(const char *name, uint64_t key, int thread_prio, hashRecord *out) {
+    size_t len = strlen(name);
+    if (read_mode == HT_READ_LOCKFREE) {
+        int found;
+        unsigned long seq;
+        epoch_enter();
+        do {
+            while ((seq = __atomic_load_n(&resize_seq, __ATOMIC_SEQ_CST)) & 1) sched_yield();
+            ch_node *cur = lookup(__atomic_load_n(&old_array, __ATOMIC_ACQUIRE),
+                                     __atomic_load_n(&cur_array, __ATOMIC_ACQUIRE), key, name, len);
+            found = cur != NULL;
+            if (found) {
+                copy_record(out, cur, name);
+                cache_touch(&cur->ref);
+            } else {
+                found = base_search(key, name, out) == 0;
+            }
+        } while (__atomic_load_n(&resize_seq, __ATOMIC_SEQ_CST) != seq);
+        epoch_exit();
+        return found ? 0 : -1;
+    }
+
+    pthread_rwlock_t *lock = stripe_of(key);
+    log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_rdlock(lock);
+    log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    ch_node *cur = lookup(old_array, cur_array, key, name, len);
+    int rc = 0;
+    if (cur) {
+        copy_record(out, cur, name);
+        cache_touch(&cur->ref);
+    } else {
+        rc = base_search(key, name, out);
+    }
+
+    log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(lock);
+    return rc;
+}
+
+/* Batches (see ht_backend.h).  Sorted keys walk each stripe's buckets in
+   order.  While key k is looked up, the bucket slot HT_PREFETCH_AHEAD keys
+   further on and the chain head of the key half as far ahead are
+   prefetched. */
+
+/* end of the run of keys from start that share its stripe */
+static size_t stripe_group_end(const batch_key *keys, size_t start, size_t n) {
+    pthread_rwlock_t *lock = stripe_of(keys[start].key);
+    size_t end = start + 1;
+    while (end < n && stripe_of(keys[end].key) == lock) end++;
+    return end;
+}
+
+/* Stage one only computes a slot address, so it may run ahead into the
+   next stripes' keys; stage two reads a slot and stays in the locked
+   stripe.  Holding any stripe keeps both arrays from being swapped. */
+static inline void prefetch_ahead(ht_array *old, ht_array *cur, const batch_key *keys,
+                                  size_t k, size_t group_end, size_t n) {
+    if (k + HT_PREFETCH_AHEAD < n)
+        __builtin_prefetch(&cur->buckets[top_bits(keys[k + HT_PREFETCH_AHEAD].key, cur->bits)]);
+    if (k + HT_PREFETCH_AHEAD / 2 < group_end) {
+        ch_node *h = load_link(read_head(old, cur, keys[k + HT_PREFETCH_AHEAD / 2].key));
+        if (h) __builtin_prefetch(h);
+    }
+}
+
+/* look up keys [start, end) of one stripe; returns the number found */
+static size_t search_group(ht_array *old, ht_array *cur, const char *const *names, const batch_key *keys,
+                           size_t start, size_t end, size_t n, hashRecord *out, int *found) {
+    size_t hits = 0;
+    for (size_t k = start; k < end; ++k) {
+        prefetch_ahead(old, cur, keys, k, end, n);
+        uint32_t i = keys[k].idx;
+        ch_node *n = lookup(old, cur, keys[k].key, names[i], strlen(names[i]));
+        if (n) {
+            copy_record(&out[i], n, names[i]);
+            cache_touch(&n->ref);
+        }
+        found[i] = n ? 0 : base_search(keys[k].key, names[i], &out[i]);
+        if (found[i] == 0) hits++;
+    }
+    return hits;
+}
+
+static int chained_search_batch(const char *const *names, const uint64_t *keyv, size_t n,
+                                int thread_prio, hashRecord *out, int *found) {
+    batch_key *keys = ht_batch_sort(keyv, n);
+    size_t hits = 0;
+    if (!keys) {
+        /* no room to sort: fall back to one lookup per key */
+        for (size_t i = 0; i < n; ++i) {
+            found[i] = chained_search_into(names[i], keyv[i], thread_prio, &out[i]);
+            if (found[i] == 0) hits++;
+        }
+        return (int)hits;
+    }
+
+    if (read_mode == HT_READ_LOCKFREE) {
+        epoch_enter();
+        for (size_t s = 0; s < n; ) {
+            size_t e = stripe_group_end(keys, s, n), got;
+            unsigned long seq;
+            do {
+                while ((seq = __atomic_load_n(&resize_seq, __ATOMIC_SEQ_CST)) & 1) sched_yield();
+                got = search_group(__atomic_load_n(&old_array, __ATOMIC_ACQUIRE),
+                                   __atomic_load_n(&cur_array, __ATOMIC_ACQUIRE), names, keys, s, e, n,
+                                   out, found);
+            } while (__atomic_load_n(&resize_seq, __ATOMIC_SEQ_CST) != seq);
+            hits += got;
+            s = e;
+        }
+        epoch_exit();
+        free(keys);
+        return (int)hits;
+    }
+
+    for (size_t s = 0; s < n; ) {
+        size_t e = stripe_group_end(keys, s, n);
+        pthread_rwlock_t *lock = stripe_of(keys[s].key);
+        log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(keys[s].key), NULL, 0);
+        stripe_rdlock(lock);
+        log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(keys[s].key), NULL, 0);
+
+        hits += search_group(old_array, cur_array, names, keys, s, e, n, out, found);
+
+        log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(keys[s].key), NULL, 0);
+        stripe_unlock(lock);
+        s = e;
+    }
+    free(keys);
+    return (int)hits;
+}
+
+static int chained_insert_batch(const char *const *names, const uint32_t *salaries, const uint64_t *keyv,
+                                const uint32_t *hashes, size_t n, int thread_prio, int *results) {
+    batch_key *keys = ht_batch_sort(keyv, n);
+    size_t inserted = 0;
+    if (!keys) {
+        for (size_t i = 0; i < n; ++i) {
+            results[i] = chained_insert(names[i], salaries[i], keyv[i], hashes[i], thread_prio);
+            if (results[i] == 0) inserted++;
+        }
+        return (int)inserted;
+    }
+
+    for (size_t s = 0; s < n; ) {
+        size_t e = stripe_group_end(keys, s, n);
+        pthread_rwlock_t *lock = stripe_of(keys[s].key);
+        log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(keys[s].key), NULL, 0);
+        stripe_wrlock(lock);
+        log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(keys[s].key), NULL, 0);
+
+        for (size_t k = s; k < e; ++k) {
+            prefetch_ahead(old_array, cur_array, keys, k, e, n);
+            uint32_t i = keys[k].idx;
+            results[i] = insert_locked(names[i], salaries[i], keyv[i], hashes[i]);
+            if (results[i] == 0) inserted++;
+        }
+
+        log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(keys[s].key), NULL, 0);
+        stripe_unlock(lock);
+        /* one migration step per write, as for single inserts */
+        for (size_t k = s; k < e; ++k) migrate_step();
+        s = e;
+    }
+    free(keys);
+    return (int)inserted;
+}
+
+/* Mid-resize, the key space is walked at the finer of the two array
+   granularities; each slice comes from its old bucket if that has not
+   moved yet and from the new array otherwise, so nothing is copied twice. */
+static unsigned slice_bits(const ht_array *old, const ht_array *cur) {
+    return old && old->bits > cur->bits ? old->bits : cur->bits;
+}
+
+/* appends the records of slice f with keys >= from to b; 0 or -1 */
+static int copy_slice(ht_array *old, ht_array *cur, unsigned fine, size_t f, uint64_t from,
+                      ht_recbuf *b) {
+    ch_node **head;
+    if (old && !bucket_moved(old, f >> (fine - old->bits)))
+        head = &old->buckets[f >> (fine - old->bits)];
+    else
+        head = &cur->buckets[f >> (fine - cur->bits)];
+    for (ch_node *r = load_link(head); r; r = load_link(&r->next)) {
+        size_t slice = top_bits(r->key, fine);
+        if (slice < f || r->key < from) continue;
+        if (slice > f) break;
+        hashRecord *dst = recbuf_push(b, r->name, r->len);
+        if (!dst) return -1;
+        copy_record(dst, r, dst->name);
+    }
+    return 0;
+}
+
+/* Append every record to b; 0 or -1 */
+static int gather(ht_array *old, ht_array *cur, ht_recbuf *b) {
+    unsigned fine = slice_bits(old, cur);
+    int rc = 0;
+    for (size_t f = 0; rc == 0 && f < ((size_t)1 << fine); ++f) rc = copy_slice(old, cur, fine, f, 0, b);
+    if (rc == 0) rc = base_collect_range(0, UINT64_MAX, b);
+    return rc;
+}
+
+/* All stripes are read-locked (in index order, so two collectors can't
+   deadlock) to make the copy a consistent snapshot.  The lock-free
+   variant only pins an epoch, so it never blocks writers but may observe
+   a concurrent update mid-copy. */
+static int chained_collect(int thread_prio, ht_recbuf *b) {
+    if (read_mode == HT_READ_LOCKFREE) {
+        epoch_enter();
+        int rc = gather(__atomic_load_n(&old_array, __ATOMIC_ACQUIRE),
+                        __atomic_load_n(&cur_array, __ATOMIC_ACQUIRE), b);
+        epoch_exit();
+        return rc;
+    }
+
+    log_event(EV_READ_LOCK_ATTEMPT, thread_prio, 0, NULL, 0);
+    STATS_TIME(t0);
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) pthread_rwlock_rdlock(&stripes[i].lock);
+    STATS_LAP(ST_STRIPE_WAIT, t0, ht_stripe_held);
+    log_event(EV_READ_LOCK_ACQUIRED, thread_prio, 0, NULL, 0);
+
+    int rc = gather(old_array, cur_array, b);
+
+    log_event(EV_READ_LOCK_RELEASED, thread_prio, 0, NULL, 0);
+    STATS_SINCE(ST_STRIPE_HOLD, ht_stripe_held);
+    for (int i = HT_NUM_STRIPES - 1; i >= 0; --i) pthread_rwlock_unlock(&stripes[i].lock);
+    return rc;
+}
+
+/* Slices are copied in order from the one holding *from to the end of its
+   stripe, or until b holds want records.  Holding the stripe also keeps
+   a resize from starting or finishing, so the arrays stay put; between
+   calls they may change, which *from, a key rather than a bucket index,
+   survives. */
+static int chained_scan(uint64_t *from, int *done, size_t want, ht_recbuf *b) {
+    uint64_t key = *from;
+    pthread_rwlock_t *lock = stripe_of(key);
+    ht_array *old, *cur;
+    if (read_mode == HT_READ_LOCKFREE) {
+        epoch_enter();
+        old = __atomic_load_n(&old_array, __ATOMIC_ACQUIRE);
+        cur = __atomic_load_n(&cur_array, __ATOMIC_ACQUIRE);
+    } else {
+        stripe_rdlock(lock);
+        old = old_array;
+        cur = cur_array;
+    }
+
+    unsigned fine = slice_bits(old, cur);
+    size_t f = top_bits(key, fine);
+    size_t end = (top_bits(key, stripe_bits) + 1) << (fine - stripe_bits);
+    int rc;
+    do {
+        rc = copy_slice(old, cur, fine, f++, key, b);
+    } while (rc == 0 && f < end && b->n < want);
+    /* the last key of the slices copied */
+    uint64_t last = f == ((size_t)1 << fine) ? UINT64_MAX : ((uint64_t)f << (64 - fine)) - 1;
+    if (rc == 0) rc = base_collect_range(key, last, b);
+
+    if (read_mode == HT_READ_LOCKFREE) {
+        epoch_exit();
+    } else {
+        stripe_unlock(lock);
+    }
+    if (rc != 0) return -1;
+    if (last == UINT64_MAX) *done = 1;
+    else *from = last + 1;
+    return 0;
+}
+
+/* The hand is a key, so it survives resizes as scan's position does.  It
+   walks the stripe's slices from the one holding it, wrapping round at
+   the stripe's end; in the slice it starts in, it skips the keys before
+   it. */
+static int chained_clock_next(size_t stripe, int thread_prio, char *name) {
+    uint64_t first_key = stripe_bits == 0 ? 0 : (uint64_t)stripe << (64 - stripe_bits);
+    pthread_rwlock_t *lock = &stripes[stripe].lock;
+    ht_array *old, *cur;
+    if (read_mode == HT_READ_LOCKFREE) {
+        epoch_enter();
+        old = __atomic_load_n(&old_array, __ATOMIC_ACQUIRE);
+        cur = __atomic_load_n(&cur_array, __ATOMIC_ACQUIRE);
+    } else {
+        log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(first_key), NULL, 0);
+        stripe_rdlock(lock);
+        log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(first_key), NULL, 0);
+        old = old_array;
+        cur = cur_array;
+    }
+
+    uint64_t hand = __atomic_load_n(&clock_hand[stripe], __ATOMIC_RELAXED);
+    if (top_bits(hand, stripe_bits) != stripe) hand = first_key;
+    unsigned fine = slice_bits(old, cur);
+    size_t per = (size_t)1 << (fine - stripe_bits);
+    size_t base_slice = stripe << (fine - stripe_bits), start = top_bits(hand, fine) - base_slice;
+    int rc = -1;
+    for (size_t step = 0; rc != 0 && step <= 2 * per; ++step) {
+        size_t f = base_slice + (start + step) % per;
+        ch_node **head;
+        if (old && !bucket_moved(old, f >> (fine - old->bits)))
+            head = &old->buckets[f >> (fine - old->bits)];
+        else
+            head = &cur->buckets[f >> (fine - cur->bits)];
+        for (ch_node *r = load_link(head); r; r = load_link(&r->next)) {
+            size_t slice = top_bits(r->key, fine);
+            if (slice < f || (step == 0 && r->key < hand)) continue;
+            if (slice > f) break;
+            if (cache_clear_ref(&r->ref)) continue;
+            memcpy(name, r->name, (size_t)r->len + 1);
+            hand = r->key + 1;
+            rc = 0;
+            break;
+        }
+    }
+    __atomic_store_n(&clock_hand[stripe], hand, __ATOMIC_RELAXED);
+
+    if (read_mode == HT_READ_LOCKFREE) {
+        epoch_exit();
+    } else {
+        log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(first_key), NULL, 0);
+        stripe_unlock(lock);
+    }
+    return rc;
+}
+
+const ht_ops ht_chain_ops = {
+    .init = chained_init,
+    .destroy = chained_destroy,
+    .insert = chained_insert,
+    .delete_key = chained_delete,
+    .update = chained_update,
+    .upsert = chained_upsert,
+    .search_into = chained_search_into,
+    .collect = chained_collect,
+    .scan = chained_scan,
+    .search_batch = chained_search_batch,
+    .insert_batch = chained_insert_batch,
+    .resize_stats = chained_resize_stats,
+    .clock_next = chained_clock_next,
+};
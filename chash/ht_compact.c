@@ -0,0 +1,695 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hash_table.h"
+#include "ht_backend.h"
+#include "chash.h"
+#include "snapshot.h"
+#include "salary_index.h"
+#include "logger.h"
+#include "stats.h"
+#include "wal.h"
+
+/* The compact backend: open addressing as in ht_swiss.c (same shards,
+   control bytes, tags and probe order), but with the slots split into
+   parallel arrays so that a probe reads only dense data.
+
+   A shard keeps
+     ctrl   one control byte per slot: EMPTY, DELETED or the key's 7-bit tag
+     fps    the low word of each slot's key, sixteen to a cache line
+     pay    per slot the Jenkins hash, the salary and where the name is
+     refs   per slot the CLOCK reference byte (cache.h)
+     names  an arena of length-prefixed names: two bytes of length, then
+            the bytes, with no terminator and no padding
+   A lookup compares a group's sixteen tags at once, then the fingerprints
+   of the slots that matched, which share one line of fps, and reads a
+   payload and a name only on a fingerprint match, which is almost always
+   the record.  A record costs 18 bytes of slot arrays (plus the free
+   slots the load factor keeps) and its name plus two bytes, instead of a
+   64-byte slot or a chain node.
+
+   A deleted record's name stays in the arena as garbage.  Rehashing a
+   shard rewrites its arena without the garbage, and a delete rehashes in
+   place once garbage is most of the arena: an arena of CP_MIN_ARENA
+   bytes at least, except in cache mode, where evictions must free the
+   memory they are run for. */
+
+#if (HT_NUM_STRIPES & (HT_NUM_STRIPES - 1)) != 0 || HT_NUM_STRIPES < 1
+#error "HT_NUM_STRIPES must be a power of two"
+#endif
+
+#define CP_GROUP 16                     /* slots per control group */
+#define CP_EMPTY 0x80
+#define CP_DELETED 0xFE
+#define CP_MAX_LOAD_PCT 87              /* full + deleted slots before a rehash */
+#define CP_SHRINK_LOAD_PCT 12           /* full slots before halving */
+#define CP_MIN_ARENA 4096               /* first arena, and garbage worth collecting */
+#define CP_LEN_BYTES 2                  /* length prefix of a name */
+
+/* smallest shard, HT_NUM_BUCKETS slots over the whole table */
+#define CP_MIN_GROUPS (HT_NUM_BUCKETS / HT_NUM_STRIPES / CP_GROUP > 0 ? \
+                       HT_NUM_BUCKETS / HT_NUM_STRIPES / CP_GROUP : 1)
+
+typedef struct {
+    uint32_t hash;              /* Jenkins, for display */
+    uint32_t salary;
+    uint32_t name;              /* offset of the name's entry in the arena */
+} cp_payload;
+
+typedef struct {
+    uint8_t *ctrl;              /* 16-byte aligned */
+    uint32_t *fps;
+    cp_payload *pay;
+    uint8_t *refs;
+    char *names;
+    size_t names_used, names_cap;
+    size_t names_dead;          /* bytes of deleted records' names */
+    size_t ngroups;             /* power of two */
+    size_t count;               /* full slots */
+    size_t deleted;             /* tombstones */
+    size_t hand;                /* slot the CLOCK hand stands at */
+} __attribute__((aligned(64))) cp_shard;
+
+static ht_stripe stripes[HT_NUM_STRIPES];
+static cp_shard shards[HT_NUM_STRIPES];
+static unsigned stripe_bits;
+
+/* resize counters, updated under different stripes */
+static unsigned long n_grows;
+static unsigned long n_shrinks;
+static unsigned long n_moved;
+
+static unsigned log2_u32(uint32_t v) {
+    unsigned r = 0;
+    while (v >>= 1) r++;
+    return r;
+}
+
+static inline size_t shard_index(uint64_t key) {
+    return stripe_bits == 0 ? 0 : (size_t)(key >> (64 - stripe_bits));
+}
+
+/* as in ht_swiss.c: the top bits pick the shard, the low word is the
+   fingerprint and picks the first group, the tag takes seven bits between */
+static inline uint32_t fp_of(uint64_t key) {
+    return (uint32_t)key;
+}
+static inline uint8_t tag_of(uint64_t key) {
+    return (uint8_t)((key >> 32) & 0x7F);
+}
+
+#ifdef __SSE2__
+/* bit i set where control byte i equals b */
+static inline unsigned group_match(const uint8_t *ctrl, uint8_t b) {
+    __m128i g = _mm_load_si128((const __m128i *)ctrl);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+}
+/* bit i set where slot i is EMPTY or DELETED (the only bytes with the top bit) */
+static inline unsigned group_free(const uint8_t *ctrl) {
+    return (unsigned)_mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+}
+#else
+static inline unsigned group_match(const uint8_t *ctrl, uint8_t b) {
+    unsigned m = 0;
+    for (int i = 0; i < CP_GROUP; ++i) m |= (unsigned)(ctrl[i] == b) << i;
+    return m;
+}
+static inline unsigned group_free(const uint8_t *ctrl) {
+    unsigned m = 0;
+    for (int i = 0; i < CP_GROUP; ++i) m |= (unsigned)(ctrl[i] >> 7) << i;
+    return m;
+}
+#endif
+
+/* length and bytes of the name of full slot i */
+static inline size_t name_len(const cp_shard *s, size_t i) {
+    uint16_t len;
+    memcpy(&len, s->names + s->pay[i].name, sizeof(len));
+    return len;
+}
+static inline const char *name_at(const cp_shard *s, size_t i) {
+    return s->names + s->pay[i].name + CP_LEN_BYTES;
+}
+
+/* slot index holding name (len bytes), or -1 */
+static long find_slot(const cp_shard *s, uint64_t key, const char *name, size_t len) {
+    uint8_t tag = tag_of(key);
+    uint32_t fp = fp_of(key);
+    size_t mask = s->ngroups - 1, g = fp & mask;
+    uint64_t probed = 0;
+    for (size_t step = 1; step <= s->ngroups; ++step) {
+        const uint8_t *ctrl = s->ctrl + g * CP_GROUP;
+        probed++;
+        for (unsigned m = group_match(ctrl, tag); m; m &= m - 1) {
+            size_t i = g * CP_GROUP + (size_t)__builtin_ctz(m);
+            if (s->fps[i] == fp && name_eq(name_at(s, i), name_len(s, i), name, len)) {
+                STATS_VALUE(ST_CHAIN_WALK, probed);
+                return (long)i;
+            }
+        }
+        if (group_match(ctrl, CP_EMPTY)) break;
+        g = (g + step) & mask;
+    }
+    STATS_VALUE(ST_CHAIN_WALK, probed);
+    return -1;
+}
+
+/* first EMPTY or DELETED slot on fp's probe sequence; the load limit
+   guarantees there is one */
+static size_t find_free(const cp_shard *s, uint32_t fp) {
+    size_t mask = s->ngroups - 1, g = fp & mask;
+    for (size_t step = 1; ; ++step) {
+        unsigned m = group_free(s->ctrl + g * CP_GROUP);
+        if (m) return g * CP_GROUP + (size_t)__builtin_ctz(m);
+        g = (g + step) & mask;
+    }
+}
+
+/* Appends a name entry to the arena; returns its offset, or -1 if out of
+   memory or past what a 32-bit offset reaches. */
+static long name_append(cp_shard *s, const char *name, size_t len) {
+    size_t need = s->names_used + CP_LEN_BYTES + len;
+    if (need > UINT32_MAX) return -1;
+    if (need > s->names_cap) {
+        size_t cap = s->names_cap ? s->names_cap : CP_MIN_ARENA;
+        while (cap < need) cap *= 2;
+        char *grown = realloc(s->names, cap);
+        if (!grown) return -1;
+        cache_charge((int64_t)cap - (int64_t)s->names_cap);
+        s->names = grown;
+        s->names_cap = cap;
+    }
+    uint16_t len16 = (uint16_t)len;
+    size_t off = s->names_used;
+    memcpy(s->names + off, &len16, sizeof(len16));
+    memcpy(s->names + off + CP_LEN_BYTES, name, len);
+    s->names_used = need;
+    return (long)off;
+}
+
+/* bytes of the slot arrays of a shard of ngroups groups */
+static size_t slots_bytes(size_t ngroups) {
+    size_t nslots = ngroups * CP_GROUP;
+    return (nslots < 64 ? 64 : nslots) + (nslots * sizeof(uint32_t) < 64 ? 64 : nslots * sizeof(uint32_t)) +
+           nslots * (sizeof(cp_payload) + 1);
+}
+
+/* Empty slot arrays of ngroups groups; the arena is left alone. */
+static int shard_alloc(cp_shard *s, size_t ngroups) {
+    size_t nslots = ngroups * CP_GROUP;
+    s->ctrl = aligned_alloc(64, nslots < 64 ? 64 : nslots);
+    s->fps = aligned_alloc(64, nslots * sizeof(uint32_t) < 64 ? 64 : nslots * sizeof(uint32_t));
+    s->pay = malloc(nslots * sizeof(cp_payload));
+    s->refs = malloc(nslots);
+    if (!s->ctrl || !s->fps || !s->pay || !s->refs) {
+        free(s->ctrl);
+        free(s->fps);
+        free(s->pay);
+        free(s->refs);
+        s->ctrl = NULL;
+        s->fps = NULL;
+        s->pay = NULL;
+        s->refs = NULL;
+        return -1;
+    }
+    memset(s->ctrl, CP_EMPTY, nslots);
+    s->ngroups = ngroups;
+    s->count = s->deleted = 0;
+    cache_charge((int64_t)slots_bytes(ngroups));
+    return 0;
+}
+
+static void shard_free(cp_shard *s) {
+    if (s->ctrl) cache_charge(-(int64_t)slots_bytes(s->ngroups));
+    cache_charge(-(int64_t)s->names_cap);
+    free(s->ctrl);
+    free(s->fps);
+    free(s->pay);
+    free(s->refs);
+    free(s->names);
+    memset(s, 0, sizeof(*s));
+}
+
+/* Move every record into fresh slot arrays of ngroups groups and a fresh
+   arena, dropping tombstones and garbage; caller holds the stripe for
+   writing.  On allocation failure the shard is left as it was. */
+static int rehash(cp_shard *s, size_t ngroups) {
+    cp_shard old = *s;
+    size_t live = old.names_used - old.names_dead;
+    s->names = NULL;
+    s->names_used = s->names_dead = 0;
+    s->names_cap = 0;
+    if (live > 0 && !(s->names = malloc(live))) {
+        *s = old;
+        return -1;
+    }
+    s->names_cap = live;
+    if (shard_alloc(s, ngroups) != 0) {
+        free(s->names);
+        *s = old;
+        return -1;
+    }
+    size_t nslots = old.ngroups * CP_GROUP;
+    for (size_t i = 0; i < nslots; ++i) {
+        if (old.ctrl[i] & 0x80) continue;
+        size_t j = find_free(s, old.fps[i]);
+        s->ctrl[j] = old.ctrl[i];
+        s->fps[j] = old.fps[i];
+        s->pay[j] = old.pay[i];
+        s->refs[j] = old.refs[i];
+        /* fits: the new arena holds exactly the live names */
+        s->pay[j].name = (uint32_t)name_append(s, name_at(&old, i), name_len(&old, i));
+        s->count++;
+    }
+    if (ngroups > old.ngroups) __atomic_fetch_add(&n_grows, 1, __ATOMIC_RELAXED);
+    else if (ngroups < old.ngroups) __atomic_fetch_add(&n_shrinks, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&n_moved, nslots, __ATOMIC_RELAXED);
+    if (ngroups != old.ngroups) {
+        log_event(EV_RESIZE_START, -1, (uint32_t)nslots, NULL, (uint32_t)(ngroups * CP_GROUP));
+        log_event(EV_RESIZE_DONE, -1, 0, NULL, (uint32_t)(ngroups * CP_GROUP));
+    }
+    cache_charge((int64_t)s->names_cap - (int64_t)old.names_cap - (int64_t)slots_bytes(old.ngroups));
+    free(old.ctrl);
+    free(old.fps);
+    free(old.pay);
+    free(old.refs);
+    free(old.names);
+    return 0;
+}
+
+/* stores a record for a name known to be absent; 0 or -1 if out of memory */
+static int shard_put(cp_shard *s, const char *name, size_t len, uint32_t salary, uint64_t key,
+                     uint32_t hash) {
+    size_t nslots = s->ngroups * CP_GROUP;
+    if ((s->count + s->deleted + 1) * 100 > nslots * CP_MAX_LOAD_PCT) {
+        /* mostly tombstones: clean up in place instead of growing */
+        size_t groups = (s->count + 1) * 100 > nslots * CP_MAX_LOAD_PCT / 2 ? s->ngroups * 2 : s->ngroups;
+        if (rehash(s, groups) != 0) return -1;
+    }
+    if (sidx_add(key, name, len, hash, salary) != 0) return -1;
+    long off = name_append(s, name, len);
+    if (off < 0) {
+        sidx_remove(key, name, len, hash, salary);
+        return -1;
+    }
+    size_t i = find_free(s, fp_of(key));
+    if (s->ctrl[i] == CP_DELETED) s->deleted--;
+    s->ctrl[i] = tag_of(key);
+    s->fps[i] = fp_of(key);
+    s->pay[i].hash = hash;
+    s->pay[i].salary = salary;
+    s->pay[i].name = (uint32_t)off;
+    s->refs[i] = 1;
+    s->count++;
+    wal_append(WAL_INSERT, name, salary);
+    return 0;
+}
+
+/* caller holds the stripe for writing; 0 inserted, -1 duplicate or out of memory */
+static int shard_insert(cp_shard *s, const char *name, uint32_t salary, uint64_t key, uint32_t hash) {
+    size_t len = strlen(name);
+    if (find_slot(s, key, name, len) >= 0 || base_contains(key, name)) return -1;
+    return shard_put(s, name, len, salary, key, hash);
+}
+
+/* the caller knows the full key, since the slot only has its low word,
+   and gives the copy its name */
+static void copy_out(hashRecord *dst, const cp_shard *s, size_t i, uint64_t key, const char *name) {
+    dst->hash = s->pay[i].hash;
+    dst->salary = s->pay[i].salary;
+    dst->key = key;
+    dst->name = name;
+}
+
+/* appends the record in full slot i to b if its key is >= from; 0 or -1
+   if out of memory */
+static int push_slot(ht_recbuf *b, const cp_shard *s, size_t i, uint64_t from) {
+    const char *name = name_at(s, i);
+    size_t len = name_len(s, i);
+    uint64_t key = key_hash_len(name, len);
+    if (key < from) return 0;
+    hashRecord *dst = recbuf_push(b, name, len);
+    if (!dst) return -1;
+    copy_out(dst, s, i, key, dst->name);
+    return 0;
+}
+
+static void compact_init(ht_read_mode mode) {
+    (void)mode;
+    stripe_bits = log2_u32(HT_NUM_STRIPES);
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) {
+        pthread_rwlock_init(&stripes[i].lock, NULL);
+        if (shard_alloc(&shards[i], CP_MIN_GROUPS) != 0) {
+            perror("ht_init");
+            exit(1);
+        }
+    }
+    n_grows = n_shrinks = n_moved = 0;
+}
+
+static void compact_destroy(void) {
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) {
+        shard_free(&shards[i]);
+        pthread_rwlock_destroy(&stripes[i].lock);
+    }
+}
+
+static int compact_insert(const char *name, uint32_t salary, uint64_t key, uint32_t hash, int thread_prio) {
+    size_t k = shard_index(key);
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(&stripes[k].lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    int rc = shard_insert(&shards[k], name, salary, key, hash);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+static int compact_delete(const char *name, uint64_t key, int thread_prio, hashRecord *out_deleted) {
+    size_t k = shard_index(key);
+    cp_shard *s = &shards[k];
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(&stripes[k].lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    long i = find_slot(s, key, name, strlen(name));
+    int rc = 0;
+    if (i >= 0) {
+        if (out_deleted) copy_out(out_deleted, s, (size_t)i, key, name);
+        sidx_remove(key, name, name_len(s, (size_t)i), s->pay[i].hash, s->pay[i].salary);
+        s->names_dead += CP_LEN_BYTES + name_len(s, (size_t)i);
+        /* a group with an EMPTY slot already ends every probe through it,
+           so the slot can go back to EMPTY instead of a tombstone */
+        if (group_match(s->ctrl + (size_t)i / CP_GROUP * CP_GROUP, CP_EMPTY)) {
+            s->ctrl[i] = CP_EMPTY;
+        } else {
+            s->ctrl[i] = CP_DELETED;
+            s->deleted++;
+        }
+        s->count--;
+        if (s->ngroups > CP_MIN_GROUPS && s->count * 100 < s->ngroups * CP_GROUP * CP_SHRINK_LOAD_PCT)
+            rehash(s, s->ngroups / 2);
+        else if ((s->names_dead > CP_MIN_ARENA || cache_capped) && s->names_dead * 2 > s->names_used)
+            rehash(s, s->ngroups);
+    } else {
+        rc = base_delete(key, name, out_deleted);
+    }
+    if (rc == 0) wal_append(WAL_DELETE, name, 0);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+static int compact_update(const char *name, uint64_t key, const salary_op *op, int thread_prio,
+                          hashRecord *out_old) {
+    size_t k = shard_index(key);
+    cp_shard *s = &shards[k];
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(&stripes[k].lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    size_t len = strlen(name);
+    long i = find_slot(s, key, name, len);
+    uint32_t salary = 0;
+    int rc;
+    if (i >= 0) {
+        if (out_old) copy_out(out_old, s, (size_t)i, key, name);
+        cache_touch(&s->refs[i]);
+        rc = salary_apply(op, s->pay[i].salary, &salary);
+        if (rc == 0) {
+            sidx_change(key, name, len, s->pay[i].hash, s->pay[i].salary, salary);
+            s->pay[i].salary = salary;
+        }
+    } else {
+        rc = base_update(key, name, op, out_old, &salary);
+    }
+    if (rc == 0) wal_append(WAL_UPDATE, name, salary);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+/* a miss goes straight to shard_put: the name is known to be absent, so
+   it is not looked up again */
+static int compact_upsert(const char *name, uint32_t salary, uint64_t key, uint32_t hash, int thread_prio,
+                          hashRecord *out_old) {
+    size_t k = shard_index(key);
+    cp_shard *s = &shards[k];
+    salary_op op = { SAL_SET, salary, 0, 0 };
+    size_t len = strlen(name);
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(&stripes[k].lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    long i = find_slot(s, key, name, len);
+    int rc = 0;
+    if (i >= 0) {
+        if (out_old) copy_out(out_old, s, (size_t)i, key, name);
+        cache_touch(&s->refs[i]);
+        sidx_change(key, name, len, s->pay[i].hash, s->pay[i].salary, salary);
+        s->pay[i].salary = salary;
+    } else if (base_update(key, name, &op, out_old, &salary) != 0) {
+        rc = shard_put(s, name, len, salary, key, hash) == 0 ? 1 : -1;
+    }
+    if (rc == 0) wal_append(WAL_UPDATE, name, salary);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+static int compact_search_into(const char *name, uint64_t key, int thread_prio, hashRecord *out) {
+    size_t k = shard_index(key);
+    cp_shard *s = &shards[k];
+    log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_rdlock(&stripes[k].lock);
+    log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    long i = find_slot(s, key, name, strlen(name));
+    int rc = 0;
+    if (i >= 0) {
+        copy_out(out, s, (size_t)i, key, name);
+        cache_touch(&s->refs[i]);
+    } else {
+        rc = base_search(key, name, out);
+    }
+
+    log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+/* Batches (see ht_backend.h): while key k is looked up, the first control
+   group of the key HT_PREFETCH_AHEAD further on is prefetched, and the
+   fingerprints of the first tag match of the key half as far ahead.  Only
+   keys of the locked shard are prefetched, since another shard may be
+   rehashed under us. */
+static inline void prefetch_ahead(const cp_shard *s, const batch_key *keys, size_t k, size_t group_end) {
+    size_t mask = s->ngroups - 1;
+    if (k + HT_PREFETCH_AHEAD < group_end)
+        __builtin_prefetch(s->ctrl + (fp_of(keys[k + HT_PREFETCH_AHEAD].key) & mask) * CP_GROUP);
+    if (k + HT_PREFETCH_AHEAD / 2 < group_end) {
+        uint64_t key = keys[k + HT_PREFETCH_AHEAD / 2].key;
+        size_t g = fp_of(key) & mask;
+        unsigned m = group_match(s->ctrl + g * CP_GROUP, tag_of(key));
+        if (m) __builtin_prefetch(&s->fps[g * CP_GROUP + (size_t)__builtin_ctz(m)]);
+    }
+}
+
+/* end of the run of keys from start that share its shard */
+static size_t shard_group_end(const batch_key *keys, size_t start, size_t n) {
+    size_t k = shard_index(keys[start].key);
+    size_t end = start + 1;
+    while (end < n && shard_index(keys[end].key) == k) end++;
+    return end;
+}
+
+static int compact_search_batch(const char *const *names, const uint64_t *keyv, size_t n,
+                                int thread_prio, hashRecord *out, int *found) {
+    batch_key *keys = ht_batch_sort(keyv, n);
+    size_t hits = 0;
+    if (!keys) {
+        for (size_t i = 0; i < n; ++i) {
+            found[i] = compact_search_into(names[i], keyv[i], thread_prio, &out[i]);
+            if (found[i] == 0) hits++;
+        }
+        return (int)hits;
+    }
+
+    for (size_t b = 0; b < n; ) {
+        size_t e = shard_group_end(keys, b, n);
+        size_t k = shard_index(keys[b].key);
+        cp_shard *s = &shards[k];
+        log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(keys[b].key), NULL, 0);
+        stripe_rdlock(&stripes[k].lock);
+        log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(keys[b].key), NULL, 0);
+
+        for (size_t j = b; j < e; ++j) {
+            prefetch_ahead(s, keys, j, e);
+            uint32_t x = keys[j].idx;
+            long i = find_slot(s, keys[j].key, names[x], strlen(names[x]));
+            if (i >= 0) {
+                copy_out(&out[x], s, (size_t)i, keys[j].key, names[x]);
+                cache_touch(&s->refs[i]);
+            }
+            found[x] = i >= 0 ? 0 : base_search(keys[j].key, names[x], &out[x]);
+            if (found[x] == 0) hits++;
+        }
+
+        log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(keys[b].key), NULL, 0);
+        stripe_unlock(&stripes[k].lock);
+        b = e;
+    }
+    free(keys);
+    return (int)hits;
+}
+
+static int compact_insert_batch(const char *const *names, const uint32_t *salaries, const uint64_t *keyv,
+                                const uint32_t *hashes, size_t n, int thread_prio, int *results) {
+    batch_key *keys = ht_batch_sort(keyv, n);
+    size_t inserted = 0;
+    if (!keys) {
+        for (size_t i = 0; i < n; ++i) {
+            results[i] = compact_insert(names[i], salaries[i], keyv[i], hashes[i], thread_prio);
+            if (results[i] == 0) inserted++;
+        }
+        return (int)inserted;
+    }
+
+    for (size_t b = 0; b < n; ) {
+        size_t e = shard_group_end(keys, b, n);
+        size_t k = shard_index(keys[b].key);
+        cp_shard *s = &shards[k];
+        log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(keys[b].key), NULL, 0);
+        stripe_wrlock(&stripes[k].lock);
+        log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(keys[b].key), NULL, 0);
+
+        for (size_t j = b; j < e; ++j) {
+            prefetch_ahead(s, keys, j, e);
+            uint32_t i = keys[j].idx;
+            results[i] = shard_insert(s, names[i], salaries[i], keyv[i], hashes[i]);
+            if (results[i] == 0) inserted++;
+        }
+
+        log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(keys[b].key), NULL, 0);
+        stripe_unlock(&stripes[k].lock);
+        b = e;
+    }
+    free(keys);
+    return (int)inserted;
+}
+
+/* As in ht_swiss.c, every stripe is read-locked (in index order) while
+   the full slots are copied, and the copies get their keys from their
+   names. */
+static int compact_collect(int thread_prio, ht_recbuf *b) {
+    log_event(EV_READ_LOCK_ATTEMPT, thread_prio, 0, NULL, 0);
+    STATS_TIME(t0);
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) pthread_rwlock_rdlock(&stripes[i].lock);
+    STATS_LAP(ST_STRIPE_WAIT, t0, ht_stripe_held);
+    log_event(EV_READ_LOCK_ACQUIRED, thread_prio, 0, NULL, 0);
+
+    int rc = 0;
+    for (int k = 0; rc == 0 && k < HT_NUM_STRIPES; ++k) {
+        const cp_shard *s = &shards[k];
+        for (size_t i = 0; rc == 0 && i < s->ngroups * CP_GROUP; ++i)
+            if (!(s->ctrl[i] & 0x80)) rc = push_slot(b, s, i, 0);
+    }
+    if (rc == 0) rc = base_collect_range(0, UINT64_MAX, b);
+
+    log_event(EV_READ_LOCK_RELEASED, thread_prio, 0, NULL, 0);
+    STATS_SINCE(ST_STRIPE_HOLD, ht_stripe_held);
+    for (int i = HT_NUM_STRIPES - 1; i >= 0; --i) pthread_rwlock_unlock(&stripes[i].lock);
+    return rc;
+}
+
+/* a scan copies one whole shard, as in ht_swiss.c */
+static int compact_scan(uint64_t *from, int *done, size_t want, ht_recbuf *b) {
+    (void)want;
+    uint64_t key = *from;
+    size_t k = shard_index(key);
+    const cp_shard *s = &shards[k];
+    stripe_rdlock(&stripes[k].lock);
+
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < s->ngroups * CP_GROUP; ++i)
+        if (!(s->ctrl[i] & 0x80)) rc = push_slot(b, s, i, key);
+    uint64_t last = k + 1 == HT_NUM_STRIPES ? UINT64_MAX : ((uint64_t)(k + 1) << (64 - stripe_bits)) - 1;
+    if (rc == 0) rc = base_collect_range(key, last, b);
+
+    stripe_unlock(&stripes[k].lock);
+    if (rc != 0) return -1;
+    if (last == UINT64_MAX) *done = 1;
+    else *from = last + 1;
+    return 0;
+}
+
+static void compact_resize_stats(ht_resize_stats *out) {
+    size_t slots = 0, records = 0;
+    for (int k = 0; k < HT_NUM_STRIPES; ++k) {
+        pthread_rwlock_rdlock(&stripes[k].lock);
+        slots += shards[k].ngroups * CP_GROUP;
+        records += shards[k].count;
+        pthread_rwlock_unlock(&stripes[k].lock);
+    }
+    records += base_count();
+    out->grows = __atomic_load_n(&n_grows, __ATOMIC_RELAXED);
+    out->shrinks = __atomic_load_n(&n_shrinks, __ATOMIC_RELAXED);
+    out->buckets_migrated = __atomic_load_n(&n_moved, __ATOMIC_RELAXED);
+    out->resizing = 0;
+    out->buckets = slots;
+    out->records = records;
+}
+
+/* the hand is a slot index, as in ht_swiss.c */
+static int compact_clock_next(size_t stripe, int thread_prio, char *name) {
+    cp_shard *s = &shards[stripe];
+    uint64_t first_key = stripe_bits == 0 ? 0 : (uint64_t)stripe << (64 - stripe_bits);
+    log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(first_key), NULL, 0);
+    stripe_rdlock(&stripes[stripe].lock);
+    log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(first_key), NULL, 0);
+
+    size_t mask = s->ngroups * CP_GROUP - 1;
+    size_t i = __atomic_load_n(&s->hand, __ATOMIC_RELAXED) & mask;
+    int rc = -1;
+    for (size_t n = 0; s->count > 0 && n <= 2 * (mask + 1); ++n, i = (i + 1) & mask) {
+        if (s->ctrl[i] & 0x80) continue;
+        if (cache_clear_ref(&s->refs[i])) continue;
+        size_t len = name_len(s, i);
+        memcpy(name, name_at(s, i), len);
+        name[len] = '\0';
+        i = (i + 1) & mask;
+        rc = 0;
+        break;
+    }
+    __atomic_store_n(&s->hand, i, __ATOMIC_RELAXED);
+
+    log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(first_key), NULL, 0);
+    stripe_unlock(&stripes[stripe].lock);
+    return rc;
+}
+
+const ht_ops ht_compact_ops = {
+    .init = compact_init,
+    .destroy = compact_destroy,
+    .insert = compact_insert,
+    .delete_key = compact_delete,
+    .update = compact_update,
+    .upsert = compact_upsert,
+    .search_into = compact_search_into,
+    .collect = compact_collect,
+    .scan = compact_scan,
+    .search_batch = compact_search_batch,
+    .insert_batch = compact_insert_batch,
+    .resize_stats = compact_resize_stats,
+    .clock_next = compact_clock_next,
+};
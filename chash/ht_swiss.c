@@ -0,0 +1,655 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "hash_table.h"
+#include "ht_backend.h"
+#include "chash.h"
+#include "snapshot.h"
+#include "salary_index.h"
+#include "logger.h"
+#include "stats.h"
+#include "wal.h"
+
+/* The open-addressing backend, in the style of Swiss tables.
+
+   The table is split into HT_NUM_STRIPES shards by the top bits of the
+   key hash, each an independent table guarded by its stripe's rwlock, so a
+   resize rehashes one shard under one lock while the others keep going.
+
+   A shard holds its records inline in an array of 64-byte slots, grouped
+   sixteen to a group, with one control byte per slot: EMPTY, DELETED
+   (a tombstone) or the 7-bit tag of the record in it.  A lookup loads a
+   group's sixteen control bytes, compares them all against the key's tag
+   with one SSE2 compare, and only in slots whose tag matched checks the
+   32-bit fingerprint stored in the slot and then the name; it stops at the first group that still has an EMPTY slot.  The
+   groups are probed in triangular order, which visits every group of a
+   power-of-two table.  A hit typically costs two cache lines, the control
+   group and the slot, instead of a walk through heap nodes.
+
+   Reads always take the stripe lock (there is no lock-free read path),
+   and a shard is rehashed whole, so it has no incremental resize. */
+
+#if (HT_NUM_STRIPES & (HT_NUM_STRIPES - 1)) != 0 || HT_NUM_STRIPES < 1
+#error "HT_NUM_STRIPES must be a power of two"
+#endif
+
+#define SW_GROUP 16                     /* slots per control group */
+#define SW_EMPTY 0x80
+#define SW_DELETED 0xFE
+#define SW_MAX_LOAD_PCT 87              /* full + deleted slots before a rehash */
+#define SW_SHRINK_LOAD_PCT 12           /* full slots before halving */
+
+/* smallest shard, HT_NUM_BUCKETS slots over the whole table */
+#define SW_MIN_GROUPS (HT_NUM_BUCKETS / HT_NUM_STRIPES / SW_GROUP > 0 ? \
+                       HT_NUM_BUCKETS / HT_NUM_STRIPES / SW_GROUP : 1)
+
+/* The full key doesn't fit next to the name in one line, so a slot keeps
+   its low word: the fingerprint, which also picks the slot's first group.
+   A name shorter than SW_INLINE bytes is kept in the slot; a longer one is
+   malloc'd and the slot points at it. */
+#define SW_INLINE 48
+typedef struct {
+    uint32_t fp;
+    uint32_t hash;              /* Jenkins, for display */
+    uint32_t salary;
+    uint16_t len;
+    uint8_t ref;                /* CLOCK reference byte (cache.h) */
+    union {
+        char name[SW_INLINE];   /* len < SW_INLINE: the name and a NUL */
+        char *ext;              /* otherwise */
+    };
+} __attribute__((aligned(64))) sw_slot;
+
+typedef struct {
+    uint8_t *ctrl;              /* one byte per slot, 16-byte aligned */
+    sw_slot *slots;
+    size_t ngroups;             /* power of two */
+    size_t count;               /* full slots */
+    size_t deleted;             /* tombstones */
+    size_t hand;                /* slot the CLOCK hand stands at */
+} __attribute__((aligned(64))) sw_shard;
+
+static ht_stripe stripes[HT_NUM_STRIPES];
+static sw_shard shards[HT_NUM_STRIPES];
+static unsigned stripe_bits;
+
+/* resize counters, updated under different stripes */
+static unsigned long n_grows;
+static unsigned long n_shrinks;
+static unsigned long n_moved;
+
+static unsigned log2_u32(uint32_t v) {
+    unsigned r = 0;
+    while (v >>= 1) r++;
+    return r;
+}
+
+static inline size_t shard_index(uint64_t key) {
+    return stripe_bits == 0 ? 0 : (size_t)(key >> (64 - stripe_bits));
+}
+
+/* The shard comes from the top bits of the key and the first group from
+   the fingerprint (the low word), so the tag takes seven bits that
+   neither uses. */
+static inline uint32_t fp_of(uint64_t key) {
+    return (uint32_t)key;
+}
+static inline uint8_t tag_of(uint64_t key) {
+    return (uint8_t)((key >> 32) & 0x7F);
+}
+
+#ifdef __SSE2__
+/* bit i set where control byte i equals b */
+static inline unsigned group_match(const uint8_t *ctrl, uint8_t b) {
+    __m128i g = _mm_load_si128((const __m128i *)ctrl);
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+}
+/* bit i set where slot i is EMPTY or DELETED (the only bytes with the top bit) */
+static inline unsigned group_free(const uint8_t *ctrl) {
+    return (unsigned)_mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+}
+#else
+static inline unsigned group_match(const uint8_t *ctrl, uint8_t b) {
+    unsigned m = 0;
+    for (int i = 0; i < SW_GROUP; ++i) m |= (unsigned)(ctrl[i] == b) << i;
+    return m;
+}
+static inline unsigned group_free(const uint8_t *ctrl) {
+    unsigned m = 0;
+    for (int i = 0; i < SW_GROUP; ++i) m |= (unsigned)(ctrl[i] >> 7) << i;
+    return m;
+}
+#endif
+
+static inline const char *slot_name(const sw_slot *slot) {
+    return slot->len < SW_INLINE ? slot->name : slot->ext;
+}
+
+/* slot index holding name, or -1 */
+static long find_slot(const sw_shard *s, uint64_t key, const char *name) {
+    uint8_t tag = tag_of(key);
+    uint32_t fp = fp_of(key);
+    size_t len = strlen(name);
+    size_t mask = s->ngroups - 1, g = fp & mask;
+    uint64_t probed = 0;
+    for (size_t step = 1; step <= s->ngroups; ++step) {
+        const uint8_t *ctrl = s->ctrl + g * SW_GROUP;
+        probed++;
+        for (unsigned m = group_match(ctrl, tag); m; m &= m - 1) {
+            size_t i = g * SW_GROUP + (size_t)__builtin_ctz(m);
+            const sw_slot *slot = &s->slots[i];
+            if (slot->fp == fp && name_eq(slot_name(slot), slot->len, name, len)) {
+                STATS_VALUE(ST_CHAIN_WALK, probed);
+                return (long)i;
+            }
+        }
+        if (group_match(ctrl, SW_EMPTY)) break;
+        g = (g + step) & mask;
+    }
+    STATS_VALUE(ST_CHAIN_WALK, probed);
+    return -1;
+}
+
+/* first EMPTY or DELETED slot on fp's probe sequence; the load limit
+   guarantees there is one */
+static size_t find_free(const sw_shard *s, uint32_t fp) {
+    size_t mask = s->ngroups - 1, g = fp & mask;
+    for (size_t step = 1; ; ++step) {
+        unsigned m = group_free(s->ctrl + g * SW_GROUP);
+        if (m) return g * SW_GROUP + (size_t)__builtin_ctz(m);
+        g = (g + step) & mask;
+    }
+}
+
+/* bytes of the slot arrays of a shard of ngroups groups */
+static size_t shard_bytes(size_t ngroups) {
+    size_t nslots = ngroups * SW_GROUP;
+    return (nslots < 64 ? 64 : nslots) + nslots * sizeof(sw_slot);
+}
+
+static int shard_alloc(sw_shard *s, size_t ngroups) {
+    size_t nslots = ngroups * SW_GROUP;
+    s->ctrl = aligned_alloc(64, nslots < 64 ? 64 : nslots);
+    s->slots = aligned_alloc(64, nslots * sizeof(sw_slot));
+    if (!s->ctrl || !s->slots) {
+        free(s->ctrl);
+        free(s->slots);
+        s->ctrl = NULL;
+        s->slots = NULL;
+        return -1;
+    }
+    memset(s->ctrl, SW_EMPTY, nslots);
+    s->ngroups = ngroups;
+    s->count = s->deleted = 0;
+    cache_charge((int64_t)shard_bytes(ngroups));
+    return 0;
+}
+
+/* Move every record into a fresh array of ngroups groups, dropping the
+   tombstones; caller holds the stripe for writing.  On allocation failure
+   the shard is left as it was. */
+static int rehash(sw_shard *s, size_t ngroups) {
+    sw_shard old = *s;
+    if (shard_alloc(s, ngroups) != 0) {
+        *s = old;
+        return -1;
+    }
+    size_t nslots = old.ngroups * SW_GROUP;
+    for (size_t i = 0; i < nslots; ++i) {
+        if (old.ctrl[i] & 0x80) continue;
+        size_t j = find_free(s, old.slots[i].fp);
+        s->ctrl[j] = old.ctrl[i];
+        s->slots[j] = old.slots[i];
+        s->count++;
+    }
+    if (ngroups > old.ngroups) __atomic_fetch_add(&n_grows, 1, __ATOMIC_RELAXED);
+    else if (ngroups < old.ngroups) __atomic_fetch_add(&n_shrinks, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&n_moved, nslots, __ATOMIC_RELAXED);
+    if (ngroups != old.ngroups) {
+        log_event(EV_RESIZE_START, -1, (uint32_t)nslots, NULL, (uint32_t)(ngroups * SW_GROUP));
+        log_event(EV_RESIZE_DONE, -1, 0, NULL, (uint32_t)(ngroups * SW_GROUP));
+    }
+    cache_charge(-(int64_t)shard_bytes(old.ngroups));
+    free(old.ctrl);
+    free(old.slots);
+    return 0;
+}
+
+/* frees a long name (NULL: none) */
+static void free_ext(char *ext, size_t len) {
+    if (!ext) return;
+    cache_charge(-(int64_t)len - 1);
+    free(ext);
+}
+
+/* stores a record for a name known to be absent; 0 or -1 if out of memory */
+static int shard_put(sw_shard *s, const char *name, uint32_t salary, uint64_t key, uint32_t hash) {
+    size_t len = strlen(name);
+    char *ext = NULL;
+    if (len >= SW_INLINE) {
+        if (!(ext = malloc(len + 1))) return -1;
+        cache_charge((int64_t)len + 1);
+    }
+    size_t nslots = s->ngroups * SW_GROUP;
+    if ((s->count + s->deleted + 1) * 100 > nslots * SW_MAX_LOAD_PCT) {
+        /* mostly tombstones: clean up in place instead of growing */
+        size_t groups = (s->count + 1) * 100 > nslots * SW_MAX_LOAD_PCT / 2 ? s->ngroups * 2 : s->ngroups;
+        if (rehash(s, groups) != 0) {
+            free_ext(ext, len);
+            return -1;
+        }
+    }
+    if (sidx_add(key, name, len, hash, salary) != 0) {
+        free_ext(ext, len);
+        return -1;
+    }
+    size_t i = find_free(s, fp_of(key));
+    sw_slot *slot = &s->slots[i];
+    if (s->ctrl[i] == SW_DELETED) s->deleted--;
+    s->ctrl[i] = tag_of(key);
+    slot->fp = fp_of(key);
+    slot->hash = hash;
+    slot->salary = salary;
+    slot->len = (uint16_t)len;
+    slot->ref = 1;
+    if (ext) slot->ext = ext;
+    memcpy(ext ? ext : slot->name, name, len + 1);
+    s->count++;
+    wal_append(WAL_INSERT, name, salary);
+    return 0;
+}
+
+/* caller holds the stripe for writing; 0 inserted, -1 duplicate or out of memory */
+static int shard_insert(sw_shard *s, const char *name, uint32_t salary, uint64_t key, uint32_t hash) {
+    if (find_slot(s, key, name) >= 0 || base_contains(key, name)) return -1;
+    return shard_put(s, name, salary, key, hash);
+}
+
+/* the caller knows the full key, since the slot only has its low word,
+   and gives the copy its name */
+static void copy_out(hashRecord *dst, const sw_slot *src, uint64_t key, const char *name) {
+    dst->hash = src->hash;
+    dst->salary = src->salary;
+    dst->key = key;
+    dst->name = name;
+}
+
+/* appends the record in slot to b; 0 or -1 if out of memory */
+static int push_slot(ht_recbuf *b, const sw_slot *slot, uint64_t key) {
+    hashRecord *dst = recbuf_push(b, slot_name(slot), slot->len);
+    if (!dst) return -1;
+    copy_out(dst, slot, key, dst->name);
+    return 0;
+}
+
+static void free_names(sw_shard *s) {
+    for (size_t i = 0; s->ctrl && i < s->ngroups * SW_GROUP; ++i)
+        if (!(s->ctrl[i] & 0x80) && s->slots[i].len >= SW_INLINE) free_ext(s->slots[i].ext, s->slots[i].len);
+}
+
+static void swiss_init(ht_read_mode mode) {
+    (void)mode;
+    stripe_bits = log2_u32(HT_NUM_STRIPES);
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) {
+        pthread_rwlock_init(&stripes[i].lock, NULL);
+        if (shard_alloc(&shards[i], SW_MIN_GROUPS) != 0) {
+            perror("ht_init");
+            exit(1);
+        }
+    }
+    n_grows = n_shrinks = n_moved = 0;
+}
+
+static void swiss_destroy(void) {
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) {
+        free_names(&shards[i]);
+        if (shards[i].ctrl) cache_charge(-(int64_t)shard_bytes(shards[i].ngroups));
+        free(shards[i].ctrl);
+        free(shards[i].slots);
+        memset(&shards[i], 0, sizeof(shards[i]));
+        pthread_rwlock_destroy(&stripes[i].lock);
+    }
+}
+
+static int swiss_insert(const char *name, uint32_t salary, uint64_t key, uint32_t hash, int thread_prio) {
+    size_t k = shard_index(key);
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(&stripes[k].lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    int rc = shard_insert(&shards[k], name, salary, key, hash);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+static int swiss_delete(const char *name, uint64_t key, int thread_prio, hashRecord *out_deleted) {
+    size_t k = shard_index(key);
+    sw_shard *s = &shards[k];
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(&stripes[k].lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    long i = find_slot(s, key, name);
+    int rc = 0;
+    if (i >= 0) {
+        if (out_deleted) copy_out(out_deleted, &s->slots[i], key, name);
+        sidx_remove(key, name, s->slots[i].len, s->slots[i].hash, s->slots[i].salary);
+        if (s->slots[i].len >= SW_INLINE) free_ext(s->slots[i].ext, s->slots[i].len);
+        /* a group with an EMPTY slot already ends every probe through it,
+           so the slot can go back to EMPTY instead of a tombstone */
+        if (group_match(s->ctrl + (size_t)i / SW_GROUP * SW_GROUP, SW_EMPTY)) {
+            s->ctrl[i] = SW_EMPTY;
+        } else {
+            s->ctrl[i] = SW_DELETED;
+            s->deleted++;
+        }
+        s->count--;
+        if (s->ngroups > SW_MIN_GROUPS && s->count * 100 < s->ngroups * SW_GROUP * SW_SHRINK_LOAD_PCT)
+            rehash(s, s->ngroups / 2);
+    } else {
+        rc = base_delete(key, name, out_deleted);
+    }
+    if (rc == 0) wal_append(WAL_DELETE, name, 0);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+static int swiss_update(const char *name, uint64_t key, const salary_op *op, int thread_prio,
+                        hashRecord *out_old) {
+    size_t k = shard_index(key);
+    sw_shard *s = &shards[k];
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(&stripes[k].lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    long i = find_slot(s, key, name);
+    uint32_t salary = 0;
+    int rc;
+    if (i >= 0) {
+        if (out_old) copy_out(out_old, &s->slots[i], key, name);
+        cache_touch(&s->slots[i].ref);
+        rc = salary_apply(op, s->slots[i].salary, &salary);
+        if (rc == 0) {
+            sidx_change(key, name, s->slots[i].len, s->slots[i].hash, s->slots[i].salary, salary);
+            s->slots[i].salary = salary;
+        }
+    } else {
+        rc = base_update(key, name, op, out_old, &salary);
+    }
+    if (rc == 0) wal_append(WAL_UPDATE, name, salary);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+/* a miss goes straight to shard_put: the name is known to be absent, so
+   it is not looked up again */
+static int swiss_upsert(const char *name, uint32_t salary, uint64_t key, uint32_t hash, int thread_prio,
+                        hashRecord *out_old) {
+    size_t k = shard_index(key);
+    sw_shard *s = &shards[k];
+    salary_op op = { SAL_SET, salary, 0, 0 };
+    log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_wrlock(&stripes[k].lock);
+    log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    long i = find_slot(s, key, name);
+    int rc = 0;
+    if (i >= 0) {
+        if (out_old) copy_out(out_old, &s->slots[i], key, name);
+        cache_touch(&s->slots[i].ref);
+        sidx_change(key, name, s->slots[i].len, s->slots[i].hash, s->slots[i].salary, salary);
+        s->slots[i].salary = salary;
+    } else if (base_update(key, name, &op, out_old, &salary) != 0) {
+        rc = shard_put(s, name, salary, key, hash) == 0 ? 1 : -1;
+    }
+    if (rc == 0) wal_append(WAL_UPDATE, name, salary);
+
+    log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+static int swiss_search_into(const char *name, uint64_t key, int thread_prio, hashRecord *out) {
+    size_t k = shard_index(key);
+    sw_shard *s = &shards[k];
+    log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(key), NULL, 0);
+    stripe_rdlock(&stripes[k].lock);
+    log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(key), NULL, 0);
+
+    long i = find_slot(s, key, name);
+    int rc = 0;
+    if (i >= 0) {
+        copy_out(out, &s->slots[i], key, name);
+        cache_touch(&s->slots[i].ref);
+    } else {
+        rc = base_search(key, name, out);
+    }
+
+    log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(key), NULL, 0);
+    stripe_unlock(&stripes[k].lock);
+    return rc;
+}
+
+/* Batches (see ht_backend.h): while key k is looked up, the first control
+   group of the key HT_PREFETCH_AHEAD further on is prefetched, and the
+   slot of the first tag match of the key half as far ahead.  Only keys of
+   the locked shard are prefetched, since another shard may be rehashed
+   under us. */
+static inline void prefetch_ahead(const sw_shard *s, const batch_key *keys, size_t k, size_t group_end) {
+    size_t mask = s->ngroups - 1;
+    if (k + HT_PREFETCH_AHEAD < group_end)
+        __builtin_prefetch(s->ctrl + (fp_of(keys[k + HT_PREFETCH_AHEAD].key) & mask) * SW_GROUP);
+    if (k + HT_PREFETCH_AHEAD / 2 < group_end) {
+        uint64_t key = keys[k + HT_PREFETCH_AHEAD / 2].key;
+        size_t g = fp_of(key) & mask;
+        unsigned m = group_match(s->ctrl + g * SW_GROUP, tag_of(key));
+        if (m) __builtin_prefetch(&s->slots[g * SW_GROUP + (size_t)__builtin_ctz(m)]);
+    }
+}
+
+/* end of the run of keys from start that share its shard */
+static size_t shard_group_end(const batch_key *keys, size_t start, size_t n) {
+    size_t k = shard_index(keys[start].key);
+    size_t end = start + 1;
+    while (end < n && shard_index(keys[end].key) == k) end++;
+    return end;
+}
+
+static int swiss_search_batch(const char *const *names, const uint64_t *keyv, size_t n,
+                              int thread_prio, hashRecord *out, int *found) {
+    batch_key *keys = ht_batch_sort(keyv, n);
+    size_t hits = 0;
+    if (!keys) {
+        for (size_t i = 0; i < n; ++i) {
+            found[i] = swiss_search_into(names[i], keyv[i], thread_prio, &out[i]);
+            if (found[i] == 0) hits++;
+        }
+        return (int)hits;
+    }
+
+    for (size_t b = 0; b < n; ) {
+        size_t e = shard_group_end(keys, b, n);
+        size_t k = shard_index(keys[b].key);
+        sw_shard *s = &shards[k];
+        log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(keys[b].key), NULL, 0);
+        stripe_rdlock(&stripes[k].lock);
+        log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(keys[b].key), NULL, 0);
+
+        for (size_t j = b; j < e; ++j) {
+            prefetch_ahead(s, keys, j, e);
+            uint32_t x = keys[j].idx;
+            long i = find_slot(s, keys[j].key, names[x]);
+            if (i >= 0) {
+                copy_out(&out[x], &s->slots[i], keys[j].key, names[x]);
+                cache_touch(&s->slots[i].ref);
+            }
+            found[x] = i >= 0 ? 0 : base_search(keys[j].key, names[x], &out[x]);
+            if (found[x] == 0) hits++;
+        }
+
+        log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(keys[b].key), NULL, 0);
+        stripe_unlock(&stripes[k].lock);
+        b = e;
+    }
+    free(keys);
+    return (int)hits;
+}
+
+static int swiss_insert_batch(const char *const *names, const uint32_t *salaries, const uint64_t *keyv,
+                              const uint32_t *hashes, size_t n, int thread_prio, int *results) {
+    batch_key *keys = ht_batch_sort(keyv, n);
+    size_t inserted = 0;
+    if (!keys) {
+        for (size_t i = 0; i < n; ++i) {
+            results[i] = swiss_insert(names[i], salaries[i], keyv[i], hashes[i], thread_prio);
+            if (results[i] == 0) inserted++;
+        }
+        return (int)inserted;
+    }
+
+    for (size_t b = 0; b < n; ) {
+        size_t e = shard_group_end(keys, b, n);
+        size_t k = shard_index(keys[b].key);
+        sw_shard *s = &shards[k];
+        log_event(EV_WRITE_LOCK_ATTEMPT, thread_prio, log_key(keys[b].key), NULL, 0);
+        stripe_wrlock(&stripes[k].lock);
+        log_event(EV_WRITE_LOCK_ACQUIRED, thread_prio, log_key(keys[b].key), NULL, 0);
+
+        for (size_t j = b; j < e; ++j) {
+            prefetch_ahead(s, keys, j, e);
+            uint32_t i = keys[j].idx;
+            results[i] = shard_insert(s, names[i], salaries[i], keyv[i], hashes[i]);
+            if (results[i] == 0) inserted++;
+        }
+
+        log_event(EV_WRITE_LOCK_RELEASED, thread_prio, log_key(keys[b].key), NULL, 0);
+        stripe_unlock(&stripes[k].lock);
+        b = e;
+    }
+    free(keys);
+    return (int)inserted;
+}
+
+/* Slots are in no particular order, so every stripe is read-locked (in
+   index order) while the full slots are copied.  A slot keeps only the
+   low word of its key, so the copies get theirs from the name. */
+static int swiss_collect(int thread_prio, ht_recbuf *b) {
+    log_event(EV_READ_LOCK_ATTEMPT, thread_prio, 0, NULL, 0);
+    STATS_TIME(t0);
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) pthread_rwlock_rdlock(&stripes[i].lock);
+    STATS_LAP(ST_STRIPE_WAIT, t0, ht_stripe_held);
+    log_event(EV_READ_LOCK_ACQUIRED, thread_prio, 0, NULL, 0);
+
+    int rc = 0;
+    for (int k = 0; rc == 0 && k < HT_NUM_STRIPES; ++k) {
+        const sw_shard *s = &shards[k];
+        for (size_t i = 0; rc == 0 && i < s->ngroups * SW_GROUP; ++i) {
+            const sw_slot *slot = &s->slots[i];
+            if (!(s->ctrl[i] & 0x80)) rc = push_slot(b, slot, key_hash_len(slot_name(slot), slot->len));
+        }
+    }
+    if (rc == 0) rc = base_collect_range(0, UINT64_MAX, b);
+
+    log_event(EV_READ_LOCK_RELEASED, thread_prio, 0, NULL, 0);
+    STATS_SINCE(ST_STRIPE_HOLD, ht_stripe_held);
+    for (int i = HT_NUM_STRIPES - 1; i >= 0; --i) pthread_rwlock_unlock(&stripes[i].lock);
+    return rc;
+}
+
+/* A shard's slots are in no key order, so a scan always copies one whole
+   shard; the cursor sorts it. */
+static int swiss_scan(uint64_t *from, int *done, size_t want, ht_recbuf *b) {
+    (void)want;
+    uint64_t key = *from;
+    size_t k = shard_index(key);
+    const sw_shard *s = &shards[k];
+    stripe_rdlock(&stripes[k].lock);
+
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < s->ngroups * SW_GROUP; ++i) {
+        if (s->ctrl[i] & 0x80) continue;
+        const sw_slot *slot = &s->slots[i];
+        uint64_t full = key_hash_len(slot_name(slot), slot->len);
+        if (full >= key) rc = push_slot(b, slot, full);
+    }
+    uint64_t last = k + 1 == HT_NUM_STRIPES ? UINT64_MAX : ((uint64_t)(k + 1) << (64 - stripe_bits)) - 1;
+    if (rc == 0) rc = base_collect_range(key, last, b);
+
+    stripe_unlock(&stripes[k].lock);
+    if (rc != 0) return -1;
+    if (last == UINT64_MAX) *done = 1;
+    else *from = last + 1;
+    return 0;
+}
+
+static void swiss_resize_stats(ht_resize_stats *out) {
+    size_t slots = 0, records = 0;
+    for (int k = 0; k < HT_NUM_STRIPES; ++k) {
+        pthread_rwlock_rdlock(&stripes[k].lock);
+        slots += shards[k].ngroups * SW_GROUP;
+        records += shards[k].count;
+        pthread_rwlock_unlock(&stripes[k].lock);
+    }
+    records += base_count();
+    out->grows = __atomic_load_n(&n_grows, __ATOMIC_RELAXED);
+    out->shrinks = __atomic_load_n(&n_shrinks, __ATOMIC_RELAXED);
+    out->buckets_migrated = __atomic_load_n(&n_moved, __ATOMIC_RELAXED);
+    out->resizing = 0;
+    out->buckets = slots;
+    out->records = records;
+}
+
+/* The hand is a slot index: after a rehash it lands on an arbitrary
+   slot, which does for an approximation of recency. */
+static int swiss_clock_next(size_t stripe, int thread_prio, char *name) {
+    sw_shard *s = &shards[stripe];
+    uint64_t first_key = stripe_bits == 0 ? 0 : (uint64_t)stripe << (64 - stripe_bits);
+    log_event(EV_READ_LOCK_ATTEMPT, thread_prio, log_key(first_key), NULL, 0);
+    stripe_rdlock(&stripes[stripe].lock);
+    log_event(EV_READ_LOCK_ACQUIRED, thread_prio, log_key(first_key), NULL, 0);
+
+    size_t mask = s->ngroups * SW_GROUP - 1;
+    size_t i = __atomic_load_n(&s->hand, __ATOMIC_RELAXED) & mask;
+    int rc = -1;
+    for (size_t n = 0; s->count > 0 && n <= 2 * (mask + 1); ++n, i = (i + 1) & mask) {
+        if (s->ctrl[i] & 0x80) continue;
+        sw_slot *slot = &s->slots[i];
+        if (cache_clear_ref(&slot->ref)) continue;
+        memcpy(name, slot_name(slot), (size_t)slot->len + 1);
+        i = (i + 1) & mask;
+        rc = 0;
+        break;
+    }
+    __atomic_store_n(&s->hand, i, __ATOMIC_RELAXED);
+
+    log_event(EV_READ_LOCK_RELEASED, thread_prio, log_key(first_key), NULL, 0);
+    stripe_unlock(&stripes[stripe].lock);
+    return rc;
+}
+
+const ht_ops ht_swiss_ops = {
+    .init = swiss_init,
+    .destroy = swiss_destroy,
+    .insert = swiss_insert,
+    .delete_key = swiss_delete,
+    .update = swiss_update,
+    .upsert = swiss_upsert,
+    .search_into = swiss_search_into,
+    .collect = swiss_collect,
+    .scan = swiss_scan,
+    .search_batch = swiss_search_batch,
+    .insert_batch = swiss_insert_batch,
+    .resize_stats = swiss_resize_stats,
+    .clock_next = swiss_clock_next,
+};
@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ingest.h"
+
+#define PARSE_MIN_BYTES (4 * 1024 * 1024)   /* smallest slice worth a thread */
+#define MAX_TOKENS 16
+
+typedef struct {
+    const char *p;
+    size_t len;
+} token;
+
+int cmdfile_open(cmd_file *f, const char *path) {
+    struct stat st;
+    f->fd = open(path, O_RDONLY);
+    if (f->fd < 0) return -1;
+    if (fstat(f->fd, &st) != 0) {
+        close(f->fd);
+        return -1;
+    }
+    f->size = (size_t)st.st_size;
+    f->data = NULL;
+    f->pos = 0;
+    f->count = 0;
+    if (f->size > 0) {
+        void *m = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+        if (m == MAP_FAILED) {
+            close(f->fd);
+            return -1;
+        }
+        madvise(m, f->size, MADV_SEQUENTIAL);
+        f->data = m;
+    }
+    return 0;
+}
+
+void cmdfile_close(cmd_file *f) {
+    if (f->data) munmap((void *)f->data, f->size);
+    close(f->fd);
+    f->data = NULL;
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* atoi on a token that is not NUL-terminated; -1 if the number does not
+   fit in a long */
+static int parse_num(token t, long *out) {
+    size_t i = 0;
+    int neg = 0;
+    long v = 0;
+    if (i < t.len && (t.p[i] == '-' || t.p[i] == '+')) neg = t.p[i++] == '-';
+    while (i < t.len && t.p[i] >= '0' && t.p[i] <= '9') {
+        int d = t.p[i++] - '0';
+        if (v > (LONG_MAX - d) / 10) return -1;
+        v = v * 10 + d;
+    }
+    *out = neg ? -v : v;
+    return 0;
+}
+
+/* parse_num for a salary: -1 unless it is in 0..UINT32_MAX */
+static int parse_salary(token t, uint32_t *out) {
+    long v;
+    if (parse_num(t, &v) != 0 || v < 0 || v > (long)UINT32_MAX) return -1;
+    *out = (uint32_t)v;
+    return 0;
+}
+
+/* parse_num truncated to 32 bits, as insert and update always took it */
+static int parse_u32(token t, uint32_t *out) {
+    long v;
+    if (parse_num(t, &v) != 0) return -1;
+    *out = (uint32_t)v;
+    return 0;
+}
+
+static int token_is(token t, const char *word) {
+    return t.len == strlen(word) && strncasecmp(t.p, word, t.len) == 0;
+}
+
+/* points out at the name in t; -1 if it is too long to store */
+static int set_name(command_t *out, token t) {
+    if (t.len > HT_NAME_MAX) return -1;
+    out->name = t.p;
+    out->name_len = (uint32_t)t.len;
+    return 0;
+}
+
+/* number of ';'-separated items in a list field */
+static uint32_t count_items(token t) {
+    uint32_t n = 1;
+    for (size_t i = 0; i < t.len; ++i) n += t.p[i] == ';';
+    return n;
+}
+
+/* whether every item of a list of names fits HT_NAME_MAX */
+static int items_fit(token t) {
+    size_t run = 0;
+    for (size_t i = 0; i < t.len; ++i) {
+        run = t.p[i] == ';' ? 0 : run + 1;
+        if (run > HT_NAME_MAX) return 0;
+    }
+    return 1;
+}
+
+static void set_list(const char **p, uint32_t *len, token t) {
+    *p = t.p;
+    *len = (uint32_t)t.len;
+}
+
+int cmd_parse_line(const char *p, const char *end, command_t *out) {
+    token tokens[MAX_TOKENS];
+    int t = 0;
+    while (p < end && is_blank(end[-1])) end--;
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    if (p == end) return 1;
+
+    /* split on commas, trimming each field */
+    while (t < MAX_TOKENS) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *stop = comma ? comma : end;
+        const char *a = p, *b = stop;
+        while (a < b && (*a == ' ' || *a == '\t')) a++;
+        while (b > a && is_blank(b[-1])) b--;
+        tokens[t].p = a;
+        tokens[t].len = (size_t)(b - a);
+        t++;
+        if (!comma) break;
+        p = comma + 1;
+    }
+
+    if (token_is(tokens[0], "threads")) {
+        /* header: threads,<N>,... ignored, counts are derived from the commands */
+        return 1;
+    }
+
+    /* last token is priority */
+    long priority;
+    if (parse_num(tokens[t-1], &priority) != 0 || priority < 0 || priority > INT_MAX) return -1;
+
+    out->priority = (int)priority;
+    out->seq = -1;
+    out->slot = -1;
+    out->salary = 0;
+    out->expected = 0;
+    out->delta = 0;
+    out->original_index = -1;
+    out->type = CMD_INVALID;
+    out->name = "";
+    out->name_len = 0;
+    out->names = out->salaries = NULL;
+    out->names_len = out->salaries_len = out->nkeys = 0;
+
+    if (token_is(tokens[0], "insert")) {
+        if (t < 4) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        if (parse_u32(tokens[t-2], &out->salary) != 0) return -1; /* second-last is salary */
+        out->type = CMD_INSERT;
+    } else if (token_is(tokens[0], "delete")) {
+        if (t < 3) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        out->type = CMD_DELETE;
+    } else if (token_is(tokens[0], "update")) {
+        /* formats vary; typically: update,Name,newSalary,priority */
+        if (t < 4) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        if (parse_u32(tokens[t-2], &out->salary) != 0) return -1;
+        out->type = CMD_UPDATE;
+    } else if (token_is(tokens[0], "upsert")) {
+        /* upsert,Name,Salary,priority: update, or insert if missing */
+        if (t < 4) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        if (parse_salary(tokens[t-2], &out->salary) != 0) return -1;
+        out->type = CMD_UPSERT;
+    } else if (token_is(tokens[0], "add")) {
+        /* add,Name,Delta,priority: Delta may be negative */
+        if (t < 4) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        long delta;
+        if (parse_num(tokens[t-2], &delta) != 0 || delta < INT32_MIN || delta > INT32_MAX) return -1;
+        out->delta = (int32_t)delta;
+        out->type = CMD_ADD;
+    } else if (token_is(tokens[0], "cas")) {
+        /* cas,Name,Expected,New,priority */
+        if (t < 5) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        if (parse_salary(tokens[2], &out->expected) != 0 || parse_salary(tokens[t-2], &out->salary) != 0)
+            return -1;
+        out->type = CMD_CAS;
+    } else if (token_is(tokens[0], "search")) {
+        if (t < 3) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        out->type = CMD_SEARCH;
+    } else if (token_is(tokens[0], "print")) {
+        out->type = CMD_PRINT;
+    } else if (token_is(tokens[0], "range")) {
+        /* range,Low,High,priority: both ends included */
+        if (t < 4) return -1;
+        if (parse_salary(tokens[1], &out->expected) != 0 || parse_salary(tokens[t-2], &out->salary) != 0)
+            return -1;
+        out->type = CMD_RANGE;
+    } else if (token_is(tokens[0], "sum")) {
+        /* sum,0,0,priority; likewise count and avg */
+        out->type = CMD_SUM;
+    } else if (token_is(tokens[0], "count")) {
+        out->type = CMD_COUNT;
+    } else if (token_is(tokens[0], "avg")) {
+        out->type = CMD_AVG;
+    } else if (token_is(tokens[0], "stats")) {
+        /* stats,0,0,priority */
+        out->type = CMD_STATS;
+    } else if (token_is(tokens[0], "snapshot")) {
+        /* snapshot,path,0,priority */
+        if (t < 3 || tokens[1].len == 0) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        out->type = CMD_SNAPSHOT;
+    } else if (token_is(tokens[0], "load")) {
+        /* load,path,verify,priority: verify 1 also checks the records' CRC */
+        if (t < 4 || tokens[1].len == 0) return -1;
+        if (set_name(out, tokens[1]) != 0) return -1;
+        if (parse_u32(tokens[t-2], &out->salary) != 0) return -1;
+        out->type = CMD_LOAD;
+    } else if (token_is(tokens[0], "multisearch")) {
+        /* multisearch,Name1;Name2;...,0,priority */
+        if (t < 3 || tokens[1].len == 0 || !items_fit(tokens[1])) return -1;
+        set_list(&out->names, &out->names_len, tokens[1]);
+        out->nkeys = count_items(tokens[1]);
+        out->type = CMD_MULTISEARCH;
+    } else if (token_is(tokens[0], "multiinsert")) {
+        /* multiinsert,Name1;Name2;...,Salary1;Salary2;...,priority */
+        if (t < 4 || tokens[1].len == 0 || count_items(tokens[1]) != count_items(tokens[t-2]) ||
+            !items_fit(tokens[1]))
+            return -1;
+        set_list(&out->names, &out->names_len, tokens[1]);
+        set_list(&out->salaries, &out->salaries_len, tokens[t-2]);
+        out->nkeys = count_items(tokens[1]);
+        out->type = CMD_MULTIINSERT;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static void warn_line(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    while (p < end && is_blank(end[-1])) end--;
+    fprintf(stderr, "Warning: skipping unparsable line: %.*s\n", (int)(end - p), p);
+}
+
+/* One slice of the mapping, starting at a line start and ending just
+   after a newline (or at end of file). */
+typedef struct {
+    const char *begin, *end;
+    size_t lines;               /* pass 1: lines in the slice */
+    command_t *out;             /* pass 2: one entry per line */
+    int bad;                    /* pass 2: unparsable lines seen */
+} parse_slice;
+
+static size_t count_lines(const char *p, const char *end) {
+    size_t n = 0;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        n++;
+        if (!nl) break;
+        p = nl + 1;
+    }
+    return n;
+}
+
+static void *count_slice(void *arg) {
+    parse_slice *s = arg;
+    s->lines = count_lines(s->begin, s->end);
+    return NULL;
+}
+
+/* fills one entry per line; lines that yield no command become CMD_INVALID */
+static void *parse_slice_lines(void *arg) {
+    parse_slice *s = arg;
+    const char *p = s->begin;
+    command_t *out = s->out;
+    while (p < s->end) {
+        const char *nl = memchr(p, '\n', (size_t)(s->end - p));
+        const char *eol = nl ? nl : s->end;
+        int rc = cmd_parse_line(p, eol, out);
+        if (rc != 0) out->type = CMD_INVALID;
+        if (rc < 0) s->bad++;
+        out++;
+        p = nl ? nl + 1 : s->end;
+    }
+    return NULL;
+}
+
+/* run fn over every slice, in threads when there is more than one */
+static void run_slices(parse_slice *slices, int n, void *(*fn)(void *)) {
+    pthread_t tids[n];
+    int started[n];
+    for (int i = 1; i < n; ++i) started[i] = pthread_create(&tids[i], NULL, fn, &slices[i]) == 0;
+    fn(&slices[0]);
+    for (int i = 1; i < n; ++i) {
+        if (started[i]) pthread_join(tids[i], NULL);
+        else fn(&slices[i]);
+    }
+}
+
+int cmdfile_parse_all(cmd_file *f, int nthreads, command_t **out) {
+    *out = NULL;
+    if (!f->data) return 0;
+
+    /* cut the mapping into slices that end on a newline */
+    size_t want = f->size / PARSE_MIN_BYTES;
+    int n = nthreads < 1 ? 1 : nthreads;
+    if ((size_t)n > want) n = want > 0 ? (int)want : 1;
+    parse_slice slices[n];
+    const char *p = f->data, *end = f->data + f->size;
+    for (int i = 0; i < n; ++i) {
+        const char *stop = i == n - 1 ? end : f->data + f->size / n * (i + 1);
+        if (stop < p) stop = p;
+        if (stop < end) {
+            const char *nl = memchr(stop, '\n', (size_t)(end - stop));
+            stop = nl ? nl + 1 : end;
+        }
+        slices[i].begin = p;
+        slices[i].end = stop;
+        slices[i].bad = 0;
+        p = stop;
+    }
+
+    /* pass 1 sizes every slice so pass 2 can parse straight into place */
+    run_slices(slices, n, count_slice);
+    size_t total = 0;
+    for (int i = 0; i < n; ++i) total += slices[i].lines;
+    command_t *cmds = malloc(sizeof(command_t) * (total ? total : 1));
+    if (!cmds) return -1;
+    for (int i = 0, off = 0; i < n; ++i) {
+        slices[i].out = cmds + off;
+        off += (int)slices[i].lines;
+    }
+    run_slices(slices, n, parse_slice_lines);
+
+    /* squeeze out the lines without a command; slices with bad lines are
+       walked again alongside their entries to report them in file order */
+    int count = 0;
+    for (int i = 0; i < n; ++i) {
+        command_t *c = slices[i].out;
+        const char *line = slices[i].begin;
+        for (size_t j = 0; j < slices[i].lines; ++j, ++c) {
+            if (slices[i].bad) {
+                const char *nl = memchr(line, '\n', (size_t)(slices[i].end - line));
+                command_t scratch;
+                if (c->type == CMD_INVALID && cmd_parse_line(line, nl ? nl : slices[i].end, &scratch) < 0) {
+                    warn_line(line, nl ? nl : slices[i].end);
+                }
+                line = nl ? nl + 1 : slices[i].end;
+            }
+            if (c->type == CMD_INVALID) continue;
+            c->original_index = count;
+            cmds[count++] = *c;
+        }
+    }
+    *out = cmds;
+    return count;
+}
+
+int cmdfile_next(cmd_file *f, command_t *out, int max) {
+    int n = 0;
+    const char *end = f->data + f->size;
+    while (n < max && f->data && f->pos < f->size) {
+        const char *p = f->data + f->pos;
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *eol = nl ? nl : end;
+        f->pos = nl ? (size_t)(nl + 1 - f->data) : f->size;
+        int rc = cmd_parse_line(p, eol, &out[n]);
+        if (rc < 0) warn_line(p, eol);
+        if (rc != 0) continue;
+        out[n].original_index = f->count++;
+        n++;
+    }
+    return n;
+}
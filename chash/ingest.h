@@ -0,0 +1,44 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stddef.h>
+#include "chash.h"
+
+/* Command file ingestion.
+   The file is mapped read-only and parsed in place: no line is copied or
+   allocated, only the finished command_t entries are written, and their
+   names point into the mapping.  A line whose name is longer than
+   HT_NAME_MAX is unparsable rather than cut short.  Whole-file
+   parsing can be split across threads at newline boundaries; streaming
+   hands out commands a batch at a time as the mapping is consumed. */
+
+typedef struct {
+    int fd;
+    const char *data;           /* mapping, NULL for an empty file */
+    size_t size;
+    size_t pos;                 /* streaming cursor: start of the next line */
+    int count;                  /* streaming: commands handed out so far */
+} cmd_file;
+
+/* Parse one line [p, end), without its newline, into out; returns 0 on
+   success, -1 if unparsable, 1 for a line with nothing to run (blank, or
+   the 'threads' header).  The command points into the line. */
+int cmd_parse_line(const char *p, const char *end, command_t *out);
+
+/* returns 0, or -1 with errno set */
+int cmdfile_open(cmd_file *f, const char *path);
+/* commands point into the mapping: close only after they have run */
+void cmdfile_close(cmd_file *f);
+
+/* Parse the whole file with up to nthreads threads (large files only).
+   Unparsable lines are reported on stderr in file order and skipped.
+   On success *out holds the commands in file order with original_index
+   set, and the count is returned; -1 on allocation failure. */
+int cmdfile_parse_all(cmd_file *f, int nthreads, command_t **out);
+
+/* Streaming: parse up to max commands from the cursor into out, with
+   original_index continuing from the previous call.  Returns the number
+   parsed, 0 at end of file. */
+int cmdfile_next(cmd_file *f, command_t *out, int max);
+
+#endif /* INGEST_H */
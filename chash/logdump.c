@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "logger.h"
+
+/* chash-logdump: decode the binary hash.log written by chash into the
+   text trace, one line per event in timestamp order. */
+
+/* sorts pointers into the record array; ties keep file order */
+static int cmp_ts(const void *a, const void *b) {
+    const log_record *x = *(const log_record *const *)a, *y = *(const log_record *const *)b;
+    if (x->ts_us != y->ts_us) return x->ts_us < y->ts_us ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+static void print_record(const log_record *e) {
+    printf("%lld: ", (long long)e->ts_us);
+    switch (e->type) {
+    case EV_WAITING:    printf("THREAD %d WAITING FOR MY TURN\n", e->thread); break;
+    case EV_AWAKENED:   printf("THREAD %d AWAKENED FOR WORK\n", e->thread); break;
+    case EV_INSERT:     printf("THREAD %d INSERT,%u,%s,%u\n", e->thread, e->hash, e->name, e->value); break;
+    case EV_DELETE:     printf("THREAD %d DELETE,%u,%s\n", e->thread, e->hash, e->name); break;
+    case EV_UPDATE:     printf("THREAD %d UPDATE,%u,%s,%u\n", e->thread, e->hash, e->name, e->value); break;
+    case EV_SEARCH:     printf("THREAD %d SEARCH,%u,%s\n", e->thread, e->hash, e->name); break;
+    case EV_PRINT:      printf("THREAD %d PRINT\n", e->thread); break;
+    case EV_READ_LOCK_ATTEMPT:   printf("THREAD %d READ LOCK ACQUIRE ATTEMPT\n", e->thread); break;
+    case EV_READ_LOCK_ACQUIRED:  printf("THREAD %d READ LOCK ACQUIRED\n", e->thread); break;
+    case EV_READ_LOCK_RELEASED:  printf("THREAD %d READ LOCK RELEASED\n", e->thread); break;
+    case EV_WRITE_LOCK_ATTEMPT:  printf("THREAD %d WRITE LOCK ACQUIRE ATTEMPT\n", e->thread); break;
+    case EV_WRITE_LOCK_ACQUIRED: printf("THREAD %d WRITE LOCK ACQUIRED\n", e->thread); break;
+    case EV_WRITE_LOCK_RELEASED: printf("THREAD %d WRITE LOCK RELEASED\n", e->thread); break;
+    case EV_RESIZE_START: printf("TABLE RESIZE START, %u -> %u BUCKETS\n", e->hash, e->value); break;
+    case EV_RESIZE_DONE:  printf("TABLE RESIZE DONE, %u BUCKETS\n", e->value); break;
+    case EV_SNAPSHOT:   printf("THREAD %d SNAPSHOT,%s\n", e->thread, e->name); break;
+    case EV_LOAD:       printf("THREAD %d LOAD,%s\n", e->thread, e->name); break;
+    case EV_UPSERT:     printf("THREAD %d UPSERT,%u,%s,%u\n", e->thread, e->hash, e->name, e->value); break;
+    case EV_ADD:        printf("THREAD %d ADD,%u,%s,%d\n", e->thread, e->hash, e->name, (int32_t)e->value); break;
+    case EV_CAS:        printf("THREAD %d CAS,%u,%s,%u\n", e->thread, e->hash, e->name, e->value); break;
+    case EV_RANGE:      printf("THREAD %d RANGE,%u,%u\n", e->thread, e->hash, e->value); break;
+    case EV_EVICT:      printf("THREAD %d EVICT,%u,%s\n", e->thread, e->hash, e->name); break;
+    default:            printf("UNKNOWN EVENT %u\n", e->type); break;
+    }
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "hash.log";
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    log_file_header hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || memcmp(hdr.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 ||
+        hdr.record_size != sizeof(log_record)) {
+        fprintf(stderr, "%s: not a chash binary log\n", path);
+        fclose(f);
+        return 1;
+    }
+
+    log_record *recs = NULL;
+    size_t n = 0, cap = 0;
+    for (;;) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 4096;
+            log_record *tmp = realloc(recs, cap * sizeof(log_record));
+            if (!tmp) { perror("realloc"); free(recs); fclose(f); return 1; }
+            recs = tmp;
+        }
+        size_t got = fread(recs + n, sizeof(log_record), cap - n, f);
+        n += got;
+        if (n < cap) break;
+    }
+    fclose(f);
+
+    log_record **order = malloc((n ? n : 1) * sizeof(*order));
+    if (!order) { perror("malloc"); free(recs); return 1; }
+    for (size_t i = 0; i < n; ++i) {
+        recs[i].name[LOG_NAME_MAX - 1] = '\0';
+        order[i] = &recs[i];
+    }
+    qsort(order, n, sizeof(*order), cmp_ts);
+    for (size_t i = 0; i < n; ++i) print_record(order[i]);
+    free(order);
+    free(recs);
+    return 0;
+}
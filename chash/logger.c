@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "logger.h"
+#include "chash.h"
+
+#define LOG_RING_EVENTS 1024            /* per thread, power of two */
+#define LOG_WRITE_BUF (256 * 1024)
+#define LOG_DRAIN_INTERVAL_MS 10
+
+/* Single-producer/single-consumer ring: the owning thread advances head,
+   the drain thread advances tail.  Rings of exited threads are drained,
+   then recycled for the next thread that logs. */
+typedef struct log_ring {
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail __attribute__((aligned(64)));
+    int closed;                         /* owner exited */
+    struct log_ring *next;
+    log_record ev[LOG_RING_EVENTS];
+} log_ring;
+
+static pthread_mutex_t reg_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_cv = PTHREAD_COND_INITIALIZER;
+static log_ring *rings;                 /* live rings, drained in a loop */
+static log_ring *spare_rings;           /* drained rings of exited threads */
+static int drain_kicked;
+static int drain_stop;
+
+static int log_fd = -1;
+static int log_running;
+static pthread_t drain_tid;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static log_level cur_level = LOG_TRACE;
+
+static __thread log_ring *my_ring;
+
+/* minimum level at which each event is recorded */
+static const unsigned char event_level[EV_COUNT] = {
+    [EV_WAITING] = LOG_OPS,
+    [EV_AWAKENED] = LOG_OPS,
+    [EV_INSERT] = LOG_OPS,
+    [EV_DELETE] = LOG_OPS,
+    [EV_UPDATE] = LOG_OPS,
+    [EV_SEARCH] = LOG_OPS,
+    [EV_PRINT] = LOG_OPS,
+    [EV_READ_LOCK_ATTEMPT] = LOG_TRACE,
+    [EV_READ_LOCK_ACQUIRED] = LOG_TRACE,
+    [EV_READ_LOCK_RELEASED] = LOG_TRACE,
+    [EV_WRITE_LOCK_ATTEMPT] = LOG_TRACE,
+    [EV_WRITE_LOCK_ACQUIRED] = LOG_TRACE,
+    [EV_WRITE_LOCK_RELEASED] = LOG_TRACE,
+    [EV_RESIZE_START] = LOG_OPS,
+    [EV_RESIZE_DONE] = LOG_OPS,
+    [EV_SNAPSHOT] = LOG_OPS,
+    [EV_LOAD] = LOG_OPS,
+    [EV_UPSERT] = LOG_OPS,
+    [EV_ADD] = LOG_OPS,
+    [EV_CAS] = LOG_OPS,
+    [EV_RANGE] = LOG_OPS,
+    [EV_EVICT] = LOG_OPS,
+};
+
+static void ring_release(void *arg) {
+    log_ring *r = arg;
+    __atomic_store_n(&r->closed, 1, __ATOMIC_RELEASE);
+}
+
+static void make_ring_key(void) {
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static log_ring *ring_register(void) {
+    pthread_mutex_lock(&reg_mutex);
+    log_ring *r = spare_rings;
+    if (r) {
+        spare_rings = r->next;
+    } else if (posix_memalign((void **)&r, 64, sizeof(*r)) != 0) {
+        pthread_mutex_unlock(&reg_mutex);
+        return NULL;
+    }
+    r->head = r->tail = 0;
+    r->closed = 0;
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&reg_mutex);
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    return r;
+}
+
+static void kick_drain(void) {
+    pthread_mutex_lock(&reg_mutex);
+    drain_kicked = 1;
+    pthread_cond_signal(&drain_cv);
+    pthread_mutex_unlock(&reg_mutex);
+}
+
+int log_enabled(log_event_type type) {
+    return event_level[type] <= __atomic_load_n(&cur_level, __ATOMIC_RELAXED) &&
+           __atomic_load_n(&log_running, __ATOMIC_ACQUIRE);
+}
+
+void log_event(log_event_type type, int thread, uint32_t hash, const char *name, uint32_t value) {
+    if (!log_enabled(type)) return;
+    log_ring *r = my_ring ? my_ring : ring_register();
+    if (!r) return;
+
+    uint64_t head = r->head;
+    /* lossless: a full ring waits for the drain thread */
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LOG_RING_EVENTS) {
+        kick_drain();
+        sched_yield();
+    }
+    log_record *e = &r->ev[head & (LOG_RING_EVENTS - 1)];
+    e->ts_us = current_timestamp_us();
+    e->thread = thread;
+    e->type = (uint16_t)type;
+    e->reserved = 0;
+    e->hash = hash;
+    e->value = value;
+    if (name) {
+        size_t n = strnlen(name, LOG_NAME_MAX - 1);
+        memcpy(e->name, name, n);
+        e->name[n] = '\0';
+    } else {
+        e->name[0] = '\0';
+    }
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    if (head + 1 - __atomic_load_n(&r->tail, __ATOMIC_RELAXED) == LOG_RING_EVENTS / 2) kick_drain();
+}
+
+static int write_all(const char *buf, size_t len) {
+    while (len) {
+        ssize_t w = write(log_fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            perror("log write");
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+/* Copy every ring's pending events into buf, writing whenever it fills.
+   Returns the number of events drained. */
+static size_t drain_rings(char *buf, size_t *used) {
+    size_t total = 0;
+    pthread_mutex_lock(&reg_mutex);
+    log_ring *list = rings;
+    pthread_mutex_unlock(&reg_mutex);
+
+    /* rings are only unlinked by this thread, so the list is stable */
+    for (log_ring *r = list; r; r = r->next) {
+        uint64_t tail = r->tail;
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            if (*used + sizeof(log_record) > LOG_WRITE_BUF) {
+                write_all(buf, *used);
+                *used = 0;
+            }
+            memcpy(buf + *used, &r->ev[tail & (LOG_RING_EVENTS - 1)], sizeof(log_record));
+            *used += sizeof(log_record);
+            tail++;
+            total++;
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+    return total;
+}
+
+/* move drained rings of exited threads to the spare list */
+static void recycle_rings(void) {
+    pthread_mutex_lock(&reg_mutex);
+    log_ring **link = &rings;
+    while (*link) {
+        log_ring *r = *link;
+        if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE) &&
+            r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+            *link = r->next;
+            r->next = spare_rings;
+            spare_rings = r;
+        } else {
+            link = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&reg_mutex);
+}
+
+static void *drain_main(void *arg) {
+    (void)arg;
+    char *buf = malloc(LOG_WRITE_BUF);
+    if (!buf) {
+        perror("log buffer");
+        return NULL;
+    }
+    for (;;) {
+        pthread_mutex_lock(&reg_mutex);
+        if (!drain_kicked && !drain_stop) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_DRAIN_INTERVAL_MS * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&drain_cv, &reg_mutex, &ts);
+        }
+        drain_kicked = 0;
+        int stop = drain_stop;
+        pthread_mutex_unlock(&reg_mutex);
+
+        size_t used = 0;
+        size_t n = drain_rings(buf, &used);
+        if (used) write_all(buf, used);
+        recycle_rings();
+        if (stop && n == 0) break;
+    }
+    free(buf);
+    return NULL;
+}
+
+int log_open(const char *path) {
+    pthread_once(&ring_key_once, make_ring_key);
+    log_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (log_fd < 0) return -1;
+    log_file_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+    hdr.record_size = sizeof(log_record);
+    if (write_all((const char *)&hdr, sizeof(hdr)) != 0) {
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+    drain_stop = 0;
+    if (pthread_create(&drain_tid, NULL, drain_main, NULL) != 0) {
+        close(log_fd);
+        log_fd = -1;
+        return -1;
+    }
+    __atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void log_close(void) {
+    if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&reg_mutex);
+    drain_stop = 1;
+    pthread_cond_signal(&drain_cv);
+    pthread_mutex_unlock(&reg_mutex);
+    pthread_join(drain_tid, NULL);
+    close(log_fd);
+    log_fd = -1;
+}
+
+void log_set_level(log_level level) {
+    __atomic_store_n(&cur_level, level, __ATOMIC_RELAXED);
+}
+
+int log_parse_level(const char *s, log_level *out) {
+    if (strcasecmp(s, "off") == 0) *out = LOG_OFF;
+    else if (strcasecmp(s, "ops") == 0) *out = LOG_OPS;
+    else if (strcasecmp(s, "trace") == 0) *out = LOG_TRACE;
+    else return -1;
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdint.h>
+
+/* Asynchronous binary event log.
+   Each thread appends fixed-size events to its own lock-free ring; a
+   background drain thread batch-writes the rings to the log file.  The file
+   is binary: chash-logdump turns it back into the text trace. */
+
+typedef enum {
+    EV_WAITING,             /* WAITING FOR MY TURN */
+    EV_AWAKENED,            /* AWAKENED FOR WORK */
+    EV_INSERT,              /* hash, name, value = salary */
+    EV_DELETE,              /* hash, name */
+    EV_UPDATE,              /* hash, name, value = salary */
+    EV_SEARCH,              /* hash, name */
+    EV_PRINT,
+    EV_READ_LOCK_ATTEMPT,
+    EV_READ_LOCK_ACQUIRED,
+    EV_READ_LOCK_RELEASED,
+    EV_WRITE_LOCK_ATTEMPT,
+    EV_WRITE_LOCK_ACQUIRED,
+    EV_WRITE_LOCK_RELEASED,
+    EV_RESIZE_START,        /* hash = old bucket count, value = new count */
+    EV_RESIZE_DONE,         /* value = bucket count */
+    EV_SNAPSHOT,            /* name = path */
+    EV_LOAD,                /* name = path */
+    EV_UPSERT,              /* hash, name, value = salary */
+    EV_ADD,                 /* hash, name, value = delta (as int32_t) */
+    EV_CAS,                 /* hash, name, value = new salary */
+    EV_RANGE,               /* hash = lowest salary, value = highest */
+    EV_EVICT,               /* hash, name */
+    EV_COUNT
+} log_event_type;
+
+/* LOG_OPS drops the lock events; LOG_OFF drops everything */
+typedef enum {
+    LOG_OFF,
+    LOG_OPS,
+    LOG_TRACE
+} log_level;
+
+#define LOG_MAGIC "CHLOGv1"
+#define LOG_NAME_MAX 56
+
+/* on-disk header, followed by log_record entries */
+typedef struct {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+} log_file_header;
+
+typedef struct {
+    int64_t ts_us;
+    int32_t thread;         /* command priority, -1 for the main thread */
+    uint16_t type;          /* log_event_type */
+    uint16_t reserved;
+    uint32_t hash;
+    uint32_t value;
+    char name[LOG_NAME_MAX];    /* NUL-terminated, truncated if longer */
+} log_record;
+
+/* Opens (truncates) the log file and starts the drain thread; until then
+   log_event() is a no-op.  Returns 0 or -1. */
+int log_open(const char *path);
+/* drains everything still buffered and stops the drain thread */
+void log_close(void);
+
+void log_set_level(log_level level);
+/* parses "off", "ops" or "trace"; returns -1 if unknown */
+int log_parse_level(const char *s, log_level *out);
+
+void log_event(log_event_type type, int thread, uint32_t hash, const char *name, uint32_t value);
+/* nonzero if log_event(type, ...) would record anything, so callers can
+   skip computing arguments only the log needs */
+int log_enabled(log_event_type type);
+
+#endif /* LOGGER_H */
@@ -0,0 +1,389 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "salary_index.h"
+#include "hash_table.h"
+#include "ht_backend.h"
+#include "cache.h"
+#include "snapshot.h"
+
+/* entries per block */
+#define SIDX_BLOCK 64
+
+/* The record an entry stands for, beyond the salary and hash the entry
+   holds itself. */
+typedef struct {
+    uint64_t key;
+    uint16_t len;
+    char name[];                /* len bytes and a NUL */
+} sidx_rec;
+
+/* 16 bytes: a search compares salary and hash in place and only follows
+   rec to compare names when both are equal */
+typedef struct {
+    uint32_t salary;
+    uint32_t hash;
+    sidx_rec *rec;
+} sidx_entry;
+
+typedef struct {
+    uint32_t n;
+    sidx_entry e[SIDX_BLOCK];   /* sorted */
+} sidx_block;
+
+/* A stripe is a sorted run of blocks.  Each block's first entry is
+   copied into first[], so finding the block for an entry is a binary
+   search of one array. */
+typedef struct {
+    pthread_rwlock_t lock;
+    sidx_block **blocks;
+    sidx_entry *first;
+    size_t nblocks, cap;
+} __attribute__((aligned(64))) sidx_stripe;
+
+/* what a search looks for */
+typedef struct {
+    uint32_t salary;
+    uint32_t hash;
+    const char *name;
+    size_t len;
+} sidx_key;
+
+static sidx_stripe stripes[HT_NUM_STRIPES];
+static unsigned stripe_bits;    /* log2(HT_NUM_STRIPES) */
+static uint64_t total_count;
+static uint64_t total_sum;
+
+/* the stripe the table keeps key under (top bits, as in every backend) */
+static inline sidx_stripe *stripe_of(uint64_t key) {
+    return &stripes[stripe_bits == 0 ? 0 : (size_t)(key >> (64 - stripe_bits))];
+}
+
+/* salary, then print order: displayed hash, then name */
+static int cmp_entry(const sidx_entry *e, const sidx_key *k) {
+    if (e->salary != k->salary) return e->salary < k->salary ? -1 : 1;
+    if (e->hash != k->hash) return e->hash < k->hash ? -1 : 1;
+    int c = memcmp(e->rec->name, k->name, e->rec->len < k->len ? e->rec->len : k->len);
+    if (c != 0) return c;
+    return e->rec->len < k->len ? -1 : e->rec->len > k->len;
+}
+
+/* first of e[0..n) not ordered before k */
+static size_t lower_bound(const sidx_entry *e, size_t n, const sidx_key *k) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cmp_entry(&e[mid], k) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* the block k belongs in: the last one starting at or before it */
+static size_t block_for(const sidx_stripe *s, const sidx_key *k) {
+    size_t i = lower_bound(s->first, s->nblocks, k);
+    if (i < s->nblocks && cmp_entry(&s->first[i], k) == 0) return i;
+    return i > 0 ? i - 1 : 0;
+}
+
+/* puts a new, empty block at index i; -1 if out of memory */
+static int add_block(sidx_stripe *s, size_t i) {
+    if (s->nblocks == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 8;
+        sidx_block **blocks = realloc(s->blocks, sizeof(*blocks) * cap);
+        if (!blocks) return -1;
+        s->blocks = blocks;
+        sidx_entry *first = realloc(s->first, sizeof(*first) * cap);
+        if (!first) return -1;
+        s->first = first;
+        cache_charge((int64_t)((cap - s->cap) * (sizeof(*blocks) + sizeof(*first))));
+        s->cap = cap;
+    }
+    sidx_block *b = malloc(sizeof(*b));
+    if (!b) return -1;
+    cache_charge(sizeof(*b));
+    b->n = 0;
+    memmove(&s->blocks[i + 1], &s->blocks[i], sizeof(*s->blocks) * (s->nblocks - i));
+    memmove(&s->first[i + 1], &s->first[i], sizeof(*s->first) * (s->nblocks - i));
+    s->blocks[i] = b;
+    s->nblocks++;
+    return 0;
+}
+
+static void drop_block(sidx_stripe *s, size_t i) {
+    cache_charge(-(int64_t)sizeof(sidx_block));
+    free(s->blocks[i]);
+    s->nblocks--;
+    memmove(&s->blocks[i], &s->blocks[i + 1], sizeof(*s->blocks) * (s->nblocks - i));
+    memmove(&s->first[i], &s->first[i + 1], sizeof(*s->first) * (s->nblocks - i));
+}
+
+/* 0, or -1 if a full block had to be split and there was no memory */
+static int insert_entry(sidx_stripe *s, const sidx_key *k, sidx_rec *rec) {
+    if (s->nblocks == 0 && add_block(s, 0) != 0) return -1;
+    size_t bi = block_for(s, k);
+    sidx_block *b = s->blocks[bi];
+    if (b->n == SIDX_BLOCK) {
+        /* the upper half moves to a new block after this one */
+        if (add_block(s, bi + 1) != 0) return -1;
+        sidx_block *upper = s->blocks[bi + 1];
+        upper->n = SIDX_BLOCK / 2;
+        b->n = SIDX_BLOCK - upper->n;
+        memcpy(upper->e, &b->e[b->n], sizeof(sidx_entry) * upper->n);
+        s->first[bi + 1] = upper->e[0];
+        if (cmp_entry(&upper->e[0], k) < 0) {
+            bi++;
+            b = upper;
+        }
+    }
+    size_t pos = lower_bound(b->e, b->n, k);
+    memmove(&b->e[pos + 1], &b->e[pos], sizeof(sidx_entry) * (b->n - pos));
+    b->e[pos] = (sidx_entry){ k->salary, k->hash, rec };
+    b->n++;
+    if (pos == 0) s->first[bi] = b->e[0];
+    return 0;
+}
+
+/* takes k's entry out; its record, or NULL if the entry is not there */
+static sidx_rec *remove_entry(sidx_stripe *s, const sidx_key *k) {
+    if (s->nblocks == 0) return NULL;
+    size_t bi = block_for(s, k);
+    sidx_block *b = s->blocks[bi];
+    size_t pos = lower_bound(b->e, b->n, k);
+    if (pos == b->n || cmp_entry(&b->e[pos], k) != 0) return NULL;
+    sidx_rec *rec = b->e[pos].rec;
+    b->n--;
+    memmove(&b->e[pos], &b->e[pos + 1], sizeof(sidx_entry) * (b->n - pos));
+    if (b->n == 0) drop_block(s, bi);
+    else if (pos == 0) s->first[bi] = b->e[0];
+    return rec;
+}
+
+void sidx_init(void) {
+    unsigned bits = 0;
+    while ((1u << bits) < HT_NUM_STRIPES) bits++;
+    stripe_bits = bits;
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) {
+        pthread_rwlock_init(&stripes[i].lock, NULL);
+        stripes[i].blocks = NULL;
+        stripes[i].first = NULL;
+        stripes[i].nblocks = stripes[i].cap = 0;
+    }
+    total_count = total_sum = 0;
+}
+
+static void rec_free(sidx_rec *rec) {
+    cache_charge(-(int64_t)(sizeof(*rec) + rec->len + 1));
+    free(rec);
+}
+
+void sidx_clear(void) {
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) {
+        sidx_stripe *s = &stripes[i];
+        for (size_t j = 0; j < s->nblocks; ++j) {
+            for (size_t k = 0; k < s->blocks[j]->n; ++k) rec_free(s->blocks[j]->e[k].rec);
+            cache_charge(-(int64_t)sizeof(sidx_block));
+            free(s->blocks[j]);
+        }
+        s->nblocks = 0;
+    }
+    total_count = total_sum = 0;
+}
+
+void sidx_destroy(void) {
+    sidx_clear();
+    for (int i = 0; i < HT_NUM_STRIPES; ++i) {
+        cache_charge(-(int64_t)(stripes[i].cap * (sizeof(sidx_block *) + sizeof(sidx_entry))));
+        free(stripes[i].blocks);
+        free(stripes[i].first);
+        pthread_rwlock_destroy(&stripes[i].lock);
+    }
+}
+
+int sidx_add(uint64_t key, const char *name, size_t len, uint32_t hash, uint32_t salary) {
+    sidx_rec *rec = malloc(sizeof(*rec) + len + 1);
+    if (!rec) return -1;
+    cache_charge((int64_t)(sizeof(*rec) + len + 1));
+    rec->key = key;
+    rec->len = (uint16_t)len;
+    memcpy(rec->name, name, len);
+    rec->name[len] = '\0';
+
+    sidx_key k = { salary, hash, name, len };
+    sidx_stripe *s = stripe_of(key);
+    pthread_rwlock_wrlock(&s->lock);
+    int rc = insert_entry(s, &k, rec);
+    pthread_rwlock_unlock(&s->lock);
+    if (rc != 0) {
+        rec_free(rec);
+        return -1;
+    }
+    __atomic_fetch_add(&total_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total_sum, salary, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void sidx_remove(uint64_t key, const char *name, size_t len, uint32_t hash, uint32_t salary) {
+    sidx_key k = { salary, hash, name, len };
+    sidx_stripe *s = stripe_of(key);
+    pthread_rwlock_wrlock(&s->lock);
+    sidx_rec *rec = remove_entry(s, &k);
+    pthread_rwlock_unlock(&s->lock);
+    if (!rec) return;
+    rec_free(rec);
+    __atomic_fetch_sub(&total_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&total_sum, salary, __ATOMIC_RELAXED);
+}
+
+/* the entry moves to its new place; only a block split allocates */
+void sidx_change(uint64_t key, const char *name, size_t len, uint32_t hash, uint32_t old_salary,
+                 uint32_t new_salary) {
+    if (old_salary == new_salary) return;
+    sidx_key k = { old_salary, hash, name, len };
+    sidx_stripe *s = stripe_of(key);
+    pthread_rwlock_wrlock(&s->lock);
+    sidx_rec *rec = remove_entry(s, &k);
+    k.salary = new_salary;
+    if (rec && insert_entry(s, &k, rec) != 0) {
+        /* the entry is out and cannot go back: the index would no longer
+           match the table */
+        perror("sidx_change");
+        exit(1);
+    }
+    pthread_rwlock_unlock(&s->lock);
+    if (rec) __atomic_fetch_add(&total_sum, (uint64_t)new_salary - old_salary, __ATOMIC_RELAXED);
+}
+
+/* A base record still in the file's salary order gets an entry of its
+   own, the salary it moves to; *moved is set under the stripe lock, so a
+   range reader sees the record in exactly one of the two places. */
+void sidx_base_change(uint64_t key, const char *name, size_t len, uint32_t hash, uint32_t old_salary,
+                      uint32_t new_salary, uint8_t *moved) {
+    if (old_salary == new_salary) return;
+    sidx_rec *rec = malloc(sizeof(*rec) + len + 1);
+    if (!rec) {
+        perror("sidx_base_change");
+        exit(1);
+    }
+    cache_charge((int64_t)(sizeof(*rec) + len + 1));
+    rec->key = key;
+    rec->len = (uint16_t)len;
+    memcpy(rec->name, name, len);
+    rec->name[len] = '\0';
+
+    sidx_key k = { new_salary, hash, name, len };
+    sidx_stripe *s = stripe_of(key);
+    pthread_rwlock_wrlock(&s->lock);
+    if (insert_entry(s, &k, rec) != 0) {
+        perror("sidx_base_change");
+        exit(1);
+    }
+    *moved = 1;
+    pthread_rwlock_unlock(&s->lock);
+    __atomic_fetch_add(&total_sum, (uint64_t)new_salary - old_salary, __ATOMIC_RELAXED);
+}
+
+void sidx_base_remove(uint64_t key, uint32_t salary, uint8_t *moved) {
+    sidx_stripe *s = stripe_of(key);
+    pthread_rwlock_wrlock(&s->lock);
+    *moved = 1;
+    pthread_rwlock_unlock(&s->lock);
+    __atomic_fetch_sub(&total_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&total_sum, salary, __ATOMIC_RELAXED);
+}
+
+void sidx_base_totals(uint64_t count, uint64_t sum) {
+    __atomic_fetch_add(&total_count, count, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total_sum, sum, __ATOMIC_RELAXED);
+}
+
+static int cmp_rec(const hashRecord *a, const hashRecord *b) {
+    if (a->salary != b->salary) return a->salary < b->salary ? -1 : 1;
+    if (a->hash != b->hash) return a->hash < b->hash ? -1 : 1;
+    return strcmp(a->name, b->name);
+}
+
+/* a stripe's copied matches, from its blocks or from the snapshot base,
+   still to be merged: recs[pos, end) */
+typedef struct {
+    size_t pos, end;
+} sidx_run;
+
+static void sift_down(sidx_run *heap, size_t n, size_t i, const hashRecord *recs) {
+    for (;;) {
+        size_t least = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && cmp_rec(&recs[heap[l].pos], &recs[heap[least].pos]) < 0) least = l;
+        if (r < n && cmp_rec(&recs[heap[r].pos], &recs[heap[least].pos]) < 0) least = r;
+        if (least == i) return;
+        sidx_run t = heap[i];
+        heap[i] = heap[least];
+        heap[least] = t;
+        i = least;
+    }
+}
+
+/* appends the stripe's entries with lo <= salary <= hi to b, in order;
+   caller holds the stripe.  0, or -1 if out of memory. */
+static int copy_range(const sidx_stripe *s, uint32_t lo, uint32_t hi, ht_recbuf *b) {
+    /* the first block starting at lo or above; the one before it may
+       already hold entries from lo */
+    size_t bi = 0, end = s->nblocks;
+    while (bi < end) {
+        size_t mid = bi + (end - bi) / 2;
+        if (s->first[mid].salary < lo) bi = mid + 1;
+        else end = mid;
+    }
+    if (bi > 0) bi--;
+    for (; bi < s->nblocks; ++bi) {
+        const sidx_block *blk = s->blocks[bi];
+        for (size_t i = 0; i < blk->n; ++i) {
+            const sidx_entry *e = &blk->e[i];
+            if (e->salary < lo) continue;
+            if (e->salary > hi) return 0;
+            hashRecord *r = recbuf_push(b, e->rec->name, e->rec->len);
+            if (!r) return -1;
+            r->hash = e->hash;
+            r->salary = e->salary;
+            r->key = e->rec->key;
+        }
+    }
+    return 0;
+}
+
+long sidx_range(uint32_t lo, uint32_t hi, void (*fn)(const hashRecord *r, void *ctx), void *ctx) {
+    ht_recbuf b = { 0 };
+    sidx_run *heap = malloc(sizeof(sidx_run) * 2 * HT_NUM_STRIPES);
+    size_t nruns = 0;
+    int ok = heap != NULL;
+
+    for (int i = 0; ok && i < HT_NUM_STRIPES; ++i) {
+        size_t start = b.n;
+        pthread_rwlock_rdlock(&stripes[i].lock);
+        ok = copy_range(&stripes[i], lo, hi, &b) == 0;
+        size_t mid = b.n;
+        ok = ok && base_salary_range((size_t)i, lo, hi, &b) == 0;
+        pthread_rwlock_unlock(&stripes[i].lock);
+        if (mid > start) heap[nruns++] = (sidx_run){ start, mid };
+        if (b.n > mid) heap[nruns++] = (sidx_run){ mid, b.n };
+    }
+
+    /* merge the stripes' runs */
+    if (ok) {
+        for (size_t i = nruns; i-- > 0;) sift_down(heap, nruns, i, b.recs);
+        while (nruns > 0) {
+            fn(&b.recs[heap[0].pos], ctx);
+            if (++heap[0].pos == heap[0].end) heap[0] = heap[--nruns];
+            sift_down(heap, nruns, 0, b.recs);
+        }
+    }
+    long n = ok ? (long)b.n : -1;
+    free(heap);
+    recbuf_free(&b);
+    return n;
+}
+
+void sidx_totals(uint64_t *count, uint64_t *sum) {
+    *count = __atomic_load_n(&total_count, __ATOMIC_RELAXED);
+    *sum = __atomic_load_n(&total_sum, __ATOMIC_RELAXED);
+}
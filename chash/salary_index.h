@@ -0,0 +1,59 @@
+#ifndef SALARY_INDEX_H
+#define SALARY_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "chash.h"
+
+/* Secondary index on salary, with running totals.
+   Records are kept in salary order, ties in print order (displayed
+   hash, then name), in one sorted array per table stripe, under a
+   rwlock of its own.  The array is cut into blocks of a few dozen
+   entries, found by a binary search of the blocks' first entries.
+   A record's stripe comes from the top bits of its key in every
+   backend, so the changes to one stripe of the index are already
+   serialized by the table stripe the writer holds; the index lock only
+   orders them against range readers.  A range query holds each
+   stripe's lock in turn while it copies that stripe's matches, then
+   merges the copies after every lock is released.
+
+   The records of a loaded snapshot are served from the file's own salary
+   order (snapshot.h) as an extra run per stripe, until they are deleted
+   or re-salaried; the sidx_base_* calls below take them out of it.
+
+   The backends (and the snapshot base) call the update functions below
+   while they hold the record's table stripe for writing, for every
+   record they store, drop or re-salary, so the index always holds
+   exactly the table's records. */
+
+void sidx_init(void);
+void sidx_destroy(void);
+/* drops every entry */
+void sidx_clear(void);
+
+/* 0, or -1 if out of memory (nothing added) */
+int sidx_add(uint64_t key, const char *name, size_t len, uint32_t hash, uint32_t salary);
+void sidx_remove(uint64_t key, const char *name, size_t len, uint32_t hash, uint32_t salary);
+/* exits if a block must be split and there is no memory for it */
+void sidx_change(uint64_t key, const char *name, size_t len, uint32_t hash, uint32_t old_salary,
+                 uint32_t new_salary);
+
+/* For a base record still in the snapshot's salary order, with *moved
+   its moved byte: change gives it an entry of its own at new_salary
+   (exiting if there is no memory), remove just drops it; both set
+   *moved.  totals adds the records the snapshot's order holds. */
+void sidx_base_change(uint64_t key, const char *name, size_t len, uint32_t hash, uint32_t old_salary,
+                      uint32_t new_salary, uint8_t *moved);
+void sidx_base_remove(uint64_t key, uint32_t salary, uint8_t *moved);
+void sidx_base_totals(uint64_t count, uint64_t sum);
+
+/* Calls fn for every record with lo <= salary <= hi, in index order,
+   with no lock held; the records' names are valid for the
+   call only.  Each record comes back once, as it was when its stripe was
+   copied.  Returns the number of records, or -1 if out of memory. */
+long sidx_range(uint32_t lo, uint32_t hi, void (*fn)(const hashRecord *r, void *ctx), void *ctx);
+
+/* record count and salary sum, kept up to date by every change */
+void sidx_totals(uint64_t *count, uint64_t *sum);
+
+#endif /* SALARY_INDEX_H */
@@ -0,0 +1,371 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "server.h"
+#include "console.h"
+#include "ingest.h"
+
+#define SERVER_READ (64 * 1024)         /* bytes asked for per read */
+#define SERVER_EVENTS 64
+
+typedef struct conn {
+    int fd;
+    uint32_t events;            /* as registered with epoll */
+    int eof;                    /* the client has closed its side */
+    int more;                   /* lines left to run once answers drain */
+    char *in;                   /* received, not yet run */
+    size_t in_len, in_cap;
+    char *out;                  /* answers not yet sent: [out_off, out_len) */
+    size_t out_off, out_len, out_cap;
+    struct conn *prev, *next;   /* the loop's connections */
+} conn;
+
+typedef struct {
+    pthread_t tid;
+    int ep;
+    pthread_mutex_t mu;         /* guards conns, which the accepting loop adds to */
+    conn *conns;
+} srv_loop;
+
+static int listen_fd = -1;
+static int stop_fd = -1;        /* eventfd, readable once the server stops */
+static server_exec_fn exec_cmd;
+/* load replaces the whole table, so it runs alone; every other command
+   runs holding this for reading */
+static pthread_rwlock_t load_lock;
+/* two snapshots to one path would share its temporary file */
+static pthread_mutex_t snap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long n_conns, n_cmds;
+static srv_loop *loops;
+static int nloops;              /* running loops, set as each starts */
+
+/* epoll data of the two descriptors every loop shares */
+static char listen_tag, stop_tag;
+
+/* room for need bytes in *buf; 0 or -1 if out of memory */
+static int reserve(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) return 0;
+    size_t n = *cap ? *cap : SERVER_READ;
+    while (n < need) n *= 2;
+    char *grown = realloc(*buf, n);
+    if (!grown) return -1;
+    *buf = grown;
+    *cap = n;
+    return 0;
+}
+
+/* Sends what it can of [buf, buf + len) without blocking; returns the
+   bytes sent, or -1 if the connection is gone. */
+static ssize_t send_some(int fd, const char *buf, size_t len) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t w = send(fd, buf + sent, len - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        sent += (size_t)w;
+    }
+    return (ssize_t)sent;
+}
+
+static int conn_flush(conn *c) {
+    if (c->out_off == c->out_len) return 0;
+    ssize_t w = send_some(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+    if (w < 0) return -1;
+    c->out_off += (size_t)w;
+    if (c->out_off == c->out_len) c->out_off = c->out_len = 0;
+    return 0;
+}
+
+/* Queues the answers; when nothing is waiting ahead of them they are sent
+   straight from the console buffer and only what the socket didn't take
+   is copied. */
+static int conn_answer(conn *c, const char *text, size_t len) {
+    if (c->out_off == c->out_len) {
+        ssize_t w = send_some(c->fd, text, len);
+        if (w < 0) return -1;
+        text += w;
+        len -= (size_t)w;
+        if (len == 0) return 0;
+    } else if (c->out_off > 0) {
+        memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+        c->out_len -= c->out_off;
+        c->out_off = 0;
+    }
+    if (reserve(&c->out, &c->out_cap, c->out_len + len) != 0) return -1;
+    memcpy(c->out + c->out_len, text, len);
+    c->out_len += len;
+    return 0;
+}
+
+/* Runs the complete lines of c's input, and at end of input a last line
+   without a newline, then answers them together; 0, or -1 to drop c.
+   Stops early, setting c->more, once SERVER_OUT_MAX bytes of answers are
+   pending, so a burst of prints can't pile up without bound. */
+static int run_lines(conn *c) {
+    char *p = c->in, *end = c->in + c->in_len;
+    unsigned long ran = 0;
+    c->more = 0;
+    pthread_rwlock_rdlock(&load_lock);
+    while (p < end) {
+        if (console_pending() >= SERVER_OUT_MAX) {
+            c->more = 1;
+            break;
+        }
+        char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl && !c->eof) break;
+        char *eol = nl ? nl : end;
+        command_t cmd;
+        int rc = cmd_parse_line(p, eol, &cmd);
+        if (rc < 0) {
+            console_printf("Error: unparsable command\n\n");
+        } else if (rc == 0) {
+            if (cmd.type == CMD_LOAD) {
+                pthread_rwlock_unlock(&load_lock);
+                pthread_rwlock_wrlock(&load_lock);
+                exec_cmd(&cmd);
+                pthread_rwlock_unlock(&load_lock);
+                pthread_rwlock_rdlock(&load_lock);
+            } else if (cmd.type == CMD_SNAPSHOT) {
+                pthread_mutex_lock(&snap_mutex);
+                exec_cmd(&cmd);
+                pthread_mutex_unlock(&snap_mutex);
+            } else {
+                exec_cmd(&cmd);
+            }
+            console_write("\n", 1);
+            ran++;
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+    pthread_rwlock_unlock(&load_lock);
+    __atomic_fetch_add(&n_cmds, ran, __ATOMIC_RELAXED);
+
+    c->in_len = (size_t)(end - p);
+    memmove(c->in, p, c->in_len);
+    if (!c->more && c->in_len > SERVER_LINE_MAX) return -1;
+    const char *text;
+    size_t len = console_take(&text);
+    return len ? conn_answer(c, text, len) : 0;
+}
+
+static int conn_read(conn *c) {
+    if (reserve(&c->in, &c->in_cap, c->in_len + SERVER_READ) != 0) return -1;
+    ssize_t r = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+    if (r < 0) return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    if (r == 0) c->eof = 1;
+    c->in_len += (size_t)r;
+    return run_lines(c);
+}
+
+/* Registers the events c now waits for: input unless the client closed
+   its side, lines are left to run or too many answers are waiting, output
+   while any are.
+   Returns -1 once c has nothing left to do. */
+static int conn_update(srv_loop *l, conn *c) {
+    size_t pending = c->out_len - c->out_off;
+    uint32_t want = 0;
+    if (!c->eof && !c->more && pending < SERVER_OUT_MAX) want |= EPOLLIN;
+    if (pending) want |= EPOLLOUT;
+    if (!want) return -1;
+    if (want != c->events) {
+        struct epoll_event ev = { .events = want, .data.ptr = c };
+        if (epoll_ctl(l->ep, EPOLL_CTL_MOD, c->fd, &ev) != 0) return -1;
+        c->events = want;
+    }
+    return 0;
+}
+
+static void conn_unlink(srv_loop *l, conn *c) {
+    pthread_mutex_lock(&l->mu);
+    if (c->prev) c->prev->next = c->next;
+    else l->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    pthread_mutex_unlock(&l->mu);
+}
+
+static void conn_close(srv_loop *l, conn *c) {
+    close(c->fd);
+    conn_unlink(l, c);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+/* Deals the connections round-robin: left to the listening socket's
+   wakeups they pile up on whichever loop is woken most.  The loop that
+   gets a connection serves it to the end. */
+static void accept_one(void) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+            perror("accept");
+        return;
+    }
+    unsigned long k = __atomic_fetch_add(&n_conns, 1, __ATOMIC_RELAXED);
+    srv_loop *l = &loops[k % (unsigned long)__atomic_load_n(&nloops, __ATOMIC_ACQUIRE)];
+    conn *c = calloc(1, sizeof(*c));
+    if (!c) {
+        perror("accept");
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+    c->events = EPOLLIN;
+    /* listed first: its loop may serve and close it as soon as it is added */
+    pthread_mutex_lock(&l->mu);
+    c->next = l->conns;
+    if (l->conns) l->conns->prev = c;
+    l->conns = c;
+    pthread_mutex_unlock(&l->mu);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    if (epoll_ctl(l->ep, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        perror("accept");
+        conn_unlink(l, c);
+        free(c);
+        close(fd);
+    }
+}
+
+static void *loop_main(void *arg) {
+    srv_loop *l = arg;
+    struct epoll_event evs[SERVER_EVENTS];
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(l->ep, evs, SERVER_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            void *tag = evs[i].data.ptr;
+            if (tag == &stop_tag) {
+                running = 0;
+            } else if (tag == &listen_tag) {
+                accept_one();
+            } else {
+                conn *c = tag;
+                int rc = conn_flush(c);
+                while (rc == 0 && c->more && c->out_len - c->out_off < SERVER_OUT_MAX) rc = run_lines(c);
+                if (rc == 0 && !c->more && (c->events & EPOLLIN) &&
+                    (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    rc = conn_read(c);
+                if (rc != 0 || conn_update(l, c) != 0) conn_close(l, c);
+            }
+        }
+    }
+    console_thread_exit();
+    return NULL;
+}
+
+int server_run(const char *path, int nthreads, server_exec_fn exec) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    /* a socket file is left behind by a server that was killed */
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) return -1;
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0 ||
+        (stop_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        int saved = errno;
+        close(listen_fd);
+        listen_fd = -1;
+        errno = saved;
+        return -1;
+    }
+
+    /* the loops inherit the blocked signals; this thread waits for them */
+    sigset_t sigs, old;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, &old);
+
+    /* prefer a waiting load, or a steady stream of commands could keep it
+       waiting forever */
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&load_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    exec_cmd = exec;
+    n_conns = n_cmds = 0;
+
+    loops = calloc((size_t)nthreads, sizeof(srv_loop));
+    nloops = 0;
+    int started = 0, err = loops ? 0 : ENOMEM;
+    while (loops && started < nthreads) {
+        srv_loop *l = &loops[started];
+        struct epoll_event lev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &listen_tag };
+        struct epoll_event sev = { .events = EPOLLIN, .data.ptr = &stop_tag };
+        pthread_mutex_init(&l->mu, NULL);
+        l->ep = epoll_create1(EPOLL_CLOEXEC);
+        if (l->ep < 0 || epoll_ctl(l->ep, EPOLL_CTL_ADD, stop_fd, &sev) != 0) {
+            err = errno;
+        } else {
+            err = pthread_create(&l->tid, NULL, loop_main, l);
+        }
+        if (err) {
+            if (l->ep >= 0) close(l->ep);
+            pthread_mutex_destroy(&l->mu);
+            break;
+        }
+        /* only a running loop may be dealt connections */
+        __atomic_store_n(&nloops, ++started, __ATOMIC_RELEASE);
+        if (epoll_ctl(l->ep, EPOLL_CTL_ADD, listen_fd, &lev) != 0) perror("server");
+    }
+
+    if (started > 0) {
+        if (started < nthreads) {
+            errno = err;
+            perror("server");
+        }
+        fprintf(stderr, "Listening on %s with %d threads\n", path, started);
+        int sig;
+        sigwait(&sigs, &sig);
+        uint64_t one = 1;
+        if (write(stop_fd, &one, sizeof(one)) != sizeof(one)) perror("server");
+        for (int i = 0; i < started; ++i) pthread_join(loops[i].tid, NULL);
+        /* once every loop is out no connection can be dealt any more; the
+           answers still unsent are dropped */
+        for (int i = 0; i < started; ++i) {
+            while (loops[i].conns) conn_close(&loops[i], loops[i].conns);
+            close(loops[i].ep);
+            pthread_mutex_destroy(&loops[i].mu);
+        }
+        fprintf(stderr, "Served %lu commands on %lu connections\n", n_cmds, n_conns);
+    }
+
+    free(loops);
+    loops = NULL;
+    pthread_rwlock_destroy(&load_lock);
+    close(stop_fd);
+    close(listen_fd);
+    stop_fd = listen_fd = -1;
+    unlink(path);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (started == 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "chash.h"
+
+/* Socket server (-s).
+   The table stays resident and clients send it command lines, in the
+   commands.txt format, over a Unix domain stream socket.  Each command is
+   answered with the console text a batch run prints for it followed by an
+   empty line, in the order the commands arrived, so a client may send
+   any number of commands before reading their answers.  An unparsable
+   line is answered "Error: unparsable command"; a blank line or a
+   'threads' header gets no answer.
+
+   Each of the server threads runs its own epoll loop, takes connections
+   from the shared listening socket and serves them to the end: the
+   commands one read brings in are run back to back and their answers go
+   out in a single write.  A client that stops reading its answers stops
+   being read from once SERVER_OUT_MAX bytes of them are waiting. */
+
+#define SERVER_OUT_MAX (4 << 20)
+#define SERVER_LINE_MAX (1 << 20)       /* longer lines drop the connection */
+
+/* Runs one command, leaving its text pending in the calling thread's
+   console buffer (console.h). */
+typedef void (*server_exec_fn)(const command_t *c);
+
+/* Listens on path, replacing a socket file left there by an earlier run,
+   and serves with nthreads threads until SIGINT or SIGTERM.  Returns 0,
+   or -1 with errno set if the socket could not be set up. */
+int server_run(const char *path, int nthreads, server_exec_fn exec);
+
+#endif /* SERVER_H */
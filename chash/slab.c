@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <pthread.h>
+#include "slab.h"
+
+/* A free object's first word links it to the next object in its batch;
+   the first object of a batch in the depot also records the batch length
+   and links to the next batch. */
+typedef struct free_obj {
+    struct free_obj *next;
+    struct free_obj *next_batch;
+    unsigned count;
+} free_obj;
+
+typedef struct slab {
+    struct slab *next;
+} slab;
+
+struct slab_pool {
+    int id;
+    size_t obj_size;
+    pthread_mutex_t mutex;      /* protects everything below */
+    free_obj *depot;            /* full batches returned by threads */
+    slab *slabs;                /* every slab, for slab_destroy */
+    char *carve;                /* unused tail of the newest slab */
+    char *carve_end;
+};
+
+/* per-thread cache of one pool; gen detects a pool id that was reused */
+typedef struct {
+    free_obj *free;
+    unsigned count;
+    unsigned long gen;
+} slab_cache;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static slab_pool *pools[SLAB_MAX_POOLS];
+static unsigned long pool_gen[SLAB_MAX_POOLS];
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+static __thread slab_cache caches[SLAB_MAX_POOLS];
+
+static void depot_push(slab_pool *pool, free_obj *batch, unsigned count) {
+    batch->count = count;
+    pthread_mutex_lock(&pool->mutex);
+    batch->next_batch = pool->depot;
+    pool->depot = batch;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/* hand a thread's cached objects back to the depots when it exits */
+static void flush_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&registry_mutex);
+    for (int i = 0; i < SLAB_MAX_POOLS; ++i) {
+        slab_cache *c = &caches[i];
+        if (pools[i] && c->free && c->gen == pool_gen[i]) depot_push(pools[i], c->free, c->count);
+        c->free = NULL;
+        c->count = 0;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static void make_exit_key(void) {
+    pthread_key_create(&exit_key, flush_thread);
+}
+
+static slab_cache *cache_of(slab_pool *pool) {
+    slab_cache *c = &caches[pool->id];
+    unsigned long gen = __atomic_load_n(&pool_gen[pool->id], __ATOMIC_RELAXED);
+    if (c->gen != gen) {
+        /* first use by this thread, or a stale cache from a destroyed pool */
+        c->free = NULL;
+        c->count = 0;
+        c->gen = gen;
+        pthread_setspecific(exit_key, caches);
+    }
+    return c;
+}
+
+slab_pool *slab_create(size_t obj_size) {
+    pthread_once(&exit_once, make_exit_key);
+    slab_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    if (obj_size < sizeof(free_obj)) obj_size = sizeof(free_obj);
+    pool->obj_size = (obj_size + 15) & ~(size_t)15;
+    pthread_mutex_init(&pool->mutex, NULL);
+
+    pthread_mutex_lock(&registry_mutex);
+    pool->id = -1;
+    for (int i = 0; i < SLAB_MAX_POOLS; ++i) {
+        if (!pools[i]) {
+            pool->id = i;
+            pools[i] = pool;
+            __atomic_fetch_add(&pool_gen[i], 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if (pool->id < 0) {
+        pthread_mutex_destroy(&pool->mutex);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void slab_destroy(slab_pool *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&registry_mutex);
+    pools[pool->id] = NULL;
+    __atomic_fetch_add(&pool_gen[pool->id], 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&registry_mutex);
+    slab *s = pool->slabs;
+    while (s) {
+        slab *next = s->next;
+        free(s);
+        s = next;
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+/* Refill an empty cache: take a batch from the depot, or carve a fresh
+   batch from the current slab (allocating a new slab when it runs out). */
+static int refill(slab_pool *pool, slab_cache *c) {
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->depot) {
+        c->free = pool->depot;
+        c->count = pool->depot->count;
+        pool->depot = pool->depot->next_batch;
+        pthread_mutex_unlock(&pool->mutex);
+        return 0;
+    }
+    for (unsigned n = 0; n < SLAB_BATCH; ++n) {
+        if (pool->carve + pool->obj_size > pool->carve_end) {
+            slab *s;
+            if (posix_memalign((void **)&s, 64, SLAB_BYTES) != 0) {
+                pthread_mutex_unlock(&pool->mutex);
+                return c->free ? 0 : -1;
+            }
+            s->next = pool->slabs;
+            pool->slabs = s;
+            /* the slab header takes the first line so objects stay aligned */
+            pool->carve = (char *)s + 64;
+            pool->carve_end = (char *)s + SLAB_BYTES;
+        }
+        free_obj *o = (free_obj *)pool->carve;
+        pool->carve += pool->obj_size;
+        o->next = c->free;
+        c->free = o;
+        c->count++;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+void *slab_alloc(slab_pool *pool) {
+    slab_cache *c = cache_of(pool);
+    if (!c->free && refill(pool, c) != 0) return NULL;
+    free_obj *o = c->free;
+    c->free = o->next;
+    c->count--;
+    return o;
+}
+
+void slab_free(slab_pool *pool, void *p) {
+    if (!p) return;
+    slab_cache *c = cache_of(pool);
+    free_obj *o = p;
+    o->next = c->free;
+    c->free = o;
+    if (++c->count >= 2 * SLAB_BATCH) {
+        /* keep one batch, give the other back */
+        free_obj *batch = c->free, *tail = batch;
+        for (unsigned n = 1; n < SLAB_BATCH; ++n) tail = tail->next;
+        c->free = tail->next;
+        tail->next = NULL;
+        c->count -= SLAB_BATCH;
+        depot_push(pool, batch, SLAB_BATCH);
+    }
+}
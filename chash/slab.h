@@ -0,0 +1,26 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/* Fixed-size object pools.
+   Objects are carved out of cache-line-aligned slabs.  Each thread keeps a
+   private free list per pool, so alloc/free normally touch no lock; only
+   batches of SLAB_BATCH objects move through the pool's shared depot.
+   Memory goes back to the system when the pool is destroyed. */
+
+#define SLAB_BYTES (64 * 1024)
+#define SLAB_BATCH 64
+#define SLAB_MAX_POOLS 16
+
+typedef struct slab_pool slab_pool;
+
+/* obj_size is rounded up to a multiple of 16 bytes (32 at least) */
+slab_pool *slab_create(size_t obj_size);
+/* frees every slab; no thread may use the pool afterwards */
+void slab_destroy(slab_pool *pool);
+
+void *slab_alloc(slab_pool *pool);
+void slab_free(slab_pool *pool, void *p);
+
+#endif /* SLAB_H */
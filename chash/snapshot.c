@@ -0,0 +1,484 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "ht_backend.h"
+#include "salary_index.h"
+#include "cache.h"
+
+/* records per index entry the writer aims for, and the largest index */
+#define SNAP_PER_INDEX 8
+#define SNAP_MAX_INDEX_BITS 24
+/* the most salary order runs a file may have */
+#define SNAP_MAX_ORDER_BITS 16
+/* bytes charged per live base record: the record, its salary order
+   entry, its reference byte and its moved byte */
+#define BASE_RECORD_BYTES (sizeof(snap_record) + sizeof(snap_order) + 2)
+/* records converted and written at a time */
+#define SNAP_WRITE_BATCH 1024
+
+/* the loaded snapshot; set and cleared only while no operation runs */
+static struct {
+    void *map;
+    size_t len;
+    unsigned bits;
+    const uint64_t *index;
+    snap_record *recs;
+    const char *names;
+    uint64_t names_size;
+    uint64_t n;
+    size_t live;                /* records not deleted */
+    uint64_t wal_lsn;
+    uint8_t *refs;              /* CLOCK reference byte per record (cache.h) */
+    const snap_order *order;    /* salary order, NULL if the index can't use it */
+    const uint64_t *runs;       /* run s is order[runs[s], runs[s + 1]) */
+    uint8_t *moved;             /* per record: left the salary order (salary_index.h) */
+    uint64_t salary_sum;
+    uint64_t hand;              /* record the CLOCK hand stands at */
+    uint64_t charged;           /* bytes charged for the records not deleted */
+} base;
+
+static size_t align64(size_t v) {
+    return (v + 63) & ~(size_t)63;
+}
+
+static int cmp_key(const void *a, const void *b) {
+    uint64_t x = ((const hashRecord *)a)->key, y = ((const hashRecord *)b)->key;
+    return (x > y) - (x < y);
+}
+
+static inline size_t prefix_of(uint64_t key, unsigned bits) {
+    return bits == 0 ? 0 : (size_t)(key >> (64 - bits));
+}
+
+/* log2(HT_NUM_STRIPES): the runs of the salary order this build writes
+   and can use */
+static unsigned stripe_bits(void) {
+    unsigned bits = 0;
+    while ((1u << bits) < HT_NUM_STRIPES) bits++;
+    return bits;
+}
+
+/* the records being written, for cmp_order */
+static __thread const hashRecord *order_recs;
+
+/* the salary index's order: salary, then displayed hash, then name */
+static int cmp_order(const void *a, const void *b) {
+    const snap_order *x = a, *y = b;
+    if (x->salary != y->salary) return x->salary < y->salary ? -1 : 1;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    return strcmp(order_recs[x->rec].name, order_recs[y->rec].name);
+}
+
+/* pads f with len (< 64) zero bytes */
+static int write_pad(FILE *f, size_t len) {
+    static const char zeros[64];
+    return len == 0 || fwrite(zeros, len, 1, f) == 1;
+}
+
+static uint32_t header_crc(const snap_header *h, const uint64_t *index, const uint64_t *runs) {
+    snap_header tmp = *h;
+    tmp.header_crc = 0;
+    uint32_t crc = crc32c(0, &tmp, sizeof(tmp));
+    crc = crc32c(crc, index, (((size_t)1 << h->index_bits) + 1) * sizeof(uint64_t));
+    return crc32c(crc, runs, (((size_t)1 << h->order_bits) + 1) * sizeof(uint64_t));
+}
+
+int snap_write(const char *path, hashRecord *recs, size_t n, uint64_t wal_lsn) {
+    unsigned bits = 0;
+    while (((size_t)SNAP_PER_INDEX << bits) < n && bits < SNAP_MAX_INDEX_BITS) bits++;
+    size_t nindex = ((size_t)1 << bits) + 1;
+    unsigned order_bits = stripe_bits();
+    size_t nruns = ((size_t)1 << order_bits) + 1;
+
+    if (n) qsort(recs, n, sizeof(*recs), cmp_key);
+    uint64_t *index = calloc(nindex, sizeof(uint64_t));
+    uint64_t *runs = calloc(nruns, sizeof(uint64_t));
+    snap_order *order = calloc(n ? n : 1, sizeof(snap_order));
+    snap_record *buf = calloc(SNAP_WRITE_BATCH, sizeof(snap_record));
+    char *tmp = malloc(strlen(path) + 5);
+    if (!index || !runs || !order || !buf || !tmp) {
+        free(index);
+        free(runs);
+        free(order);
+        free(buf);
+        free(tmp);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (size_t i = 0; i < n; ++i) index[prefix_of(recs[i].key, bits) + 1]++;
+    for (size_t p = 1; p < nindex; ++p) index[p] += index[p - 1];
+
+    /* the records are in key order, so each stripe's run is a stretch of
+       them, sorted here on its own */
+    uint64_t salary_sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        runs[prefix_of(recs[i].key, order_bits) + 1]++;
+        order[i] = (snap_order){ recs[i].salary, recs[i].hash, i };
+        salary_sum += recs[i].salary;
+    }
+    for (size_t p = 1; p < nruns; ++p) runs[p] += runs[p - 1];
+    order_recs = recs;
+    for (size_t p = 0; p + 1 < nruns; ++p) {
+        size_t len = runs[p + 1] - runs[p];
+        if (len > 1) qsort(&order[runs[p]], len, sizeof(snap_order), cmp_order);
+    }
+
+    snap_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.version = SNAP_VERSION;
+    h.header_size = sizeof(snap_header);
+    h.record_size = sizeof(snap_record);
+    h.index_bits = bits;
+    h.key_check = key_hash(SNAP_MAGIC);
+    h.records = n;
+    h.index_offset = align64(sizeof(snap_header));
+    h.records_offset = align64(h.index_offset + nindex * sizeof(uint64_t));
+    h.names_offset = h.records_offset + n * sizeof(snap_record);
+    for (size_t i = 0; i < n; ++i) h.names_size += strlen(recs[i].name);
+    h.wal_lsn = wal_lsn;
+    h.order_offset = align64(h.names_offset + h.names_size);
+    h.salary_sum = salary_sum;
+    h.order_bits = order_bits;
+    h.file_size = h.order_offset + nruns * sizeof(uint64_t) + n * sizeof(snap_order);
+
+    /* header placeholder and index, then the records, the names and the
+       salary order, then the real header */
+    sprintf(tmp, "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    int ok = f != NULL &&
+             fwrite(&h, sizeof(h), 1, f) == 1 &&
+             write_pad(f, h.index_offset - sizeof(h)) &&
+             fwrite(index, sizeof(uint64_t), nindex, f) == nindex &&
+             write_pad(f, h.records_offset - h.index_offset - nindex * sizeof(uint64_t));
+    uint32_t crc = 0;
+    uint64_t name_offset = 0;
+    for (size_t i = 0; ok && i < n; i += SNAP_WRITE_BATCH) {
+        size_t m = n - i < SNAP_WRITE_BATCH ? n - i : SNAP_WRITE_BATCH;
+        for (size_t j = 0; j < m; ++j) {
+            const hashRecord *r = &recs[i + j];
+            snap_record *s = &buf[j];
+            s->key = r->key;
+            s->name_offset = name_offset;
+            s->hash = r->hash;
+            s->salary = r->salary;
+            s->name_len = (uint16_t)strlen(r->name);
+            name_offset += s->name_len;
+        }
+        crc = crc32c(crc, buf, m * sizeof(snap_record));
+        ok = fwrite(buf, sizeof(snap_record), m, f) == m;
+    }
+    for (size_t i = 0; ok && i < n; ++i) {
+        size_t len = strlen(recs[i].name);
+        crc = crc32c(crc, recs[i].name, len);
+        ok = len == 0 || fwrite(recs[i].name, len, 1, f) == 1;
+    }
+    ok = ok && write_pad(f, h.order_offset - h.names_offset - h.names_size) &&
+         fwrite(runs, sizeof(uint64_t), nruns, f) == nruns &&
+         (n == 0 || fwrite(order, sizeof(snap_order), n, f) == n);
+    if (ok) {
+        h.records_crc = crc32c(crc, order, n * sizeof(snap_order));
+        h.header_crc = header_crc(&h, index, runs);
+        ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fflush(f) == 0 && fsync(fileno(f)) == 0;
+    }
+    if (f && fclose(f) != 0) ok = 0;
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    int saved = errno;
+    if (!ok) unlink(tmp);
+    free(index);
+    free(runs);
+    free(order);
+    free(buf);
+    free(tmp);
+    errno = saved;
+    return ok ? 0 : -1;
+}
+
+/* Maps path privately and checks everything but the record CRC; 0 or -1
+   (errno EINVAL for a file that is not a usable snapshot). */
+static int map_snapshot(const char *path, int prot, void **map_out, size_t *len_out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len < sizeof(snap_header)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    void *map = mmap(NULL, len, prot, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const snap_header *h = map;
+    int ok = memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) == 0 &&
+             h->version == SNAP_VERSION &&
+             h->header_size == sizeof(snap_header) &&
+             h->record_size == sizeof(snap_record) &&
+             h->key_check == key_hash(SNAP_MAGIC) &&
+             h->file_size == len &&
+             h->index_bits <= SNAP_MAX_INDEX_BITS &&
+             h->order_bits <= SNAP_MAX_ORDER_BITS;
+    size_t nindex = ok ? ((size_t)1 << h->index_bits) + 1 : 0;
+    size_t nruns = ok ? ((size_t)1 << h->order_bits) + 1 : 0;
+    ok = ok && h->index_offset >= sizeof(snap_header) && h->index_offset % 8 == 0 &&
+         h->index_offset <= len && h->records_offset <= len && h->records_offset % 8 == 0 &&
+         h->index_offset + nindex * sizeof(uint64_t) <= h->records_offset &&
+         h->records <= (len - h->records_offset) / sizeof(snap_record) &&
+         h->names_offset == h->records_offset + h->records * sizeof(snap_record) &&
+         h->names_size <= len - h->names_offset &&
+         h->order_offset >= h->names_offset + h->names_size && h->order_offset % 8 == 0 &&
+         h->order_offset <= len && nruns * sizeof(uint64_t) <= len - h->order_offset &&
+         len - h->order_offset - nruns * sizeof(uint64_t) == h->records * sizeof(snap_order);
+    const uint64_t *index = ok ? (const uint64_t *)((const char *)map + h->index_offset) : NULL;
+    const uint64_t *runs = ok ? (const uint64_t *)((const char *)map + h->order_offset) : NULL;
+    ok = ok && header_crc(h, index, runs) == h->header_crc && index[0] == 0 &&
+         index[nindex - 1] == h->records && runs[0] == 0 && runs[nruns - 1] == h->records;
+    for (size_t p = 1; ok && p < nindex; ++p) ok = index[p - 1] <= index[p];
+    for (size_t p = 1; ok && p < nruns; ++p) ok = runs[p - 1] <= runs[p];
+    if (!ok) {
+        munmap(map, len);
+        errno = EINVAL;
+        return -1;
+    }
+    *map_out = map;
+    *len_out = len;
+    return 0;
+}
+
+int snap_load(const char *path) {
+    void *map;
+    size_t len;
+    if (map_snapshot(path, PROT_READ | PROT_WRITE, &map, &len) != 0) return -1;
+    const snap_header *h = map;
+    uint8_t *refs = calloc(h->records ? h->records : 1, 1);
+    uint8_t *moved = calloc(h->records ? h->records : 1, 1);
+    if (!refs || !moved) {
+        free(refs);
+        free(moved);
+        munmap(map, len);
+        return -1;
+    }
+    snap_unload();
+    base.map = map;
+    base.len = len;
+    base.bits = h->index_bits;
+    base.index = (const uint64_t *)((char *)map + h->index_offset);
+    base.recs = (snap_record *)((char *)map + h->records_offset);
+    base.names = (const char *)map + h->names_offset;
+    base.names_size = h->names_size;
+    base.n = h->records;
+    base.live = h->records;
+    base.wal_lsn = h->wal_lsn;
+    base.refs = refs;
+    base.runs = (const uint64_t *)((char *)map + h->order_offset);
+    if (h->order_bits == stripe_bits())
+        base.order = (const snap_order *)(base.runs + ((size_t)1 << h->order_bits) + 1);
+    base.moved = moved;
+    base.salary_sum = h->salary_sum;
+    /* every record of a file is live */
+    base.charged = h->records * BASE_RECORD_BYTES + h->names_size;
+    cache_charge((int64_t)base.charged);
+    /* lookups land anywhere in the records; don't read ahead around them */
+    madvise(map, len, MADV_RANDOM);
+    return 0;
+}
+
+int snap_verify(const char *path) {
+    void *map;
+    size_t len;
+    if (map_snapshot(path, PROT_READ, &map, &len) != 0) return -1;
+    const snap_header *h = map;
+    madvise(map, len, MADV_SEQUENTIAL);
+    uint32_t crc = crc32c(0, (const char *)map + h->records_offset, h->records * sizeof(snap_record));
+    crc = crc32c(crc, (const char *)map + h->names_offset, h->names_size);
+    size_t runs_size = (((size_t)1 << h->order_bits) + 1) * sizeof(uint64_t);
+    crc = crc32c(crc, (const char *)map + h->order_offset + runs_size, h->records * sizeof(snap_order));
+    int ok = crc == h->records_crc;
+    munmap(map, len);
+    if (!ok) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+void snap_unload(void) {
+    if (base.map) munmap(base.map, base.len);
+    cache_charge(-(int64_t)base.charged);
+    free(base.refs);
+    free(base.moved);
+    memset(&base, 0, sizeof(base));
+}
+
+uint64_t snap_wal_lsn(void) {
+    return base.wal_lsn;
+}
+
+/* index of the first base record whose key is >= key */
+static uint64_t lower_bound(uint64_t key) {
+    size_t p = prefix_of(key, base.bits);
+    uint64_t lo = base.index[p], hi = base.index[p + 1];
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (base.recs[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* A record's name, or NULL if the record points outside the names: only
+   the header and index are checked on load, so the records are checked
+   as they are used. */
+static const char *name_of(const snap_record *r) {
+    if (r->name_offset > base.names_size || r->name_len > base.names_size - r->name_offset) return NULL;
+    return base.names + r->name_offset;
+}
+
+/* the base record named name, or NULL if there is none or it was deleted */
+static snap_record *base_find(uint64_t key, const char *name) {
+    if (!base.map) return NULL;
+    size_t len = strlen(name);
+    for (uint64_t lo = lower_bound(key); lo < base.n && base.recs[lo].key == key; ++lo) {
+        snap_record *r = &base.recs[lo];
+        const char *stored = name_of(r);
+        if (stored && name_eq(stored, r->name_len, name, len))
+            return __atomic_load_n(&r->deleted, __ATOMIC_ACQUIRE) ? NULL : r;
+    }
+    return NULL;
+}
+
+static void copy_base(hashRecord *dst, const snap_record *src, const char *name) {
+    dst->hash = src->hash;
+    dst->salary = __atomic_load_n(&src->salary, __ATOMIC_RELAXED);
+    dst->key = src->key;
+    dst->name = name;
+}
+
+int base_search(uint64_t key, const char *name, hashRecord *out) {
+    snap_record *r = base_find(key, name);
+    if (!r) return -1;
+    copy_base(out, r, name);
+    cache_touch(&base.refs[r - base.recs]);
+    return 0;
+}
+
+int base_contains(uint64_t key, const char *name) {
+    return base_find(key, name) != NULL;
+}
+
+int base_update(uint64_t key, const char *name, const salary_op *op, hashRecord *out_old,
+                uint32_t *salary) {
+    snap_record *r = base_find(key, name);
+    if (!r) return -1;
+    if (out_old) copy_base(out_old, r, name);
+    cache_touch(&base.refs[r - base.recs]);
+    if (salary_apply(op, r->salary, salary) != 0) return -2;
+    uint8_t *moved = &base.moved[r - base.recs];
+    if (*moved) sidx_change(key, name, r->name_len, r->hash, r->salary, *salary);
+    else sidx_base_change(key, name, r->name_len, r->hash, r->salary, *salary, moved);
+    __atomic_store_n(&r->salary, *salary, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int base_delete(uint64_t key, const char *name, hashRecord *out_deleted) {
+    snap_record *r = base_find(key, name);
+    if (!r) return -1;
+    if (out_deleted) copy_base(out_deleted, r, name);
+    uint8_t *moved = &base.moved[r - base.recs];
+    if (*moved) sidx_remove(key, name, r->name_len, r->hash, r->salary);
+    else sidx_base_remove(key, r->salary, moved);
+    __atomic_store_n(&r->deleted, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_sub(&base.live, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&base.charged, BASE_RECORD_BYTES + r->name_len, __ATOMIC_RELAXED);
+    cache_charge(-(int64_t)(BASE_RECORD_BYTES + r->name_len));
+    return 0;
+}
+
+int base_index(void) {
+    if (base.order) {
+        sidx_base_totals(base.n, base.salary_sum);
+        return 0;
+    }
+    /* the runs are for other stripes: every record goes to the blocks */
+    if (base.n) memset(base.moved, 1, base.n);
+    for (uint64_t i = 0; i < base.n; ++i) {
+        const snap_record *r = &base.recs[i];
+        const char *name = name_of(r);
+        if (!name || r->deleted) continue;
+        if (sidx_add(r->key, name, r->name_len, r->hash, r->salary) != 0) return -1;
+    }
+    return 0;
+}
+
+int base_salary_range(size_t stripe, uint32_t lo, uint32_t hi, ht_recbuf *b) {
+    if (!base.order) return 0;
+    uint64_t i = base.runs[stripe], end = base.runs[stripe + 1];
+    for (uint64_t n = end - i; n > 0;) {
+        uint64_t half = n / 2;
+        if (base.order[i + half].salary < lo) {
+            i += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    for (; i < end && base.order[i].salary <= hi; ++i) {
+        const snap_order *o = &base.order[i];
+        if (o->rec >= base.n || base.moved[o->rec]) continue;
+        const snap_record *r = &base.recs[o->rec];
+        const char *name = name_of(r);
+        if (!name) continue;
+        hashRecord *dst = recbuf_push(b, name, r->name_len);
+        if (!dst) return -1;
+        dst->hash = o->hash;
+        dst->salary = o->salary;
+        dst->key = r->key;
+    }
+    return 0;
+}
+
+/* No lock: the hand is a shared counter, and a record's name and
+   deleted flag are safe to read at any time. */
+int base_clock_next(char *name) {
+    for (uint64_t n = 0; base.n > 0 && n <= 2 * base.n && base_count() > 0; ++n) {
+        uint64_t i = __atomic_fetch_add(&base.hand, 1, __ATOMIC_RELAXED) % base.n;
+        const snap_record *r = &base.recs[i];
+        const char *stored = name_of(r);
+        if (!stored || r->name_len > HT_NAME_MAX || __atomic_load_n(&r->deleted, __ATOMIC_ACQUIRE)) continue;
+        if (cache_clear_ref(&base.refs[i])) continue;
+        memcpy(name, stored, r->name_len);
+        name[r->name_len] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+size_t base_count(void) {
+    return __atomic_load_n(&base.live, __ATOMIC_RELAXED);
+}
+
+int base_collect_range(uint64_t from, uint64_t last, ht_recbuf *b) {
+    if (!base.map) return 0;
+    for (uint64_t i = lower_bound(from); i < base.n && base.recs[i].key <= last; ++i) {
+        const snap_record *r = &base.recs[i];
+        const char *name = name_of(r);
+        if (!name || __atomic_load_n(&r->deleted, __ATOMIC_ACQUIRE)) continue;
+        hashRecord *dst = recbuf_push(b, name, r->name_len);
+        if (!dst) return -1;
+        copy_base(dst, r, dst->name);
+    }
+    return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "chash.h"
+#include "ht_backend.h"
+
+/* Table snapshots.
+   A snapshot file holds every record, sorted by key, behind a radix index
+   on the top bits of the key, then the records' names, in record order
+   and without separators, and last the records again in salary order.
+   It uses offsets only, so it can be mapped at any address; ht_load maps
+   it privately and the table serves those records straight from the
+   mapping (the "base") instead of rebuilding the table, so loading costs
+   the same whatever the record count.
+
+   The salary order is one run per table stripe of the writer, each in
+   the salary index's order (salary_index.h), so the index serves the
+   base's records from the file as well.  A base record that is deleted
+   or re-salaried is marked as moved and from then on has an entry in the
+   index's own blocks, or none.  A build with a different stripe count
+   cannot use the runs and adds the records to the index one by one.
+
+   A record lives either in the base or in the backend's own storage,
+   never both: the backends consult the base when a key is not in their
+   storage, inserts fail if the base has the name, and updates and
+   deletes of a base record change it in place.  The mapping is private,
+   so those writes copy the touched pages and the file never changes.
+   Callers hold the key's stripe, as for the backend's own records. */
+
+#define SNAP_MAGIC "CHSNAPv1"
+#define SNAP_VERSION 4
+
+/* on-disk header; the index, the records, the names and the salary
+   order follow it */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;       /* sizeof(snap_header) */
+    uint32_t record_size;       /* sizeof(snap_record) */
+    uint32_t index_bits;        /* the index has 2^index_bits + 1 entries */
+    uint64_t key_check;         /* key_hash(SNAP_MAGIC) of the writer */
+    uint64_t records;
+    uint64_t index_offset;      /* from the start of the file */
+    uint64_t records_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t file_size;
+    uint64_t wal_lsn;           /* last write-ahead log record it includes (wal.h) */
+    uint64_t order_offset;      /* 2^order_bits + 1 run starts, then the entries */
+    uint64_t salary_sum;        /* of every record */
+    uint32_t order_bits;        /* runs by the top bits of the key */
+    uint32_t reserved;
+    uint32_t records_crc;       /* CRC-32C of the record array, the names and the
+                                   salary order entries as written */
+    uint32_t header_crc;        /* of this header (with header_crc 0), the index
+                                   and the run starts */
+} snap_header;
+
+typedef struct {
+    uint64_t key;
+    uint64_t name_offset;       /* from the start of the names */
+    uint32_t hash;
+    uint32_t salary;            /* changed in place by updates */
+    uint16_t name_len;
+    uint8_t deleted;            /* set in place by deletes */
+    uint8_t reserved[5];
+} snap_record;
+
+/* an entry of the salary order, standing for records[rec] */
+typedef struct {
+    uint32_t salary;
+    uint32_t hash;
+    uint64_t rec;
+} snap_order;
+
+/* Writes recs[0..n) (which it sorts by key) to path via a temporary file
+   that is synced and renamed over it.  wal_lsn is the last log record the
+   records include, 0 without a log.  0 or -1 with errno set. */
+int snap_write(const char *path, hashRecord *recs, size_t n, uint64_t wal_lsn);
+/* Maps path and checks its header and index (not the records, which would
+   read the whole file); on success the mapping replaces the base.  0 or -1. */
+int snap_load(const char *path);
+/* checks a snapshot file, including the record CRC, without loading it */
+int snap_verify(const char *path);
+/* unmaps the base */
+void snap_unload(void);
+/* wal_lsn of the loaded snapshot, 0 if none is loaded */
+uint64_t snap_wal_lsn(void);
+
+/* Base lookups and changes, as for the ht_* functions: 0 or -1 (update:
+   as the backends' update, see ht_backend.h, with the salary it set in
+   *salary).  Copies point their name at the caller's name. */
+int base_search(uint64_t key, const char *name, hashRecord *out);
+int base_contains(uint64_t key, const char *name);
+int base_update(uint64_t key, const char *name, const salary_op *op, hashRecord *out_old,
+                uint32_t *salary);
+int base_delete(uint64_t key, const char *name, hashRecord *out_deleted);
+/* Puts the base's records in the salary index (salary_index.h), which
+   is empty: only their totals when the file's runs match this build's
+   stripes, otherwise every record not deleted.  0 or -1 if out of memory. */
+int base_index(void);
+/* Appends the base records of the salary order's run for the given table
+   stripe with lo <= salary <= hi that have not moved, in order, to b;
+   the caller holds that stripe of the index.  0 or -1 if out of memory. */
+int base_salary_range(size_t stripe, uint32_t lo, uint32_t hi, ht_recbuf *b);
+/* The base's CLOCK hand (see clock_next in ht_backend.h), over the
+   records in file order: 0 with the name of the next record whose
+   reference byte was clear, or -1 if two turns found none. */
+int base_clock_next(char *name);
+/* records of the base not deleted */
+size_t base_count(void);
+/* appends the records of the base not deleted with keys in [from, last],
+   in key order, to b; 0 or -1 if out of memory */
+int base_collect_range(uint64_t from, uint64_t last, ht_recbuf *b);
+
+#endif /* SNAPSHOT_H */
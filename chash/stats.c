@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stats.h"
+
+static const char *const kind_names[ST_COUNT] = {
+    [ST_STRIPE_WAIT] = "stripe_lock_wait_ns",
+    [ST_STRIPE_HOLD] = "stripe_lock_hold_ns",
+    [ST_SCHED_WAIT] = "sched_mutex_wait_ns",
+    [ST_SCHED_HOLD] = "sched_mutex_hold_ns",
+    [ST_CHAIN_WALK] = "chain_walk_nodes",
+    [ST_OP_INSERT] = "insert_ns",
+    [ST_OP_DELETE] = "delete_ns",
+    [ST_OP_UPDATE] = "update_ns",
+    [ST_OP_SEARCH] = "search_ns",
+    [ST_OP_PRINT] = "print_ns",
+};
+
+const char *stats_kind_name(stats_kind kind) {
+    return kind_names[kind];
+}
+
+uint64_t stats_percentile(const stats_hist *h, double pct) {
+    uint64_t want = (uint64_t)((double)h->count * pct / 100.0 + 0.5), seen = 0;
+    if (h->count == 0) return 0;
+    if (want == 0) want = 1;
+    for (int i = 0; i < STATS_HIST_BUCKETS; ++i) {
+        seen += h->hist[i];
+        if (seen >= want) {
+            uint64_t top = i == 0 ? 0 : ((uint64_t)1 << i) - 1;
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
+
+__thread uint32_t stats_rng;
+
+#if HT_STATS
+
+/* The owning thread is the only writer of its block; it stores with
+   relaxed atomics so stats_collect can read the block while it runs.
+   Blocks of exited threads are folded into `retired` and recycled. */
+typedef struct stats_block {
+    ht_stats s;
+    struct stats_block *next;
+} stats_block;
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static stats_block *live_blocks;
+static stats_block *spare_blocks;
+static ht_stats retired;
+static pthread_key_t block_key;
+static pthread_once_t block_key_once = PTHREAD_ONCE_INIT;
+
+static __thread stats_block *my_block;
+
+static void add_stats(ht_stats *dst, const ht_stats *src) {
+    for (int k = 0; k < ST_COUNT; ++k) {
+        stats_hist *d = &dst->h[k];
+        const stats_hist *s = &src->h[k];
+        d->count += __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+        d->sum += __atomic_load_n(&s->sum, __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+        if (max > d->max) d->max = max;
+        for (int i = 0; i < STATS_HIST_BUCKETS; ++i)
+            d->hist[i] += __atomic_load_n(&s->hist[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void block_release(void *arg) {
+    stats_block *b = arg;
+    pthread_mutex_lock(&stats_mutex);
+    add_stats(&retired, &b->s);
+    for (stats_block **link = &live_blocks; *link; link = &(*link)->next) {
+        if (*link == b) {
+            *link = b->next;
+            break;
+        }
+    }
+    b->next = spare_blocks;
+    spare_blocks = b;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+static void make_block_key(void) {
+    pthread_key_create(&block_key, block_release);
+}
+
+static stats_block *block_register(void) {
+    pthread_once(&block_key_once, make_block_key);
+    pthread_mutex_lock(&stats_mutex);
+    stats_block *b = spare_blocks;
+    if (b) {
+        spare_blocks = b->next;
+    } else if (posix_memalign((void **)&b, 64, sizeof(*b)) != 0) {
+        pthread_mutex_unlock(&stats_mutex);
+        return NULL;
+    }
+    memset(&b->s, 0, sizeof(b->s));
+    b->next = live_blocks;
+    live_blocks = b;
+    pthread_mutex_unlock(&stats_mutex);
+    pthread_setspecific(block_key, b);
+    my_block = b;
+    return b;
+}
+
+static inline void bump(uint64_t *p, uint64_t by) {
+    __atomic_store_n(p, *p + by, __ATOMIC_RELAXED);
+}
+
+static inline int bucket_of(uint64_t v) {
+    if (v == 0) return 0;
+    int b = 64 - __builtin_clzll(v);
+    return b < STATS_HIST_BUCKETS ? b : STATS_HIST_BUCKETS - 1;
+}
+
+void stats_record(stats_kind kind, uint64_t value) {
+    stats_block *b = my_block ? my_block : block_register();
+    if (!b) return;
+    stats_hist *h = &b->s.h[kind];
+    bump(&h->count, 1);
+    bump(&h->sum, value);
+    if (value > h->max) __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+    bump(&h->hist[bucket_of(value)], 1);
+}
+
+void stats_collect(ht_stats *out) {
+    pthread_mutex_lock(&stats_mutex);
+    *out = retired;
+    for (stats_block *b = live_blocks; b; b = b->next) add_stats(out, &b->s);
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+void stats_reset(void) {
+    pthread_mutex_lock(&stats_mutex);
+    memset(&retired, 0, sizeof(retired));
+    for (stats_block *b = live_blocks; b; b = b->next) {
+        uint64_t *w = (uint64_t *)&b->s;
+        for (size_t i = 0; i < sizeof(b->s) / sizeof(uint64_t); ++i)
+            __atomic_store_n(&w[i], 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+#else /* !HT_STATS */
+
+void stats_record(stats_kind kind, uint64_t value) {
+    (void)kind;
+    (void)value;
+}
+
+void stats_collect(ht_stats *out) {
+    memset(out, 0, sizeof(*out));
+}
+
+void stats_reset(void) {
+}
+
+#endif /* HT_STATS */
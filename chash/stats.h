@@ -0,0 +1,114 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Contention and latency statistics.
+   Each thread counts into its own block, so recording takes no lock and
+   shares no cache line; the blocks are summed only when someone asks
+   (ht_get_stats, the `stats` command).  Reading the clock costs more than
+   most of the critical sections it would time, so only about one probe in
+   HT_STATS_SAMPLE is recorded, picked at random so that probes that
+   always come in the same order can't alias with the sampling period.
+   Build with -DHT_STATS=0 (`make STATS=0`) to compile every probe out. */
+#ifndef HT_STATS
+#define HT_STATS 1
+#endif
+#ifndef HT_STATS_SAMPLE
+#define HT_STATS_SAMPLE 16      /* power of two; 1 records every probe */
+#endif
+#if (HT_STATS_SAMPLE & (HT_STATS_SAMPLE - 1)) != 0 || HT_STATS_SAMPLE < 1
+#error "HT_STATS_SAMPLE must be a power of two"
+#endif
+
+typedef enum {
+    ST_STRIPE_WAIT,         /* ns to acquire a table stripe lock */
+    ST_STRIPE_HOLD,         /* ns a stripe lock was held */
+    ST_SCHED_WAIT,          /* ns to acquire sched_mutex */
+    ST_SCHED_HOLD,          /* ns sched_mutex was held, condition waits excluded */
+    ST_CHAIN_WALK,          /* nodes visited per chain walk (swiss: groups probed) */
+    ST_OP_INSERT,           /* ns per table operation */
+    ST_OP_DELETE,
+    ST_OP_UPDATE,
+    ST_OP_SEARCH,
+    ST_OP_PRINT,
+    ST_COUNT
+} stats_kind;
+
+/* bucket 0 counts zeros, bucket i values in [2^(i-1), 2^i) */
+#define STATS_HIST_BUCKETS 48
+
+typedef struct {
+    uint64_t count;         /* samples */
+    uint64_t sum;
+    uint64_t max;
+    uint64_t hist[STATS_HIST_BUCKETS];
+} stats_hist;
+
+typedef struct {
+    stats_hist h[ST_COUNT];
+} ht_stats;
+
+/* adds value to the calling thread's histogram for kind */
+void stats_record(stats_kind kind, uint64_t value);
+/* sums every thread's counters, including threads that have exited */
+void stats_collect(ht_stats *out);
+/* zeroes everything; only meaningful while no thread is recording */
+void stats_reset(void);
+
+const char *stats_kind_name(stats_kind kind);
+/* upper bound of the bucket holding the pct-th percentile (capped at max) */
+uint64_t stats_percentile(const stats_hist *h, double pct);
+
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+extern __thread uint32_t stats_rng;
+
+/* true for about one call in HT_STATS_SAMPLE (xorshift32 per thread) */
+static inline int stats_sampled(void) {
+    uint32_t x = stats_rng ? stats_rng : (uint32_t)(uintptr_t)&stats_rng | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    stats_rng = x;
+    return (x & (HT_STATS_SAMPLE - 1)) == 0;
+}
+
+/* start time of a sampled interval, 0 if this one is skipped */
+static inline uint64_t stats_start(void) {
+    return stats_sampled() ? stats_now() : 0;
+}
+
+/* Probes: STATS_TIME declares a start time, STATS_MARK restarts it and
+   STATS_SINCE records the ns elapsed since it, if the start was sampled.
+   STATS_LAP records the same and restarts the clock at the moment it read,
+   so a wait and the hold that follows it are sampled together and cost
+   one clock read between them. */
+#if HT_STATS
+#define STATS_TIME(t) uint64_t t = stats_start()
+#define STATS_MARK(t) ((t) = stats_start())
+#define STATS_SINCE(kind, t) do { \
+        if (t) stats_record(kind, stats_now() - (t)); \
+    } while (0)
+#define STATS_LAP(kind, t, restart) do { \
+        uint64_t lap_now_ = (t) ? stats_now() : 0; \
+        if (t) stats_record(kind, lap_now_ - (t)); \
+        (restart) = lap_now_; \
+    } while (0)
+#define STATS_VALUE(kind, v) do { \
+        if (stats_sampled()) stats_record(kind, v); \
+    } while (0)
+#else
+#define STATS_TIME(t) do { } while (0)
+#define STATS_MARK(t) ((void)0)
+#define STATS_SINCE(kind, t) ((void)0)
+#define STATS_LAP(kind, t, restart) ((void)0)
+#define STATS_VALUE(kind, v) ((void)(v))
+#endif
+
+#endif /* STATS_H */
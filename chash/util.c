@@ -0,0 +1,148 @@
+#include <stddef.h>
+#include <string.h>
+#include <sys/time.h>
+#include "chash.h"
+
+/* utilities shared by chash and chash-bench */
+
+long long current_timestamp_us(void) {
+    struct timeval te;
+    gettimeofday(&te, NULL);
+    return (long long)te.tv_sec * 1000000LL + te.tv_usec;
+}
+
+/* Jenkins one-at-a-time hash */
+uint32_t jenkins_one_at_a_time_hash(const char *key) {
+    uint32_t hash = 0;
+    while (*key) {
+        hash += (unsigned char)(*key++);
+        hash += (hash << 10);
+        hash ^= (hash >> 6);
+    }
+    hash += (hash << 3);
+    hash ^= (hash >> 11);
+    hash += (hash << 15);
+    return hash;
+}
+
+/* CRC-32C (Castagnoli), one table lookup per byte.  The table is
+   built on first use; building it twice concurrently is harmless. */
+static uint32_t crc_table[256];
+static int crc_ready;
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len) {
+    if (!__atomic_load_n(&crc_ready, __ATOMIC_ACQUIRE)) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+            crc_table[i] = c;
+        }
+        __atomic_store_n(&crc_ready, 1, __ATOMIC_RELEASE);
+    }
+    const unsigned char *p = buf;
+    crc = ~crc;
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* Key hash: the table places records by it and compares it before the
+   name, so only a 64-bit collision costs a string compare.  wyhash
+   (final v4, public domain) reads the name eight bytes at a time; build
+   with -DCHASH_KEY_HASH_JENKINS (`make HASH=jenkins`) to use the
+   one-at-a-time hash above, spread to 64 bits, instead. */
+#ifndef CHASH_KEY_HASH_JENKINS
+
+static inline uint64_t wymix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+static inline uint64_t wyr8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+static inline uint64_t wyr4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+static inline uint64_t wyr3(const uint8_t *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+static const uint64_t wysecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+static uint64_t wyhash(const void *key, size_t len, uint64_t seed) {
+    const uint8_t *p = key;
+    uint64_t a, b;
+    seed ^= wymix(seed ^ wysecret[0], wysecret[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ wysecret[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ wysecret[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ wysecret[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ wysecret[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+    a ^= wysecret[1];
+    b ^= seed;
+    __uint128_t r = (__uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+    return wymix(a ^ wysecret[0] ^ len, b ^ wysecret[1]);
+}
+
+uint64_t key_hash_len(const char *key, size_t len) {
+    return wyhash(key, len, 0);
+}
+
+#else
+
+uint64_t key_hash_len(const char *key, size_t len) {
+    /* one-at-a-time over len bytes, as jenkins_one_at_a_time_hash above */
+    uint32_t h = 0;
+    for (size_t i = 0; i < len; ++i) {
+        h += (unsigned char)key[i];
+        h += (h << 10);
+        h ^= (h >> 6);
+    }
+    h += (h << 3);
+    h ^= (h >> 11);
+    h += (h << 15);
+    /* splitmix64 finalizer: a bijection, so collisions stay Jenkins' own */
+    uint64_t z = h;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+#endif
+
+uint64_t key_hash(const char *key) {
+    return key_hash_len(key, strlen(key));
+}
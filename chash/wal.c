@@ -0,0 +1,291 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "wal.h"
+#include "chash.h"
+
+typedef struct {
+    char *p;
+    size_t cap;
+} wal_buf;
+
+/* Appenders fill cur under mu; the leader of a group swaps it with spare,
+   drops mu for the write and fdatasync, then publishes durable_lsn. */
+static struct {
+    pthread_mutex_t mu;
+    pthread_cond_t cv;          /* a group write finished */
+    wal_buf cur, spare;
+    size_t len;                 /* bytes pending in cur */
+    uint64_t last_lsn;          /* last appended */
+    uint64_t durable_lsn;       /* last on disk */
+    int flushing;               /* a leader is gathering or writing a group */
+    wal_stats st;
+} wal = { .mu = PTHREAD_MUTEX_INITIALIZER, .cv = PTHREAD_COND_INITIALIZER };
+
+static int wal_fd = -1;
+static int wal_on;              /* changed only while no operation runs */
+static unsigned flush_interval_us;
+static pthread_rwlock_t ckpt_lock;
+
+static __thread uint64_t my_lsn;        /* last record this thread appended */
+
+static size_t pad8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static void make_header(wal_file_header *h) {
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, WAL_MAGIC, sizeof(h->magic));
+    h->version = WAL_VERSION;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t w = write(fd, buf, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+long wal_scan(const char *path, int (*fn)(const wal_entry *e, void *ctx), void *ctx,
+              uint64_t *valid_len, uint64_t *last_lsn) {
+    *valid_len = 0;
+    *last_lsn = 0;
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    wal_file_header h, want;
+    make_header(&want);
+    size_t got = fread(&h, 1, sizeof(h), f);
+    if (memcmp(&h, &want, got) != 0) {
+        fclose(f);
+        errno = EINVAL;
+        return -1;
+    }
+    if (got < sizeof(h)) {
+        /* crashed while creating it */
+        fclose(f);
+        return 0;
+    }
+    *valid_len = sizeof(h);
+
+    char name[WAL_NAME_MAX + 8];
+    long n = 0;
+    wal_record r;
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        size_t body = pad8(r.name_len);
+        if (r.name_len > WAL_NAME_MAX || r.lsn != *last_lsn + 1 ||
+            fread(name, 1, body, f) != body ||
+            crc32c(crc32c(0, (const char *)&r + sizeof(r.crc), sizeof(r) - sizeof(r.crc)), name, body) != r.crc)
+            break;
+        name[r.name_len] = '\0';
+        wal_entry e = { r.lsn, (wal_op)r.type, r.salary, name };
+        if (fn && fn(&e, ctx) != 0) {
+            int saved = errno;
+            fclose(f);
+            errno = saved;
+            return -1;
+        }
+        *valid_len += sizeof(r) + body;
+        *last_lsn = r.lsn;
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+/* syncs the directory holding path, so a new log's entry is durable */
+static int sync_dir(const char *path) {
+    char *copy = strdup(path);
+    if (!copy) return -1;
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    free(copy);
+    if (fd < 0) return -1;
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+int wal_open(const char *path, uint64_t valid_len, uint64_t last_lsn, unsigned flush_us) {
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd < 0) return -1;
+    int ok;
+    if (valid_len == 0) {
+        wal_file_header h;
+        make_header(&h);
+        ok = ftruncate(fd, 0) == 0 && write_all(fd, (const char *)&h, sizeof(h)) == 0 &&
+             fdatasync(fd) == 0 && sync_dir(path) == 0;
+    } else {
+        /* drop a torn tail so new records follow the last intact one */
+        ok = ftruncate(fd, (off_t)valid_len) == 0 && lseek(fd, 0, SEEK_END) >= 0 &&
+             fdatasync(fd) == 0;
+    }
+    if (!ok) {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    /* prefer the snapshot's exclusive hold, or a steady stream of changes
+       could keep it waiting forever */
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&ckpt_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+
+    wal_fd = fd;
+    wal.len = 0;
+    wal.last_lsn = wal.durable_lsn = last_lsn;
+    wal.flushing = 0;
+    memset(&wal.st, 0, sizeof(wal.st));
+    flush_interval_us = flush_us;
+    wal_on = 1;
+    return 0;
+}
+
+static void sleep_us(unsigned us) {
+    struct timespec ts = { us / 1000000, (long)(us % 1000000) * 1000 };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {}
+}
+
+/* Writes the pending records as one group; called with mu held and
+   flushing set, and drops mu while writing.  A log that can't be written
+   can't promise anything about the changes already applied, so that is
+   fatal. */
+static void write_group(void) {
+    wal_buf out = wal.cur;
+    size_t len = wal.len;
+    uint64_t upto = wal.last_lsn;
+    wal.cur = wal.spare;
+    wal.len = 0;
+    pthread_mutex_unlock(&wal.mu);
+
+    if (write_all(wal_fd, out.p, len) != 0 || fdatasync(wal_fd) != 0) {
+        perror("write-ahead log");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&wal.mu);
+    wal.spare = out;
+    wal.durable_lsn = upto;
+    wal.st.syncs++;
+}
+
+void wal_close(void) {
+    if (!wal_on) return;
+    pthread_mutex_lock(&wal.mu);
+    while (wal.flushing) pthread_cond_wait(&wal.cv, &wal.mu);
+    if (wal.len) write_group();
+    pthread_mutex_unlock(&wal.mu);
+    close(wal_fd);
+    wal_fd = -1;
+    free(wal.cur.p);
+    free(wal.spare.p);
+    memset(&wal.cur, 0, sizeof(wal.cur));
+    memset(&wal.spare, 0, sizeof(wal.spare));
+    pthread_rwlock_destroy(&ckpt_lock);
+    wal_on = 0;
+}
+
+int wal_active(void) {
+    return wal_on;
+}
+
+void wal_append(wal_op type, const char *name, uint32_t salary) {
+    if (!wal_on) return;
+    size_t nlen = strnlen(name, WAL_NAME_MAX);
+    size_t len = sizeof(wal_record) + pad8(nlen);
+
+    pthread_mutex_lock(&wal.mu);
+    if (wal.len + len > wal.cur.cap) {
+        size_t cap = wal.cur.cap ? wal.cur.cap : 64 * 1024;
+        while (cap < wal.len + len) cap *= 2;
+        char *p = realloc(wal.cur.p, cap);
+        if (!p) {
+            perror("write-ahead log");
+            exit(1);
+        }
+        wal.cur.p = p;
+        wal.cur.cap = cap;
+    }
+    wal_record *r = (wal_record *)(wal.cur.p + wal.len);
+    memset(r, 0, len);
+    r->type = (uint16_t)type;
+    r->name_len = (uint16_t)nlen;
+    r->salary = salary;
+    r->lsn = ++wal.last_lsn;
+    memcpy(r + 1, name, nlen);
+    r->crc = crc32c(0, (const char *)r + sizeof(r->crc), len - sizeof(r->crc));
+    wal.len += len;
+    wal.st.records++;
+    wal.st.bytes += len;
+    my_lsn = r->lsn;
+    pthread_mutex_unlock(&wal.mu);
+}
+
+void wal_sync(void) {
+    uint64_t lsn = my_lsn;
+    if (lsn == 0) return;
+    my_lsn = 0;
+    pthread_mutex_lock(&wal.mu);
+    wal.st.commits++;
+    while (wal.durable_lsn < lsn) {
+        if (wal.flushing) {
+            pthread_cond_wait(&wal.cv, &wal.mu);
+            continue;
+        }
+        /* lead the next group: give other changes the interval to join */
+        wal.flushing = 1;
+        if (flush_interval_us) {
+            pthread_mutex_unlock(&wal.mu);
+            sleep_us(flush_interval_us);
+            pthread_mutex_lock(&wal.mu);
+        }
+        write_group();
+        wal.flushing = 0;
+        pthread_cond_broadcast(&wal.cv);
+    }
+    pthread_mutex_unlock(&wal.mu);
+}
+
+uint64_t wal_last_lsn(void) {
+    pthread_mutex_lock(&wal.mu);
+    uint64_t lsn = wal.last_lsn;
+    pthread_mutex_unlock(&wal.mu);
+    return lsn;
+}
+
+void wal_change_begin(void) {
+    if (wal_on) pthread_rwlock_rdlock(&ckpt_lock);
+}
+
+void wal_change_end(void) {
+    if (wal_on) pthread_rwlock_unlock(&ckpt_lock);
+}
+
+void wal_checkpoint_begin(void) {
+    if (wal_on) pthread_rwlock_wrlock(&ckpt_lock);
+}
+
+void wal_checkpoint_end(void) {
+    if (wal_on) pthread_rwlock_unlock(&ckpt_lock);
+}
+
+void wal_get_stats(wal_stats *out) {
+    pthread_mutex_lock(&wal.mu);
+    *out = wal.st;
+    pthread_mutex_unlock(&wal.mu);
+}
@@ -0,0 +1,102 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Write-ahead log of table changes.
+   The backends append a record for every change they apply, while they
+   still hold the key's stripe, so records of one key are in the order the
+   changes happened.  Appending only copies the record into a buffer; the
+   ht_* call that made the change then waits in wal_sync() until the
+   buffer has reached the disk.
+
+   Group commit: the first waiter to find no write in progress becomes the
+   leader.  It waits out the flush interval, so that more changes can join
+   its group, then writes everything appended so far with one write and
+   one fdatasync and wakes every waiter the write covered.  Changes made
+   while it writes go to a second buffer and form the next group.
+
+   Snapshots and loads are logged too, so recovery can start from the last
+   snapshot and replay only the records after it (ht_wal_open). */
+
+#define WAL_MAGIC "CHWALv1"
+#define WAL_VERSION 1
+#define WAL_NAME_MAX 4096       /* longest name or path a record holds */
+
+typedef enum {
+    WAL_INSERT = 1,             /* name, salary */
+    WAL_DELETE,                 /* name */
+    WAL_UPDATE,                 /* name, salary = new salary */
+    WAL_SNAPSHOT,               /* name = path of a snapshot just written */
+    WAL_LOAD                    /* name = path of a snapshot just loaded */
+} wal_op;
+
+/* on-disk header, followed by records */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} wal_file_header;
+
+/* record header; name_len bytes of name follow, zero-padded to 8 */
+typedef struct {
+    uint32_t crc;               /* CRC-32C of the rest of the record */
+    uint16_t type;              /* wal_op */
+    uint16_t name_len;
+    uint32_t salary;
+    uint32_t reserved;
+    uint64_t lsn;               /* 1, 2, 3, ... in file order */
+} wal_record;
+
+/* a record as read back; name is NUL-terminated */
+typedef struct {
+    uint64_t lsn;
+    wal_op type;
+    uint32_t salary;
+    const char *name;
+} wal_entry;
+
+typedef struct {
+    unsigned long records;      /* appended since wal_open */
+    unsigned long commits;      /* wal_sync calls that had records to wait for */
+    unsigned long syncs;        /* group writes, one fdatasync each */
+    uint64_t bytes;
+} wal_stats;
+
+/* Calls fn for each intact record of the log at path, in order, and sets
+   *valid_len to the length of the file up to the last of them (a torn
+   write at the end stops the scan) and *last_lsn to that record's LSN.
+   fn returns 0 to go on; -1 stops the scan, which then fails with the
+   errno fn left.  Returns the records passed to fn, or -1 with errno set
+   (ENOENT: no log; EINVAL: not a log). */
+long wal_scan(const char *path, int (*fn)(const wal_entry *e, void *ctx), void *ctx,
+              uint64_t *valid_len, uint64_t *last_lsn);
+
+/* Opens the log at path for appending, creating it if needed and
+   dropping anything after valid_len; LSNs continue from last_lsn.
+   flush_us is the group commit interval.  0 or -1 with errno set. */
+int wal_open(const char *path, uint64_t valid_len, uint64_t last_lsn, unsigned flush_us);
+/* writes out anything still buffered and closes the log */
+void wal_close(void);
+int wal_active(void);
+
+/* Appends a record (no-op while no log is open); callers hold the
+   stripe of the changed key, or run alone. */
+void wal_append(wal_op type, const char *name, uint32_t salary);
+/* waits until every record this thread appended is on disk */
+void wal_sync(void);
+/* lsn of the last record appended, 0 if none */
+uint64_t wal_last_lsn(void);
+
+/* Changes hold the log's checkpoint lock shared from applying a change
+   until its record is appended; a snapshot holds it exclusively while it
+   copies the table, so the copy matches a point in the log. */
+void wal_change_begin(void);
+void wal_change_end(void);
+void wal_checkpoint_begin(void);
+void wal_checkpoint_end(void);
+
+void wal_get_stats(wal_stats *out);
+
+#endif /* WAL_H */
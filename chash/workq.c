@@ -0,0 +1,53 @@
+#include <stdlib.h>
+#include "workq.h"
+
+int workq_init(workq *q, int cap) {
+    q->items = malloc(sizeof(void *) * (cap > 0 ? cap : 1));
+    if (!q->items) return -1;
+    q->cap = cap > 0 ? cap : 1;
+    q->head = 0;
+    q->count = 0;
+    pthread_mutex_init(&q->mutex, NULL);
+    return 0;
+}
+
+void workq_destroy(workq *q) {
+    pthread_mutex_destroy(&q->mutex);
+    free(q->items);
+    q->items = NULL;
+}
+
+int workq_push(workq *q, void *item) {
+    pthread_mutex_lock(&q->mutex);
+    if (q->count == q->cap) {
+        pthread_mutex_unlock(&q->mutex);
+        return -1;
+    }
+    q->items[(q->head + q->count) % q->cap] = item;
+    q->count++;
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+void *workq_pop(workq *q) {
+    void *item = NULL;
+    pthread_mutex_lock(&q->mutex);
+    if (q->count > 0) {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return item;
+}
+
+void *workq_steal(workq *q) {
+    void *item = NULL;
+    pthread_mutex_lock(&q->mutex);
+    if (q->count > 0) {
+        q->count--;
+        item = q->items[(q->head + q->count) % q->cap];
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return item;
+}
@@ -0,0 +1,30 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+
+#include <pthread.h>
+
+/* Bounded work queue for the worker pool.
+   The owning worker takes items from the head (oldest first); idle workers
+   steal from the tail so they disturb the owner's next item as little as
+   possible. */
+
+typedef struct {
+    pthread_mutex_t mutex;      /* protects everything below */
+    void **items;
+    int cap;
+    int head;                   /* index of the oldest item */
+    int count;
+} workq;
+
+/* returns 0, or -1 if the buffer cannot be allocated */
+int workq_init(workq *q, int cap);
+void workq_destroy(workq *q);
+
+/* append at the tail; returns -1 when the queue is full */
+int workq_push(workq *q, void *item);
+/* owner side: remove the oldest item, NULL when empty */
+void *workq_pop(workq *q);
+/* thief side: remove the newest item, NULL when empty */
+void *workq_steal(workq *q);
+
+#endif /* WORKQ_H */